@@ -0,0 +1,94 @@
+#include "acpi.h"
+#include "util.h"
+
+// Just enough ACPI to count the CPUs: find the RSDP, walk the RSDT and
+// read the processor entries of the MADT ("APIC" table).
+
+typedef struct {
+    char signature[8];                  // "RSD PTR "
+    unsigned char checksum;
+    char oem[6];
+    unsigned char revision;
+    unsigned int rsdt;
+} __attribute__((packed)) Rsdp;
+
+typedef struct {
+    char signature[4];
+    unsigned int length;
+    unsigned char revision;
+    unsigned char checksum;
+    char oem[6];
+    char oem_table[8];
+    unsigned int oem_revision;
+    unsigned int creator;
+    unsigned int creator_revision;
+} __attribute__((packed)) SdtHeader;
+
+typedef struct {
+    SdtHeader header;
+    unsigned int lapic_address;
+    unsigned int flags;
+} __attribute__((packed)) Madt;
+
+#define BDA_EBDA_SEGMENT 0x40E   // BIOS data area: EBDA segment
+
+#define MADT_LOCAL_APIC 0
+#define LAPIC_ENABLED   1
+
+static int checksum_ok(const void* data, unsigned int length) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    unsigned char sum = 0;
+    for (unsigned int i = 0; i < length; i++) sum += bytes[i];
+    return sum == 0;
+}
+
+static const Rsdp* scan_rsdp(unsigned int start, unsigned int length) {
+    for (unsigned int address = start; address + sizeof(Rsdp) <= start + length; address += 16) {
+        const Rsdp* rsdp = (const Rsdp*)address;
+        if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 && checksum_ok(rsdp, sizeof(Rsdp))) return rsdp;
+    }
+    return 0;
+}
+
+// The RSDP is in the first KB of the EBDA or in the BIOS area below 1 MB
+static const Rsdp* find_rsdp() {
+    unsigned int ebda = (unsigned int)*(const unsigned short*)BDA_EBDA_SEGMENT << 4;
+    const Rsdp* rsdp = ebda ? scan_rsdp(ebda, 1024) : 0;
+    return rsdp ? rsdp : scan_rsdp(0xE0000, 0x20000);
+}
+
+static const Madt* find_madt() {
+    const Rsdp* rsdp = find_rsdp();
+    if (!rsdp) return 0;
+
+    const SdtHeader* rsdt = (const SdtHeader*)rsdp->rsdt;
+    if (memcmp(rsdt->signature, "RSDT", 4) != 0 || !checksum_ok(rsdt, rsdt->length)) return 0;
+
+    const unsigned int* entries = (const unsigned int*)(rsdt + 1);
+    int count = (rsdt->length - sizeof(SdtHeader)) / 4;
+    for (int i = 0; i < count; i++) {
+        const SdtHeader* table = (const SdtHeader*)entries[i];
+        if (memcmp(table->signature, "APIC", 4) == 0 && checksum_ok(table, table->length)) {
+            return (const Madt*)table;
+        }
+    }
+    return 0;
+}
+
+int acpi_find_cpus(unsigned char* apic_ids, int max, unsigned int* lapic_address) {
+    const Madt* madt = find_madt();
+    if (!madt) return 0;
+
+    *lapic_address = madt->lapic_address;
+    int found = 0;
+    const unsigned char* entry = (const unsigned char*)(madt + 1);
+    const unsigned char* end = (const unsigned char*)madt + madt->header.length;
+    while (entry + 2 <= end && entry[1] >= 2) {
+        // type, length, ACPI processor id, APIC id, flags
+        if (entry[0] == MADT_LOCAL_APIC && (*(const unsigned int*)(entry + 4) & LAPIC_ENABLED) && found < max) {
+            apic_ids[found++] = entry[3];
+        }
+        entry += entry[1];
+    }
+    return found;
+}
@@ -0,0 +1,8 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+// Local APIC IDs of the enabled CPUs listed in the ACPI MADT; returns how
+// many were found (0 without ACPI) and the local APIC base address
+int acpi_find_cpus(unsigned char* apic_ids, int max, unsigned int* lapic_address);
+
+#endif
@@ -1,20 +1,20 @@
 #include "basic.h"
+#include "bytecode.h"
+#include "fs.h"
+#include "heap.h"
+#include "jit.h"
+#include "keyboard.h"
+#include "optimize.h"
+#include "program.h"
 #include "util.h"
 
-#define MAX_LINES 64
-
-int stack[128] = {0};
-int sp = 0;
-
 int returnToCMD = 0;
 
-typedef struct {
-    int number;
-    char content[64];
-} BasicLine;
-
-BasicLine program[MAX_LINES];
-int line_count = 0;
+// Compiled form of the current program, rebuilt on 'run' after any edit
+Bytecode compiled = {0};
+int compiled_valid = 0;
+JitCode jitted = {0};
+OptimizeStats optimize_stats = {0};
 
 void itoa(int value, char* buffer, int base) {
     if (base < 2 || base > 16) {
@@ -57,111 +57,76 @@ void itoa(int value, char* buffer, int base) {
 
 
 void clear_program() {
-    for (int i = 0; i < MAX_LINES; i++) {
-        program[i].number = 0;
-        program[i].content[0] = 0;
-    }
-    line_count = 0;
+    program_clear();
+    compiled_valid = 0;
 }
 
 int find_line_index(int number) {
-    for (int i = 0; i < line_count; i++) {
-        if (program[i].number == number)
-            return i;
-    }
-    return -1;
+    return program_find_line(number);
 }
 
-void list_program() {
-    for (int i = 0; i < line_count; i++) {
-        print_string("\n");
-        char num[6];
-        int n = program[i].number;
-        int pos = 0;
-        if (n == 0) num[pos++] = '0';
-        else {
-            char tmp[6];
-            int len = 0;
-            while (n > 0) {
-                tmp[len++] = '0' + (n % 10);
-                n /= 10;
-            }
-            while (len--) num[pos++] = tmp[len];
-        }
-        num[pos] = 0;
-        print_string(num);
-        print_string(" ");
-        print_string(program[i].content);
-    }
-}
-
-void add_line(int number, const char* content) {
-    for (int i = 0; i < line_count; i++) {
-        if (program[i].number == number) {
-            print_string("Replacing line ");
-            char buf[16];
-            itoa(number, buf, 10);
-            print_string(buf);
-            print_string("\n");
-
-            // Properly clear and overwrite
-            for (int j = 0; j < 64; j++) {
-                program[i].content[j] = 0;
-            }
-            for (int j = 0; content[j] && j < 63; j++) {
-                program[i].content[j] = content[j];
-            }
-            program[i].content[63] = 0; // Ensure null-termination
-            return;
-        }
+// Ask before scrolling a long listing off the screen. Returns 0 to stop,
+// otherwise how many more rows may be printed without asking.
+static int pager_prompt() {
+    const char* prompt = "-- more -- (space: page, enter: line, q: quit)";
+    print_string("\n");
+    print_string(prompt);
+    char* key = get_keypress();
+
+    // Remove the prompt again so the listing continues on its row
+    for (int i = string_length(prompt); i > 0; i--) {
+        cursor_pos--;
+        video_memory[cursor_pos * 2] = ' ';
+        video_memory[cursor_pos * 2 + 1] = color;
     }
+    cursor_pos -= WIDTH;
+    update_cursor();
 
-    // Insert new line if not found
-    if (line_count < MAX_LINES) {
-        int i = 0;
-        while (i < line_count && program[i].number < number) i++;
-        for (int j = line_count; j > i; j--) {
-            program[j] = program[j - 1];
-        }
-
-        program[i].number = number;
-        for (int j = 0; j < 64; j++) {
-            program[i].content[j] = 0;
-        }
-        for (int j = 0; content[j] && j < 63; j++) {
-            program[i].content[j] = content[j];
-        }
-        program[i].content[63] = 0;
-        line_count++;
-    }
+    if (key[0] == 'q' || key[0] == 27) return 0;
+    if (key[0] == '\n') return 1;
+    return HEIGHT - 2;
 }
 
+void list_program() {
+    // Only page on the screen, not into pipes, files or the serial log
+    int paging = output_sink == 0;
+    int rows_left = HEIGHT - 2;
+    ProgramCursor cursor = program_begin();
+    int number;
+    const char* text;
+    char buffer[12];
+
+    while (program_next(&cursor, &number, &text)) {
+        int rows = 1 + (string_length(text) + 7) / WIDTH;
+        if (paging && rows > rows_left) {
+            rows_left = pager_prompt();
+            if (!rows_left) return;
+        }
+        rows_left -= rows;
 
-void push_stack(int value) {
-    if (sp < 128) {
-        stack[++sp] = value;
-    } else {
-        print_string("Stack Overflow");
+        print_string("\n");
+        itoa(number, buffer, 10);
+        print_string(buffer);
+        print_string(" ");
+        print_string(text);
     }
 }
 
-int pop_stack() {
-    if (sp > 0) {
-        return stack[sp--];
-    } else {
-        print_string("Stack Underflow");
-        return 0;
+void add_line(int number, const char* content) {
+    compiled_valid = 0;
+
+    int result = program_set_line(number, content);
+    if (result == LINE_REPLACED) {
+        char buf[16];
+        print_string("Replacing line ");
+        itoa(number, buf, 10);
+        print_string(buf);
+        print_string("\n");
+    } else if (!result) {
+        print_string("\nProgram too large");
     }
 }
 
-int stack_top() {
-    if (sp > 0) {
-        return stack[sp - 1];
-    } else {
-        print_string("Stack is empty\n");
-        return 0;
-    }
-}
 
 int read_number() {
     char buffer[16];
@@ -170,8 +135,7 @@ int read_number() {
     print_string("Enter number: ");
 
     while (index < 15) {
-        while (!(inb(0x64) & 1)); // wait for keypress
-        unsigned char scancode = inb(0x60);
+        unsigned char scancode = keyboard_read();
 
         // Basic US QWERTY scancode to ASCII mapping for 0–9 and Enter
         char c = 0;
@@ -200,132 +164,517 @@ int read_number() {
     return result;
 }
 
+static int ensure_compiled() {
+    if (compiled_valid) return 1;
+
+    free_bytecode(&compiled);
+    jit_free(&jitted);
+    if (!compile_program(&compiled)) return 0;
+    optimize_bytecode(&compiled, &optimize_stats);
+    compiled_valid = 1;
+    return 1;
+}
+
+static int ensure_jitted() {
+    if (!ensure_compiled()) return 0;
+    if (jitted.code) return 1;
+    if (!jit_compile(&compiled, &jitted)) {
+        print_string("\nOut of memory for native code");
+        return 0;
+    }
+    return 1;
+}
+
 void run_program() {
-    int pc = 0;
-
-    while (pc < line_count) {
-        // Allow breaking with 'c'
-        if (inb(0x64) & 1) {
-            unsigned char code = inb(0x60);
-            if (code == 0x2E) { // scancode for 'c'
-                print_string("\nprogram interrupted by 'c'\n");
-                break;
-            }
+    if (!ensure_compiled()) return;
+    reset_program_state();
+    execute_bytecode(&compiled, 0);
+}
+
+void run_program_jit() {
+    if (!ensure_jitted()) return;
+    reset_program_state();
+    jit_execute(&compiled, &jitted);
+}
+
+#define PROFILE_TOP 10
+
+// Shift a 64-bit value and its total down until plain 32-bit maths works
+static int percent_of(unsigned long long value, unsigned long long total) {
+    while (total > 0x00FFFFFF) {
+        value >>= 1;
+        total >>= 1;
+    }
+    return total ? (int)((unsigned int)value * 100 / (unsigned int)total) : 0;
+}
+
+// Run the program with per-line counters and print the lines that used the
+// most cycles, hottest first
+void profile_program() {
+    if (!ensure_compiled()) return;
+
+    int lines = compiled.line_count + 1;
+    Profile profile;
+    profile.counts = (unsigned int*)kzalloc(lines * sizeof(unsigned int));
+    profile.cycles = (unsigned long long*)kzalloc(lines * sizeof(unsigned long long));
+    char* shown = (char*)kzalloc(lines);
+    if (!profile.counts || !profile.cycles || !shown) {
+        print_string("\nOut of memory");
+        kfree(profile.counts);
+        kfree(profile.cycles);
+        kfree(shown);
+        return;
+    }
+
+    reset_program_state();
+    execute_bytecode(&compiled, &profile);
+
+    unsigned long long total = 0;
+    for (int i = 0; i < lines; i++) total += profile.cycles[i];
+
+    char buffer[24];
+    print_string("\nline  count       cycles          %    source\n");
+    for (int n = 0; n < PROFILE_TOP && n < lines; n++) {
+        int hottest = -1;
+        for (int i = 0; i < lines; i++) {
+            if (shown[i] || !profile.counts[i]) continue;
+            if (hottest < 0 || profile.cycles[i] > profile.cycles[hottest]) hottest = i;
         }
+        if (hottest < 0) break;
+        shown[hottest] = 1;
+
+        int is_end = hottest == compiled.line_count;
+        itoa(is_end ? 0 : compiled.line_numbers[hottest], buffer, 10);
+        print_padded(is_end ? "-" : buffer, 6);
+        u64_to_string(profile.counts[hottest], buffer);
+        print_padded(buffer, 12);
+        u64_to_string(profile.cycles[hottest], buffer);
+        print_padded(buffer, 16);
+        itoa(percent_of(profile.cycles[hottest], total), buffer, 10);
+        print_padded(buffer, 5);
+        print_string(is_end ? "(end of program)" : program_line_text(hottest));
+        print_string("\n");
+    }
 
-        char* line = program[pc].content;
-
-        if (starts_with(line, "printt \"")) {
-            char* start = line + 8;
-            char* end = start;
-            while (*end && *end != '"') end++;
-            *end = '\0';
-            print_string(start);
-            print_string("\n");
-            pc++;
-        } else if (starts_with(line, "printv")) {
-            int val = stack_top();
-            char buffer[32];
-            itoa(val, buffer, 10);
-            print_string(buffer);
-            print_string("\n");
-            pc++;
-        } else if (starts_with(line, "push ")) {
-            int value = 0;
-            char* ptr = line + 5;
-            while (*ptr >= '0' && *ptr <= '9') {
-                value = value * 10 + (*ptr - '0');
-                ptr++;
-            }
-            push_stack(value);
-            pc++;
-        } else if (compare_strings(line, "pop")) {
-            pop_stack();
-            pc++;
-        } else if (compare_strings(line, "dup")) {
-            int val = stack_top();
-            push_stack(val);
-            pc++;
-        } else if (compare_strings(line, "add")) {
-            int b = pop_stack();
-            int a = pop_stack();
-            push_stack(a + b);
-            pc++;
-        } else if (compare_strings(line, "sub")) {
-            int a = pop_stack();
-            int b = pop_stack();
-            push_stack(a - b);
-            pc++;
-        } else if (starts_with(line, "biz ")) {
-            int target = 0;
-            char* ptr = line + 4;
-            while (*ptr >= '0' && *ptr <= '9') {
-                target = target * 10 + (*ptr - '0');
-                ptr++;
-            }
-            if (stack_top() == 0) {
-                int idx = find_line_index(target);
-                if (idx >= 0) {
-                    pc = idx;
-                } else {
-                    print_string("\nError: line not found\n");
-                    break;
-                }
-            } else {
-                pc++;
-            }
-        } else if (starts_with(line, "binz ")) {
-            int target = 0;
-            char* ptr = line + 5;
-            while (*ptr >= '0' && *ptr <= '9') {
-                target = target * 10 + (*ptr - '0');
-                ptr++;
-            }
-            if (stack_top() != 0) {
-                int idx = find_line_index(target);
-                if (idx >= 0) {
-                    pc = idx;
-                } else {
-                    print_string("\nError: line not found\n");
-                    break;
-                }
-            } else {
-                pc++;
-            }
-        } else if (compare_strings(line, "in")) {
-            int input = read_number();
-            push_stack(input);
-            pc++;
-        } else if (starts_with(line, "jmp ")) {
-            int target = 0;
-            char* ptr = line + 4;
-            while (*ptr >= '0' && *ptr <= '9') {
-                target = target * 10 + (*ptr - '0');
-                ptr++;
-            }
-            int target_index = find_line_index(target);
-            if (target_index >= 0) {
-                pc = target_index;
-            } else {
-                print_string("\nError: line not found\n");
+    kfree(profile.counts);
+    kfree(profile.cycles);
+    kfree(shown);
+}
+
+static void print_stat(const char* label, int value) {
+    char buffer[12];
+    print_string(label);
+    itoa(value, buffer, 10);
+    print_string(buffer);
+}
+
+// budget               show the limits
+// budget off           remove them
+// budget <n>           stop after n instructions
+// budget <n> ms        stop after n milliseconds
+void set_budget(const char* args) {
+    while (*args == ' ') args++;
+
+    if (*args == 0) {
+        print_string("\ninstructions: ");
+        if (instruction_budget) print_stat("", instruction_budget);
+        else print_string("unlimited");
+        print_string("\ntime: ");
+        if (time_budget_ms) print_stat("", time_budget_ms);
+        else print_string("unlimited");
+        if (time_budget_ms) print_string(" ms");
+        return;
+    }
+    if (compare_strings(args, "off")) {
+        instruction_budget = 0;
+        time_budget_ms = 0;
+        return;
+    }
+    if (*args < '0' || *args > '9') {
+        print_string("\nUsage: budget [off | <instructions> | <n> ms]");
+        return;
+    }
+
+    int value = string_to_int(args);
+    while (*args >= '0' && *args <= '9') args++;
+    while (*args == ' ') args++;
+
+    if (compare_strings(args, "ms")) {
+        if (!tsc_khz) print_string("\nTSC speed unknown, time budget ignored");
+        time_budget_ms = value;
+    } else if (*args == 0) {
+        instruction_budget = value;
+    } else {
+        print_string("\nUsage: budget [off | <instructions> | <n> ms]");
+    }
+}
+
+// Show what the optimiser did to the current program
+void explain_program() {
+    if (!ensure_compiled()) return;
+    print_stat("\ninstructions: ", optimize_stats.before);
+    print_stat(" -> ", optimize_stats.after);
+    print_stat("\nfolded: ", optimize_stats.folded);
+    print_stat("  threaded: ", optimize_stats.threaded);
+    print_stat("  dead: ", optimize_stats.dead);
+    print_stat("  fused: ", optimize_stats.fused);
+}
+
+// Output sink that fingerprints everything printed, optionally passing it on
+typedef struct {
+    OutputSink sink;
+    OutputSink* next;
+    int echo;
+    unsigned int hash;
+    unsigned int length;
+} HashSink;
+
+static void hash_sink_write(OutputSink* sink, const char* str) {
+    HashSink* h = (HashSink*)sink;
+    for (const char* c = str; *c; c++) {
+        h->hash = (h->hash ^ (unsigned char)*c) * 16777619u;
+        h->length++;
+    }
+    if (h->echo) {
+        set_output_sink(h->next);
+        print_string(str);
+        set_output_sink(sink);
+    }
+}
+
+static void hash_sink_init(HashSink* h, int echo) {
+    h->sink.write = hash_sink_write;
+    h->next = output_sink;
+    h->echo = echo;
+    h->hash = 2166136261u;
+    h->length = 0;
+}
+
+// Run the program through the interpreter (silently) and then the JIT, and
+// compare the final stack and the printed output of both
+void check_jit() {
+    if (!ensure_jitted()) return;
+    for (int i = 0; i < compiled.count; i++) {
+        if (compiled.code[i].op == OP_IN) {
+            print_string("\njitcheck: programs using 'in' cannot be cross-checked");
+            return;
+        }
+    }
+
+    int initial_stack[STACK_SIZE];
+    int expected_stack[STACK_SIZE];
+    int initial_sp = sp;
+    memcpy(initial_stack, stack, sizeof(stack));
+
+    HashSink interpreted;
+    hash_sink_init(&interpreted, 0);
+    set_output_sink(&interpreted.sink);
+    reset_program_state();
+    execute_bytecode(&compiled, 0);
+    set_output_sink(interpreted.next);
+    int expected_sp = sp;
+    int expected_variables[MAX_VARIABLES];
+    memcpy(expected_stack, stack, sizeof(stack));
+    memcpy(expected_variables, variables, sizeof(variables));
+
+    sp = initial_sp;
+    memcpy(stack, initial_stack, sizeof(stack));
+
+    HashSink native;
+    hash_sink_init(&native, 1);
+    set_output_sink(&native.sink);
+    reset_program_state();
+    jit_execute(&compiled, &jitted);
+    set_output_sink(native.next);
+
+    int mismatch = 0;
+    if (native.hash != interpreted.hash || native.length != interpreted.length) {
+        print_string("\njitcheck: output differs from the interpreter");
+        mismatch = 1;
+    }
+    if (sp != expected_sp || memcmp(stack + 1, expected_stack + 1, sp * sizeof(int)) != 0) {
+        print_string("\njitcheck: stack differs from the interpreter");
+        mismatch = 1;
+    }
+    if (memcmp(variables, expected_variables, sizeof(variables)) != 0) {
+        print_string("\njitcheck: variables differ from the interpreter");
+        mismatch = 1;
+    }
+    if (!mismatch) print_string("\njitcheck: native code matches the interpreter");
+}
+
+
+// --- Saving and loading ----------------------------------------------------
+//
+// "save prog" writes the source text to the file "prog" and the compiled,
+// optimised bytecode to "prog.bc", tagged with a hash of the source. "load"
+// reuses that image when the hash still matches, so unchanged programs are
+// not compiled again.
+
+#define IMAGE_MAGIC   0x43424745    // "EGBC"
+#define IMAGE_VERSION 1             // bump whenever the instruction set changes
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int source_hash;
+    int count;
+    int line_count;
+    unsigned int string_size;
+    OptimizeStats stats;
+} ImageHeader;
+
+static unsigned int hash_text(const char* text, unsigned int size) {
+    unsigned int hash = 2166136261u;
+    for (unsigned int i = 0; i < size; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// "prog" -> "prog.bc", or 0 if that is too long for the file store
+static int image_name(const char* name, char* image) {
+    int length = string_length(name);
+    if (length + 3 >= MAX_FILENAME) return 0;
+    copy_string(image, name);
+    copy_string(image + length, ".bc");
+    return 1;
+}
+
+// The whole program as "number text" lines in a heap buffer
+static char* program_text(unsigned int* size) {
+    ProgramCursor cursor = program_begin();
+    int number;
+    const char* text;
+    unsigned int total = 1;
+
+    while (program_next(&cursor, &number, &text)) total += string_length(text) + 13;
+
+    char* buffer = (char*)kmalloc(total);
+    if (!buffer) return 0;
+
+    unsigned int pos = 0;
+    cursor = program_begin();
+    while (program_next(&cursor, &number, &text)) {
+        itoa(number, buffer + pos, 10);
+        pos += string_length(buffer + pos);
+        buffer[pos++] = ' ';
+        copy_string(buffer + pos, text);
+        pos += string_length(text);
+        buffer[pos++] = '\n';
+    }
+    buffer[pos] = 0;
+    *size = pos;
+    return buffer;
+}
+
+static void write_image(const char* name, unsigned int source_hash) {
+    ImageHeader header;
+    header.magic = IMAGE_MAGIC;
+    header.version = IMAGE_VERSION;
+    header.source_hash = source_hash;
+    header.count = compiled.count;
+    header.line_count = compiled.line_count;
+    header.string_size = compiled.string_size;
+    header.stats = optimize_stats;
+
+    unsigned int code_bytes = compiled.count * sizeof(Instr);
+    unsigned int line_bytes = (compiled.line_count + 1) * sizeof(int);
+    unsigned int size = sizeof(header) + code_bytes + line_bytes + compiled.string_size;
+    char* image = (char*)kmalloc(size);
+    TextFile* file = create_file(name);
+    if (!image || !file) {
+        kfree(image);
+        return;
+    }
+
+    char* pos = image;
+    memcpy(pos, &header, sizeof(header));
+    pos += sizeof(header);
+    memcpy(pos, compiled.code, code_bytes);
+    pos += code_bytes;
+    memcpy(pos, compiled.line_numbers, line_bytes);
+    pos += line_bytes;
+    memcpy(pos, compiled.strings, compiled.string_size);
+
+    file_write(file, image, size);
+    kfree(image);
+}
+
+// An image is only trusted if it matches the source and every jump and
+// slot in it is in range
+static int image_is_valid(const ImageHeader* header, const Instr* code, unsigned int size, unsigned int source_hash) {
+    if (header->magic != IMAGE_MAGIC || header->version != IMAGE_VERSION) return 0;
+    if (header->source_hash != source_hash) return 0;
+    if (header->count < 1 || header->count > MAX_PROGRAM_LINES + 1) return 0;
+    if (header->line_count != program_line_count()) return 0;
+    if (header->string_size > size) return 0;
+
+    unsigned int expected = sizeof(ImageHeader) + header->count * sizeof(Instr)
+                          + (header->line_count + 1) * sizeof(int) + header->string_size;
+    if (expected != size) return 0;
+
+    for (int i = 0; i < header->count; i++) {
+        const Instr* instr = &code[i];
+        switch (instr->op) {
+            case OP_BIZ: case OP_BINZ: case OP_JMP: case OP_DUP_BIZ: case OP_DUP_BINZ:
+                if (instr->operand < 0 || instr->operand >= header->count) return 0;
+                break;
+            case OP_PRINTT:
+                if (instr->operand < 0 || (unsigned int)instr->operand >= header->string_size) return 0;
+                break;
+            case OP_LOAD: case OP_STORE:
+                if (instr->operand < 0 || instr->operand >= MAX_VARIABLES) return 0;
+                break;
+            case OP_DIM: case OP_ALOAD: case OP_ASTORE: case OP_LEN: case OP_FILL:
+            case OP_COPY: case OP_SUM: case OP_MIN: case OP_MAX: case OP_DOT:
+                if (instr->operand < 0 || instr->operand >= MAX_ARRAYS || instr->operand2 >= MAX_ARRAYS) return 0;
+                break;
+            default:
+                if (instr->op >= OP_COUNT) return 0;
                 break;
-            }
-        } else if (compare_strings(line, "end")) {
-            break;
-        } else {
-            print_string("\nUnknown: ");
-            print_string(line);
-            break;
         }
     }
+    return 1;
 }
 
+static int read_image(const char* name, unsigned int source_hash) {
+    TextFile* file = find_file(name);
+    if (!file || file->size < sizeof(ImageHeader)) return 0;
+
+    ImageHeader header;
+    memcpy(&header, file->data, sizeof(header));
+    const char* pos = file->data + sizeof(header);
+    unsigned int code_bytes = header.count * sizeof(Instr);
+    unsigned int line_bytes = (header.line_count + 1) * sizeof(int);
+
+    // Copy the code out first: file data is not aligned for Instr
+    Instr* code = (Instr*)kmalloc(code_bytes ? code_bytes : 1);
+    if (!code) return 0;
+    if (header.count > 0 && header.count <= MAX_PROGRAM_LINES + 1
+        && sizeof(header) + code_bytes <= file->size) {
+        memcpy(code, pos, code_bytes);
+    } else {
+        kfree(code);
+        return 0;
+    }
+    if (!image_is_valid(&header, code, file->size, source_hash)) {
+        kfree(code);
+        return 0;
+    }
+    pos += code_bytes;
+
+    int* line_numbers = (int*)kmalloc(line_bytes);
+    char* strings = (char*)kmalloc(header.string_size ? header.string_size : 1);
+    if (!line_numbers || !strings) {
+        kfree(code);
+        kfree(line_numbers);
+        kfree(strings);
+        return 0;
+    }
+    memcpy(line_numbers, pos, line_bytes);
+    pos += line_bytes;
+    memcpy(strings, pos, header.string_size);
+
+    free_bytecode(&compiled);
+    jit_free(&jitted);
+    compiled.code = code;
+    compiled.count = header.count;
+    compiled.line_numbers = line_numbers;
+    compiled.line_count = header.line_count;
+    compiled.strings = strings;
+    compiled.string_size = header.string_size;
+    optimize_stats = header.stats;
+    compiled_valid = 1;
+    return 1;
+}
+
+void save_program(const char* name) {
+    if (!*name) {
+        print_string("\nUsage: save <file>");
+        return;
+    }
+
+    unsigned int size;
+    char* text = program_text(&size);
+    TextFile* file = create_file(name);
+    if (!text || !file || !file_write(file, text, size)) {
+        print_string("\nCould not save ");
+        print_string(name);
+        kfree(text);
+        return;
+    }
+
+    print_stat("\nSaved ", program_line_count());
+    print_string(" lines to ");
+    print_string(name);
+
+    char image[MAX_FILENAME];
+    if (image_name(name, image) && program_line_count() && ensure_compiled()) {
+        write_image(image, hash_text(text, size));
+    }
+    kfree(text);
+}
+
+void load_program(const char* name) {
+    if (!*name) {
+        print_string("\nUsage: load <file>");
+        return;
+    }
+
+    TextFile* file = find_file(name);
+    if (!file) {
+        print_string("\nNo such file: ");
+        print_string(name);
+        return;
+    }
+
+    clear_program();
+    int skipped = 0;
+    char* line = file->data;
+    char* end = file->data + file->size;
+
+    while (line && line < end) {
+        char* next = line;
+        while (next < end && *next != '\n') next++;
+
+        // Cut the line out in place; the byte is put back afterwards
+        char saved = *next;
+        *next = 0;
+        if (next > line && next[-1] == '\r') next[-1] = 0;
+
+        char* p = line;
+        while (*p == ' ') p++;
+        if (*p >= '0' && *p <= '9') {
+            int number = 0;
+            while (*p >= '0' && *p <= '9') number = number * 10 + (*p++ - '0');
+            while (*p == ' ') p++;
+            if (!program_set_line(number, p)) skipped++;
+        } else if (*p) {
+            skipped++;
+        }
+
+        if (next > line && next[-1] == 0) next[-1] = '\r';
+        *next = saved;
+        line = next + 1;
+    }
+
+    print_stat("\nLoaded ", program_line_count());
+    print_string(" lines");
+    if (skipped) print_stat(", skipped ", skipped);
+
+    char image[MAX_FILENAME];
+    if (image_name(name, image) && read_image(image, hash_text(file->data, file->size))) {
+        print_string(" (compiled image reused)");
+    }
+}
 
 void start_basic_repl() {
     print_string("\nWelcome to EG-Basic REPL!\n");
     print_string("Type 'help' for a list of commands.\n");
 
-    clear_program();
+    // The program stays in memory between visits to the REPL
+    returnToCMD = 0;
 
     char key[2] = {0};
     char line[128];
@@ -366,6 +715,20 @@ void start_basic_repl() {
             list_program();
         } else if (compare_strings(line, "run")) {
             run_program();
+        } else if (compare_strings(line, "run profile")) {
+            profile_program();
+        } else if (compare_strings(line, "run jit")) {
+            run_program_jit();
+        } else if (compare_strings(line, "run jitcheck")) {
+            check_jit();
+        } else if (starts_with(line, "budget") && (line[6] == 0 || line[6] == ' ')) {
+            set_budget(line + 6);
+        } else if (compare_strings(line, "explain")) {
+            explain_program();
+        } else if (starts_with(line, "save ")) {
+            save_program(line + 5);
+        } else if (starts_with(line, "load ")) {
+            load_program(line + 5);
         } else if (compare_strings(line, "new")) {
             clear_program();
         } else if (line[0] >= '0' && line[0] <= '9') {
@@ -4,4 +4,10 @@
 void start_basic_repl();
 char* get_keypress();
 
+void load_program(const char* name);
+void run_program();
+
+void itoa(int value, char* buffer, int base);
+int read_number();
+
 #endif
\ No newline at end of file
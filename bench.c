@@ -0,0 +1,265 @@
+#include "bench.h"
+#include "bytecode.h"
+#include "command.h"
+#include "heap.h"
+#include "serial.h"
+#include "util.h"
+
+// Every benchmark is run a few times to warm caches and branch predictors,
+// then timed over N repetitions. The minimum is the best the code can do;
+// the median and the 99th percentile show what interrupts, other CPUs and
+// the emulator add on top. Besides the table on screen each result goes to
+// the serial port as one line ("BENCH name=... min=..."), bracketed by a
+// BENCH-BEGIN line that identifies the build, for collecting across runs.
+// Machine lines start on a fresh line even when the console is mirrored.
+
+#define MAX_BENCHMARKS 32
+#define WARMUP_RUNS    3
+
+static const Benchmark* benchmarks[MAX_BENCHMARKS];
+static int benchmark_count = 0;
+
+static unsigned int tsc_overhead = 0;
+static volatile unsigned int bench_sink;
+
+// --- Built-in benchmarks ---
+
+#define ALU_ROUNDS 100000
+
+static void bench_alu() {
+    unsigned int x = 12345, y = 67890;
+    for (int i = 0; i < ALU_ROUNDS; i++) {
+        x = x * 1664525 + 1013904223;
+        y ^= x >> 7;
+        y += (y << 3) - x;
+    }
+    bench_sink = x ^ y;
+}
+
+#define COPY_SIZE 65536
+
+static unsigned char copy_source[COPY_SIZE];
+static unsigned char copy_target[COPY_SIZE];
+
+static void bench_memcpy() {
+    memcpy(copy_target, copy_source, COPY_SIZE);
+}
+
+static void bench_vga_scroll() {
+    for (int i = 0; i < HEIGHT; i++) console_scroll();
+}
+
+// Command-like names: similar prefixes, so comparisons run a few bytes in
+static const char* const bench_names[] = {
+    "help", "echo", "clear", "poke", "peek", "editor", "ls", "cat", "grep",
+    "wc", "head", "run", "runbin", "eg-basic", "rtc-time", "info", "color",
+    "bench", "ps", "workq", "reboot", "shutdown", "shutdow", "nosuch",
+};
+#define BENCH_NAMES (int)(sizeof(bench_names) / sizeof(bench_names[0]))
+
+static void bench_strcmp() {
+    int equal = 0;
+    for (int i = 0; i < BENCH_NAMES; i++) {
+        for (int j = 0; j < BENCH_NAMES; j++) equal += compare_strings(bench_names[i], bench_names[j]);
+    }
+    bench_sink = equal;
+}
+
+static void bench_dispatch() {
+    int found = 0;
+    for (int i = 0; i < BENCH_NAMES; i++) found += find_command(bench_names[i]) != 0;
+    bench_sink = found;
+}
+
+// A counting loop in EG-Basic bytecode: the interpreter's dispatch cost
+#define BASIC_ROUNDS 10000
+
+static const Instr basic_loop[] = {
+    { BASIC_ROUNDS, 0, OP_PUSH, 0 },
+    { 5,            0, OP_BIZ,  0 },    // 1: leave at zero
+    { -1,           0, OP_PUSH, 0 },
+    { 0,            0, OP_ADD,  0 },
+    { 1,            0, OP_JMP,  0 },
+    { 0,            0, OP_END,  0 },
+};
+
+static void bench_basic() {
+    Bytecode bytecode = { (Instr*)basic_loop, sizeof(basic_loop) / sizeof(Instr), 0, 0, 0, 0 };
+    sp = 0;
+    execute_bytecode(&bytecode, 0);
+    sp = 0;
+}
+
+static const Benchmark builtin_benchmarks[] = {
+    { "alu",        "integer multiply/shift/xor chain",   ALU_ROUNDS,          bench_alu },
+    { "memcpy",     "64 KB memcpy (ops = bytes)",         COPY_SIZE,           bench_memcpy },
+    { "vga-scroll", "scroll the text screen 25 lines",    HEIGHT,              bench_vga_scroll },
+    { "strcmp",     "compare_strings over command names", BENCH_NAMES * BENCH_NAMES, bench_strcmp },
+    { "dispatch",   "find_command for 24 names",          BENCH_NAMES,         bench_dispatch },
+    { "basic",      "bytecode interpreter counting loop", BASIC_ROUNDS * 4 + 3, bench_basic },
+};
+
+// --- Framework ---
+
+void register_benchmarks(const Benchmark* table, int count) {
+    for (int i = 0; i < count && benchmark_count < MAX_BENCHMARKS; i++) {
+        benchmarks[benchmark_count++] = &table[i];
+    }
+}
+
+void bench_init() {
+    register_benchmarks(builtin_benchmarks, sizeof(builtin_benchmarks) / sizeof(builtin_benchmarks[0]));
+}
+
+static void measure_overhead() {
+    unsigned long long best = ~0ULL;
+    for (int i = 0; i < 16; i++) {
+        unsigned long long start = serialized_tsc();
+        unsigned long long cycles = serialized_tsc() - start;
+        if (cycles < best) best = cycles;
+    }
+    tsc_overhead = (unsigned int)best;
+}
+
+static void sort_samples(unsigned int* samples, int count) {
+    for (int i = 1; i < count; i++) {
+        unsigned int value = samples[i];
+        int j = i - 1;
+        while (j >= 0 && samples[j] > value) {
+            samples[j + 1] = samples[j];
+            j--;
+        }
+        samples[j + 1] = value;
+    }
+}
+
+static void print_cycles(unsigned int cycles, int width) {
+    char buffer[16];
+    u64_to_string(cycles, buffer);
+    print_padded(buffer, width);
+}
+
+static void serial_field(const char* key, unsigned int value) {
+    char buffer[16];
+    serial_write(" ");
+    serial_write(key);
+    serial_write("=");
+    u64_to_string(value, buffer);
+    serial_write(buffer);
+}
+
+// Benchmarks like vga-scroll move the text on screen; the table printed so
+// far is put back once the timing is done
+static char saved_screen[WIDTH * HEIGHT * 2];
+
+static void run_benchmark(const Benchmark* benchmark, unsigned int* samples, int reps) {
+    memcpy(saved_screen, video_memory, sizeof(saved_screen));
+    for (int i = 0; i < WARMUP_RUNS; i++) benchmark->run();
+
+    for (int i = 0; i < reps; i++) {
+        unsigned long long start = serialized_tsc();
+        benchmark->run();
+        unsigned long long cycles = serialized_tsc() - start;
+        cycles = cycles > tsc_overhead ? cycles - tsc_overhead : 0;
+        samples[i] = cycles > 0xFFFFFFFF ? 0xFFFFFFFF : (unsigned int)cycles;
+    }
+    memcpy(video_memory, saved_screen, sizeof(saved_screen));
+    sort_samples(samples, reps);
+
+    unsigned int min = samples[0];
+    unsigned int median = samples[reps / 2];
+    unsigned int p99 = samples[(reps * 99 + 99) / 100 - 1];
+
+    // Per operation, in hundredths of a cycle
+    unsigned int per_op = (unsigned int)u64_div((unsigned long long)median * 100, benchmark->operations);
+    char buffer[16];
+    print_string("\n");
+    print_padded(benchmark->name, 12);
+    print_cycles(min, 11);
+    print_cycles(median, 11);
+    print_cycles(p99, 11);
+    int_to_string(per_op / 100, buffer);
+    print_string(buffer);
+    print_string(".");
+    int_to_string(per_op % 100 / 10, buffer);
+    print_string(buffer);
+    int_to_string(per_op % 10, buffer);
+    print_string(buffer);
+
+    serial_write("\nBENCH name=");
+    serial_write(benchmark->name);
+    serial_field("reps", reps);
+    serial_field("min", min);
+    serial_field("median", median);
+    serial_field("p99", p99);
+    serial_field("ops", benchmark->operations);
+    serial_write(" unit=cycles\n");
+}
+
+// bench [list | all | <name>] [repetitions]
+void run_benchmarks(const char* args) {
+    char name[16];
+    int length = 0;
+    while (*args == ' ') args++;
+    while (*args && *args != ' ' && length < (int)sizeof(name) - 1) name[length++] = *args++;
+    name[length] = 0;
+    while (*args == ' ') args++;
+
+    if (compare_strings(name, "list")) {
+        for (int i = 0; i < benchmark_count; i++) {
+            print_string("\n");
+            print_padded(benchmarks[i]->name, 12);
+            print_string(benchmarks[i]->description);
+        }
+        return;
+    }
+
+    int reps = *args ? string_to_int(args) : BENCH_DEFAULT_REPS;
+    if (reps < 1 || reps > BENCH_MAX_REPS) {
+        command_error("\nRepetitions must be 1-1001.");
+        return;
+    }
+
+    int all = !name[0] || compare_strings(name, "all");
+    const Benchmark* only = 0;
+    for (int i = 0; i < benchmark_count && !all && !only; i++) {
+        if (compare_strings(benchmarks[i]->name, name)) only = benchmarks[i];
+    }
+    if (!all && !only) {
+        command_error("\nUnknown benchmark: ");
+        print_string(name);
+        return;
+    }
+
+    unsigned int* samples = (unsigned int*)kmalloc(reps * sizeof(unsigned int));
+    if (!samples) {
+        command_error("\nOut of memory.");
+        return;
+    }
+    measure_overhead();
+
+    char buffer[16];
+    serial_write("\nBENCH-BEGIN version=\"");
+    serial_write(kernel_version);
+    serial_write("\" build=\"");
+    serial_write(build_date);
+    serial_write(" ");
+    serial_write(build_time);
+    serial_write("\" cpu=\"");
+    serial_write(cpu_brand);
+    serial_write("\"");
+    serial_field("tsc_khz", tsc_khz);
+    serial_write("\n");
+
+    print_string("\nNAME        MIN        MEDIAN     P99        CYCLES/OP");
+    for (int i = 0; i < benchmark_count; i++) {
+        if (all || benchmarks[i] == only) run_benchmark(benchmarks[i], samples, reps);
+    }
+
+    print_string("\n(");
+    int_to_string(reps, buffer);
+    print_string(buffer);
+    print_string(" runs each after warm-up, cycles per run)");
+    serial_write("\nBENCH-END\n");
+    kfree(samples);
+}
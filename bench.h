@@ -0,0 +1,32 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Micro-benchmarks: each run does a fixed amount of work ('operations'
+// units of it) and is timed with serialised TSC reads
+
+typedef struct {
+    const char* name;
+    const char* description;
+    unsigned int operations;
+    void (*run)();
+} Benchmark;
+
+#define BENCH_DEFAULT_REPS 31
+#define BENCH_MAX_REPS     1001
+
+// CPUID waits for everything before it to finish, so RDTSC can't be
+// reordered into or out of the timed code
+static inline unsigned long long serialized_tsc() {
+    unsigned int low, high;
+    __asm__ __volatile__ ("xorl %%eax, %%eax\n\t"
+                          "cpuid\n\t"
+                          "rdtsc"
+        : "=a"(low), "=d"(high) :: "ebx", "ecx", "memory");
+    return ((unsigned long long)high << 32) | low;
+}
+
+void bench_init();
+void register_benchmarks(const Benchmark* table, int count);
+void run_benchmarks(const char* args);
+
+#endif
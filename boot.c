@@ -1,10 +1,11 @@
 #include "util.h"
 #include "boot.h"
+#include "thread.h"
 #include "multiboot.h"
 
 
 void boot_delay() {
-    for (volatile int i = 0; i < 100000000; i++);  // crude delay
+    thread_sleep(250);      // sleeps on the timer instead of spinning
 }
 
 void boot_count_up(unsigned int limit, const char* label) {
@@ -0,0 +1,224 @@
+#include "bulk.h"
+#include "fpu.h"
+#include "util.h"
+
+// The loops work on four independent lanes so the CPU can overlap the
+// additions and compares instead of waiting on one running total. min and
+// max expect count > 0. copy handles overlapping arrays like memmove,
+// running backward when dest lies above src.
+//
+// With SSE2 the four lanes live in one XMM register instead. Only these
+// functions are compiled for SSE2, and they run between kernel_fpu_begin()
+// and kernel_fpu_end(); short arrays stay scalar, where the FPU hand-over
+// would cost more than it saves.
+
+#define SIMD_MIN_COUNT 16
+
+static void fill_scalar(int* dest, int value, unsigned int count) {
+    unsigned int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        dest[i] = value;
+        dest[i + 1] = value;
+        dest[i + 2] = value;
+        dest[i + 3] = value;
+    }
+    for (; i < count; i++) dest[i] = value;
+}
+
+static void copy_scalar(int* dest, const int* src, unsigned int count) {
+    if (dest > src && dest < src + count) {
+        for (unsigned int i = count; i > 0; i--) dest[i - 1] = src[i - 1];
+    } else {
+        for (unsigned int i = 0; i < count; i++) dest[i] = src[i];
+    }
+}
+
+static int sum_scalar(const int* src, unsigned int count) {
+    int s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    unsigned int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        s0 += src[i];
+        s1 += src[i + 1];
+        s2 += src[i + 2];
+        s3 += src[i + 3];
+    }
+    for (; i < count; i++) s0 += src[i];
+    return s0 + s1 + s2 + s3;
+}
+
+static int min_scalar(const int* src, unsigned int count) {
+    int m0 = src[0], m1 = src[0], m2 = src[0], m3 = src[0];
+    unsigned int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        if (src[i] < m0) m0 = src[i];
+        if (src[i + 1] < m1) m1 = src[i + 1];
+        if (src[i + 2] < m2) m2 = src[i + 2];
+        if (src[i + 3] < m3) m3 = src[i + 3];
+    }
+    for (; i < count; i++) {
+        if (src[i] < m0) m0 = src[i];
+    }
+    if (m1 < m0) m0 = m1;
+    if (m3 < m2) m2 = m3;
+    return m2 < m0 ? m2 : m0;
+}
+
+static int max_scalar(const int* src, unsigned int count) {
+    int m0 = src[0], m1 = src[0], m2 = src[0], m3 = src[0];
+    unsigned int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        if (src[i] > m0) m0 = src[i];
+        if (src[i + 1] > m1) m1 = src[i + 1];
+        if (src[i + 2] > m2) m2 = src[i + 2];
+        if (src[i + 3] > m3) m3 = src[i + 3];
+    }
+    for (; i < count; i++) {
+        if (src[i] > m0) m0 = src[i];
+    }
+    if (m1 > m0) m0 = m1;
+    if (m3 > m2) m2 = m3;
+    return m2 > m0 ? m2 : m0;
+}
+
+static int dot_scalar(const int* a, const int* b, unsigned int count) {
+    int s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    unsigned int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < count; i++) s0 += a[i] * b[i];
+    return s0 + s1 + s2 + s3;
+}
+
+SIMD static void fill_sse2(int* dest, int value, unsigned int count) {
+    Vec4 v = { value, value, value, value };
+    unsigned int i = 0;
+    for (; i + 4 <= count; i += 4) *(Vec4*)(dest + i) = v;
+    for (; i < count; i++) dest[i] = value;
+}
+
+// Each block is loaded whole before it is stored, so an overlap of less
+// than four ints is safe in either direction
+SIMD static void copy_sse2(int* dest, const int* src, unsigned int count) {
+    if (dest > src && dest < src + count) {
+        unsigned int i = count;
+        for (; i >= 4; i -= 4) *(Vec4*)(dest + i - 4) = *(const Vec4*)(src + i - 4);
+        for (; i > 0; i--) dest[i - 1] = src[i - 1];
+    } else {
+        unsigned int i = 0;
+        for (; i + 4 <= count; i += 4) *(Vec4*)(dest + i) = *(const Vec4*)(src + i);
+        for (; i < count; i++) dest[i] = src[i];
+    }
+}
+
+SIMD static int sum_sse2(const int* src, unsigned int count) {
+    Vec4 s = { 0, 0, 0, 0 };
+    unsigned int i = 0;
+    for (; i + 4 <= count; i += 4) s += *(const Vec4*)(src + i);
+    int total = s[0] + s[1] + s[2] + s[3];
+    for (; i < count; i++) total += src[i];
+    return total;
+}
+
+// SSE2 has no packed signed min/max; select through a compare mask
+SIMD static int min_sse2(const int* src, unsigned int count) {
+    Vec4 m = { src[0], src[0], src[0], src[0] };
+    unsigned int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        Vec4 x = *(const Vec4*)(src + i);
+        Vec4 less = x < m;
+        m = (x & less) | (m & ~less);
+    }
+    int result = m[0];
+    for (int lane = 1; lane < 4; lane++) {
+        if (m[lane] < result) result = m[lane];
+    }
+    for (; i < count; i++) {
+        if (src[i] < result) result = src[i];
+    }
+    return result;
+}
+
+SIMD static int max_sse2(const int* src, unsigned int count) {
+    Vec4 m = { src[0], src[0], src[0], src[0] };
+    unsigned int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        Vec4 x = *(const Vec4*)(src + i);
+        Vec4 greater = x > m;
+        m = (x & greater) | (m & ~greater);
+    }
+    int result = m[0];
+    for (int lane = 1; lane < 4; lane++) {
+        if (m[lane] > result) result = m[lane];
+    }
+    for (; i < count; i++) {
+        if (src[i] > result) result = src[i];
+    }
+    return result;
+}
+
+SIMD static int dot_sse2(const int* a, const int* b, unsigned int count) {
+    Vec4 s = { 0, 0, 0, 0 };
+    unsigned int i = 0;
+    for (; i + 4 <= count; i += 4) s += *(const Vec4*)(a + i) * *(const Vec4*)(b + i);
+    int total = s[0] + s[1] + s[2] + s[3];
+    for (; i < count; i++) total += a[i] * b[i];
+    return total;
+}
+
+void bulk_fill(int* dest, int value, unsigned int count) {
+    if (count >= SIMD_MIN_COUNT && kernel_fpu_begin()) {
+        fill_sse2(dest, value, count);
+        kernel_fpu_end();
+        return;
+    }
+    fill_scalar(dest, value, count);
+}
+
+void bulk_copy(int* dest, const int* src, unsigned int count) {
+    if (count >= SIMD_MIN_COUNT && kernel_fpu_begin()) {
+        copy_sse2(dest, src, count);
+        kernel_fpu_end();
+        return;
+    }
+    copy_scalar(dest, src, count);
+}
+
+int bulk_sum(const int* src, unsigned int count) {
+    if (count >= SIMD_MIN_COUNT && kernel_fpu_begin()) {
+        int result = sum_sse2(src, count);
+        kernel_fpu_end();
+        return result;
+    }
+    return sum_scalar(src, count);
+}
+
+int bulk_min(const int* src, unsigned int count) {
+    if (count >= SIMD_MIN_COUNT && kernel_fpu_begin()) {
+        int result = min_sse2(src, count);
+        kernel_fpu_end();
+        return result;
+    }
+    return min_scalar(src, count);
+}
+
+int bulk_max(const int* src, unsigned int count) {
+    if (count >= SIMD_MIN_COUNT && kernel_fpu_begin()) {
+        int result = max_sse2(src, count);
+        kernel_fpu_end();
+        return result;
+    }
+    return max_scalar(src, count);
+}
+
+int bulk_dot(const int* a, const int* b, unsigned int count) {
+    if (count >= SIMD_MIN_COUNT && kernel_fpu_begin()) {
+        int result = dot_sse2(a, b, count);
+        kernel_fpu_end();
+        return result;
+    }
+    return dot_scalar(a, b, count);
+}
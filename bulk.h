@@ -0,0 +1,12 @@
+#ifndef BULK_H
+#define BULK_H
+
+// Whole-array integer kernels used by the EG-Basic built-ins
+void bulk_fill(int* dest, int value, unsigned int count);
+void bulk_copy(int* dest, const int* src, unsigned int count);
+int bulk_sum(const int* src, unsigned int count);
+int bulk_min(const int* src, unsigned int count);
+int bulk_max(const int* src, unsigned int count);
+int bulk_dot(const int* a, const int* b, unsigned int count);
+
+#endif
@@ -0,0 +1,722 @@
+#include "bytecode.h"
+#include "basic.h"
+#include "bulk.h"
+#include "heap.h"
+#include "keyboard.h"
+#include "metrics.h"
+#include "program.h"
+#include "util.h"
+
+// EG-Basic programs are compiled once into a flat array of instructions with
+// decoded operands and jump targets already turned into instruction indices.
+// The interpreter then dispatches with computed gotos (one indirect jump per
+// instruction) instead of re-parsing source text for every step.
+
+int stack[STACK_SIZE] = {0};   // stack[1..sp] is in use, stack[0] stays free
+int sp = 0;
+
+// Variable and array names become slot numbers at compile time, so the
+// running program indexes these directly
+int variables[MAX_VARIABLES] = {0};
+IntArray arrays[MAX_ARRAYS] = {{0}};
+
+#define MAX_ARRAY_SIZE 0x01000000
+
+typedef struct {
+    char names[MAX_VARIABLES][MAX_NAME];
+    int count;
+} SymbolTable;
+
+static SymbolTable variable_names;
+static SymbolTable array_names;
+
+// Instructions that take one or two variable/array names
+typedef struct {
+    const char* word;
+    unsigned char op;
+    unsigned char names;
+    unsigned char is_array;
+} NamedOp;
+
+static const NamedOp named_ops[] = {
+    {"load ", OP_LOAD, 1, 0},
+    {"store ", OP_STORE, 1, 0},
+    {"dim ", OP_DIM, 1, 1},
+    {"aload ", OP_ALOAD, 1, 1},
+    {"astore ", OP_ASTORE, 1, 1},
+    {"len ", OP_LEN, 1, 1},
+    {"fill ", OP_FILL, 1, 1},
+    {"copy ", OP_COPY, 2, 1},
+    {"sum ", OP_SUM, 1, 1},
+    {"min ", OP_MIN, 1, 1},
+    {"max ", OP_MAX, 1, 1},
+    {"dot ", OP_DOT, 2, 1},
+};
+
+static void syntax_error(const Bytecode* bytecode, int index, const char* message) {
+    char buffer[16];
+    print_string("\nSyntax error in line ");
+    int_to_string(bytecode->line_numbers[index], buffer);
+    print_string(buffer);
+    print_string(": ");
+    print_string(message);
+}
+
+// Parse a decimal operand; the whole remainder of the line must be the number
+static int parse_number(const char* text, int* value) {
+    int negative = 0;
+    int result = 0;
+
+    while (*text == ' ') text++;
+    if (*text == '-') {
+        negative = 1;
+        text++;
+    }
+    if (*text < '0' || *text > '9') return 0;
+    while (*text >= '0' && *text <= '9') {
+        result = result * 10 + (*text - '0');
+        text++;
+    }
+    while (*text == ' ') text++;
+    if (*text) return 0;
+
+    *value = negative ? -result : result;
+    return 1;
+}
+
+static int find_target(const Bytecode* bytecode, int number) {
+    int low = 0;
+    int high = bytecode->line_count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (bytecode->line_numbers[mid] == number) return mid;
+        if (bytecode->line_numbers[mid] < number) low = mid + 1;
+        else high = mid - 1;
+    }
+    return -1;
+}
+
+static int is_word(const char* line, const char* word) {
+    while (*word) {
+        if (*line++ != *word++) return 0;
+    }
+    while (*line == ' ') line++;
+    return *line == 0;
+}
+
+static int is_name_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Read one name, advancing the text; names start with a letter
+static int parse_name(const char** text, char* name) {
+    const char* p = *text;
+    int length = 0;
+
+    while (*p == ' ') p++;
+    if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z'))) return 0;
+    while (is_name_char(*p)) {
+        if (length == MAX_NAME - 1) return 0;
+        name[length++] = *p++;
+    }
+    name[length] = 0;
+    *text = p;
+    return 1;
+}
+
+// Slot of a name, adding it if it is new; -1 when the table is full
+static int find_slot(SymbolTable* table, int limit, const char* name) {
+    for (int i = 0; i < table->count; i++) {
+        if (compare_strings(table->names[i], name)) return i;
+    }
+    if (table->count >= limit) return -1;
+    copy_string(table->names[table->count], name);
+    return table->count++;
+}
+
+// Returns 1 if the line is one of the named instructions (errors included)
+static int compile_named(const Bytecode* bytecode, int index, const char* line, Instr* instr, int* errors) {
+    const NamedOp* named = 0;
+    for (unsigned int i = 0; i < sizeof(named_ops) / sizeof(named_ops[0]); i++) {
+        if (starts_with(line, named_ops[i].word)) named = &named_ops[i];
+    }
+    if (!named) return 0;
+
+    const char* args = line + string_length(named->word);
+    int slots[2] = {0, 0};
+    char name[MAX_NAME];
+    instr->op = named->op;
+
+    for (int n = 0; n < named->names; n++) {
+        if (!parse_name(&args, name)) {
+            syntax_error(bytecode, index, named->names == 2 ? "expected two names" : "expected a name");
+            (*errors)++;
+            return 1;
+        }
+        if (named->is_array) slots[n] = find_slot(&array_names, MAX_ARRAYS, name);
+        else slots[n] = find_slot(&variable_names, MAX_VARIABLES, name);
+        if (slots[n] < 0) {
+            syntax_error(bytecode, index, named->is_array ? "too many arrays" : "too many variables");
+            (*errors)++;
+            return 1;
+        }
+    }
+
+    while (*args == ' ') args++;
+    if (*args) {
+        syntax_error(bytecode, index, "unexpected text after the name");
+        (*errors)++;
+        return 1;
+    }
+
+    instr->operand = slots[0];
+    instr->operand2 = (unsigned char)slots[1];
+    return 1;
+}
+
+// Variables start at zero and arrays are gone at the start of every run
+void reset_program_state() {
+    memset(variables, 0, sizeof(variables));
+    for (int i = 0; i < MAX_ARRAYS; i++) {
+        kfree(arrays[i].data);
+        arrays[i].data = 0;
+        arrays[i].size = 0;
+    }
+}
+
+void free_bytecode(Bytecode* bytecode) {
+    kfree(bytecode->code);
+    kfree(bytecode->strings);
+    kfree(bytecode->line_numbers);
+    bytecode->code = 0;
+    bytecode->strings = 0;
+    bytecode->line_numbers = 0;
+    bytecode->count = 0;
+    bytecode->string_size = 0;
+    bytecode->line_count = 0;
+}
+
+// Returns 0 (after reporting every error) if the program does not compile
+int compile_program(Bytecode* bytecode) {
+    int lines = program_line_count();
+    unsigned int string_bytes = 0;
+
+    for (int i = 0; i < lines; i++) {
+        string_bytes += string_length(program_line_text(i)) + 1;
+    }
+
+    bytecode->line_count = lines;
+    bytecode->count = lines + 1;
+    bytecode->code = (Instr*)kmalloc(bytecode->count * sizeof(Instr));
+    bytecode->string_size = string_bytes + 1;
+    bytecode->strings = (char*)kmalloc(bytecode->string_size);
+    bytecode->line_numbers = (int*)kmalloc((lines + 1) * sizeof(int));
+    if (!bytecode->code || !bytecode->strings || !bytecode->line_numbers) {
+        print_string("\nOut of memory");
+        free_bytecode(bytecode);
+        return 0;
+    }
+
+    for (int i = 0; i < lines; i++) {
+        bytecode->line_numbers[i] = program_line_number(i);
+    }
+
+    unsigned int string_pos = 0;
+    int errors = 0;
+    variable_names.count = 0;
+    array_names.count = 0;
+    char number[16];
+
+    for (int i = 0; i < lines; i++) {
+        const char* line = program_line_text(i);
+        Instr* instr = &bytecode->code[i];
+        instr->line = (unsigned short)i;
+        instr->operand = 0;
+        instr->operand2 = 0;
+        int jump = 0;
+
+        if (starts_with(line, "printt \"")) {
+            const char* start = line + 8;
+            const char* end = start;
+            while (*end && *end != '"') end++;
+
+            instr->op = OP_PRINTT;
+            instr->operand = string_pos;
+            while (start < end) bytecode->strings[string_pos++] = *start++;
+            bytecode->strings[string_pos++] = 0;
+        } else if (is_word(line, "printv")) {
+            instr->op = OP_PRINTV;
+        } else if (starts_with(line, "push ")) {
+            instr->op = OP_PUSH;
+            if (!parse_number(line + 5, &instr->operand)) {
+                syntax_error(bytecode, i, "push needs a number");
+                errors++;
+            }
+        } else if (is_word(line, "pop")) {
+            instr->op = OP_POP;
+        } else if (is_word(line, "dup")) {
+            instr->op = OP_DUP;
+        } else if (is_word(line, "add")) {
+            instr->op = OP_ADD;
+        } else if (is_word(line, "sub")) {
+            instr->op = OP_SUB;
+        } else if (starts_with(line, "biz ")) {
+            instr->op = OP_BIZ;
+            jump = 4;
+        } else if (starts_with(line, "binz ")) {
+            instr->op = OP_BINZ;
+            jump = 5;
+        } else if (starts_with(line, "jmp ")) {
+            instr->op = OP_JMP;
+            jump = 4;
+        } else if (is_word(line, "in")) {
+            instr->op = OP_IN;
+        } else if (is_word(line, "end")) {
+            instr->op = OP_END;
+        } else if (compile_named(bytecode, i, line, instr, &errors)) {
+            continue;
+        } else {
+            syntax_error(bytecode, i, "unknown instruction: ");
+            print_string(line);
+            errors++;
+            continue;
+        }
+
+        if (jump) {
+            // Resolve the BASIC line number to an instruction index now
+            int target;
+            if (!parse_number(line + jump, &target)) {
+                syntax_error(bytecode, i, "jump needs a line number");
+                errors++;
+            } else if ((instr->operand = find_target(bytecode, target)) < 0) {
+                syntax_error(bytecode, i, "no such line ");
+                int_to_string(target, number);
+                print_string(number);
+                errors++;
+            }
+        }
+    }
+
+    // Falling off the end of the program stops it
+    bytecode->code[lines].op = OP_END;
+    bytecode->code[lines].operand = 0;
+    bytecode->code[lines].operand2 = 0;
+    bytecode->code[lines].line = (unsigned short)lines;
+    bytecode->line_numbers[lines] = 0;
+
+    if (errors) {
+        free_bytecode(bytecode);
+        return 0;
+    }
+    return 1;
+}
+
+static inline void vm_push(int* top, int value) {
+    if (*top < STACK_SIZE - 1) {
+        stack[++*top] = value;
+    } else {
+        print_string("Stack Overflow");
+    }
+}
+
+static inline int vm_pop(int* top) {
+    if (*top > 0) return stack[(*top)--];
+    print_string("Stack Underflow");
+    return 0;
+}
+
+static inline int vm_peek(int top) {
+    if (top > 0) return stack[top];
+    print_string("Stack is empty\n");
+    return 0;
+}
+
+static inline int vm_in_range(const IntArray* array, int index) {
+    if (index >= 0 && index < array->size) return 1;
+    print_string("Index out of range");
+    return 0;
+}
+
+// Array instructions and the bulk built-ins; each runs over the whole
+// array in C instead of one interpreted instruction per element
+static void vm_array_op(int* top, const Instr* instr) {
+    IntArray* array = &arrays[instr->operand];
+    IntArray* other = &arrays[instr->operand2];
+    int count = array->size < other->size ? array->size : other->size;
+
+    switch (instr->op) {
+        case OP_DIM: {
+            int size = vm_pop(top);
+            kfree(array->data);
+            array->data = 0;
+            array->size = 0;
+            if (size < 0 || size > MAX_ARRAY_SIZE) {
+                print_string("Bad array size");
+                break;
+            }
+            array->data = (int*)kzalloc(size * sizeof(int));
+            if (!array->data) {
+                print_string("Out of memory");
+                break;
+            }
+            array->size = size;
+            break;
+        }
+        case OP_ALOAD: {
+            int index = vm_pop(top);
+            vm_push(top, vm_in_range(array, index) ? array->data[index] : 0);
+            break;
+        }
+        case OP_ASTORE: {
+            int index = vm_pop(top);
+            int value = vm_pop(top);
+            if (vm_in_range(array, index)) array->data[index] = value;
+            break;
+        }
+        case OP_LEN:
+            vm_push(top, array->size);
+            break;
+        case OP_FILL:
+            bulk_fill(array->data, vm_pop(top), array->size);
+            break;
+        case OP_COPY:
+            bulk_copy(other->data, array->data, count);
+            break;
+        case OP_SUM:
+            vm_push(top, bulk_sum(array->data, array->size));
+            break;
+        case OP_MIN:
+        case OP_MAX:
+            if (array->size == 0) {
+                print_string("Array is empty");
+                vm_push(top, 0);
+            } else if (instr->op == OP_MIN) {
+                vm_push(top, bulk_min(array->data, array->size));
+            } else {
+                vm_push(top, bulk_max(array->data, array->size));
+            }
+            break;
+        case OP_DOT:
+            vm_push(top, bulk_dot(array->data, other->data, count));
+            break;
+    }
+}
+
+// Superinstructions keep the exact behaviour of the pair they replace,
+// including the stack error messages when the stack is empty or full
+static inline void vm_add_immediate(int* top, int value) {
+    if (*top > 0 && *top < STACK_SIZE - 1) {
+        stack[*top] += value;
+        return;
+    }
+    vm_push(top, value);
+    int b = vm_pop(top);
+    int a = vm_pop(top);
+    vm_push(top, a + b);
+}
+
+static inline void vm_sub_immediate(int* top, int value) {
+    if (*top > 0 && *top < STACK_SIZE - 1) {
+        stack[*top] = value - stack[*top];
+        return;
+    }
+    vm_push(top, value);
+    int a = vm_pop(top);
+    int b = vm_pop(top);
+    vm_push(top, a - b);
+}
+
+// Allow breaking with 'c'; the keyboard interrupt catches the key while a
+// program runs
+int break_pressed() {
+    return keyboard_break_requested();
+}
+
+unsigned int instruction_budget = 0;
+unsigned int time_budget_ms = 0;
+
+static unsigned long long run_deadline = 0;
+
+// Instructions until the next poll: never past the end of the budget, so
+// a run stops exactly when it is used up
+unsigned int next_poll_interval(unsigned long long executed) {
+    if (instruction_budget && executed < instruction_budget && instruction_budget - executed < POLL_INTERVAL) {
+        return (unsigned int)(instruction_budget - executed);
+    }
+    return POLL_INTERVAL;
+}
+
+// Called when a program starts; returns how many instructions to run
+// before the first call to run_limit_reached()
+unsigned int start_run_limits() {
+    run_deadline = 0;
+    if (time_budget_ms && tsc_khz) {
+        run_deadline = read_tsc() + (unsigned long long)time_budget_ms * tsc_khz;
+    }
+    keyboard_arm_break(1);
+    return next_poll_interval(0);
+}
+
+// Called when a program stops, so 'c' types a 'c' again
+void finish_run_limits() {
+    keyboard_arm_break(0);
+}
+
+// Reading the TSC is expensive (it may trap under virtualisation), so the
+// break flag and the budgets are only looked at every POLL_INTERVAL
+// instructions (fewer just before the budget runs out)
+int run_limit_reached(unsigned long long executed) {
+    if (break_pressed()) {
+        print_string("\nprogram interrupted by 'c'\n");
+        return 1;
+    }
+    if (instruction_budget && executed >= instruction_budget) {
+        print_string("\nprogram stopped: instruction budget used up\n");
+        return 1;
+    }
+    if (run_deadline && read_tsc() >= run_deadline) {
+        print_string("\nprogram stopped: time budget used up\n");
+        return 1;
+    }
+    return 0;
+}
+
+// GCC documents -fno-gcse for computed-goto interpreters: it keeps one indirect
+// jump per handler instead of merging them into a shared dispatch block
+//
+// A profiled run dispatches through a second table whose entries all lead
+// to op_profile, which charges the cycles since the previous dispatch to the
+// previous instruction's line before jumping to the real handler. Normal
+// runs never touch that code.
+__attribute__((optimize("no-gcse")))
+void execute_bytecode(const Bytecode* bytecode, Profile* profile) {
+    static void* const labels[OP_COUNT] = {
+        [OP_PRINTT] = &&op_printt, [OP_PRINTV] = &&op_printv, [OP_PUSH] = &&op_push,
+        [OP_POP] = &&op_pop,       [OP_DUP] = &&op_dup,       [OP_ADD] = &&op_add,
+        [OP_SUB] = &&op_sub,       [OP_BIZ] = &&op_biz,       [OP_BINZ] = &&op_binz,
+        [OP_JMP] = &&op_jmp,       [OP_IN] = &&op_in,         [OP_END] = &&op_end,
+        [OP_ADDI] = &&op_addi,     [OP_SUBI] = &&op_subi,     [OP_DUP_BIZ] = &&op_dup_biz,
+        [OP_DUP_BINZ] = &&op_dup_binz,
+        [OP_LOAD] = &&op_load,     [OP_STORE] = &&op_store,
+        [OP_DIM ... OP_DOT] = &&op_array,
+    };
+    static void* const profile_labels[OP_COUNT] = {
+        [0 ... OP_COUNT - 1] = &&op_profile,
+    };
+
+    void* const* table = profile ? profile_labels : labels;
+    const Instr* code = bytecode->code;
+    const Instr* ip = code;
+    int top = sp;
+    char buffer[32];
+    int line = -1;
+    unsigned long long last = 0;
+    // DISPATCH() takes one off the countdown before each instruction, so it
+    // starts one above the interval: handlers run since the last poll are
+    // always interval + 1 - countdown
+    unsigned int interval = start_run_limits();
+    unsigned int countdown = interval + 1;
+    unsigned long long executed = 0;
+
+#define DISPATCH() do {                         \
+        if (--countdown == 0) goto poll;        \
+        goto *table[ip->op];                    \
+    } while (0)
+
+    DISPATCH();
+
+op_printt:
+    print_string(bytecode->strings + ip->operand);
+    print_string("\n");
+    ip++;
+    DISPATCH();
+op_printv:
+    itoa(vm_peek(top), buffer, 10);
+    print_string(buffer);
+    print_string("\n");
+    ip++;
+    DISPATCH();
+op_push:
+    vm_push(&top, ip->operand);
+    ip++;
+    DISPATCH();
+op_pop:
+    vm_pop(&top);
+    ip++;
+    DISPATCH();
+op_dup:
+    vm_push(&top, vm_peek(top));
+    ip++;
+    DISPATCH();
+op_add: {
+        int b = vm_pop(&top);
+        int a = vm_pop(&top);
+        vm_push(&top, a + b);
+        ip++;
+        DISPATCH();
+    }
+op_sub: {
+        int a = vm_pop(&top);
+        int b = vm_pop(&top);
+        vm_push(&top, a - b);
+        ip++;
+        DISPATCH();
+    }
+op_biz:
+    ip = vm_peek(top) == 0 ? code + ip->operand : ip + 1;
+    DISPATCH();
+op_binz:
+    ip = vm_peek(top) != 0 ? code + ip->operand : ip + 1;
+    DISPATCH();
+op_jmp:
+    ip = code + ip->operand;
+    DISPATCH();
+op_in:
+    vm_push(&top, read_number());
+    ip++;
+    DISPATCH();
+op_load:
+    vm_push(&top, variables[ip->operand]);
+    ip++;
+    DISPATCH();
+op_store:
+    variables[ip->operand] = vm_pop(&top);
+    ip++;
+    DISPATCH();
+op_array:
+    vm_array_op(&top, ip);
+    ip++;
+    DISPATCH();
+op_addi:
+    vm_add_immediate(&top, ip->operand);
+    ip++;
+    DISPATCH();
+op_subi:
+    vm_sub_immediate(&top, ip->operand);
+    ip++;
+    DISPATCH();
+op_dup_biz:
+    vm_push(&top, vm_peek(top));
+    ip = vm_peek(top) == 0 ? code + ip->operand : ip + 1;
+    DISPATCH();
+op_dup_binz:
+    vm_push(&top, vm_peek(top));
+    ip = vm_peek(top) != 0 ? code + ip->operand : ip + 1;
+    DISPATCH();
+
+op_profile: {
+        unsigned long long now = read_tsc();
+        if (line >= 0) profile->cycles[line] += now - last;
+        line = ip->line;
+        profile->counts[line]++;
+        last = read_tsc();      // keep the bookkeeping itself out of the numbers
+        goto *labels[ip->op];
+    }
+
+poll:
+    executed += interval;
+    interval = next_poll_interval(executed);
+    countdown = interval + 1;
+    if (run_limit_reached(executed)) goto op_end;
+    DISPATCH();
+
+op_end:
+    if (profile && line >= 0) profile->cycles[line] += read_tsc() - last;
+    sp = top;
+    finish_run_limits();
+    metric_add(METRIC_BASIC_INSTRUCTIONS, executed + (interval + 1 - countdown));
+#undef DISPATCH
+}
+
+// Execute a single instruction on the global stack and return the index of
+// the next one, or -1 when the program stops. Used by the JIT for the
+// instructions it does not translate itself.
+int execute_instruction(const Bytecode* bytecode, int index) {
+    const Instr* instr = &bytecode->code[index];
+    int top = sp;
+    int next = index + 1;
+    char buffer[32];
+
+    switch (instr->op) {
+        case OP_PRINTT:
+            print_string(bytecode->strings + instr->operand);
+            print_string("\n");
+            break;
+        case OP_PRINTV:
+            itoa(vm_peek(top), buffer, 10);
+            print_string(buffer);
+            print_string("\n");
+            break;
+        case OP_PUSH:
+            vm_push(&top, instr->operand);
+            break;
+        case OP_POP:
+            vm_pop(&top);
+            break;
+        case OP_DUP:
+            vm_push(&top, vm_peek(top));
+            break;
+        case OP_ADD: {
+            int b = vm_pop(&top);
+            int a = vm_pop(&top);
+            vm_push(&top, a + b);
+            break;
+        }
+        case OP_SUB: {
+            int a = vm_pop(&top);
+            int b = vm_pop(&top);
+            vm_push(&top, a - b);
+            break;
+        }
+        case OP_BIZ:
+            if (vm_peek(top) == 0) next = instr->operand;
+            break;
+        case OP_BINZ:
+            if (vm_peek(top) != 0) next = instr->operand;
+            break;
+        case OP_JMP:
+            next = instr->operand;
+            break;
+        case OP_IN:
+            vm_push(&top, read_number());
+            break;
+        case OP_LOAD:
+            vm_push(&top, variables[instr->operand]);
+            break;
+        case OP_STORE:
+            variables[instr->operand] = vm_pop(&top);
+            break;
+        case OP_DIM:
+        case OP_ALOAD:
+        case OP_ASTORE:
+        case OP_LEN:
+        case OP_FILL:
+        case OP_COPY:
+        case OP_SUM:
+        case OP_MIN:
+        case OP_MAX:
+        case OP_DOT:
+            vm_array_op(&top, instr);
+            break;
+        case OP_ADDI:
+            vm_add_immediate(&top, instr->operand);
+            break;
+        case OP_SUBI:
+            vm_sub_immediate(&top, instr->operand);
+            break;
+        case OP_DUP_BIZ:
+            vm_push(&top, vm_peek(top));
+            if (vm_peek(top) == 0) next = instr->operand;
+            break;
+        case OP_DUP_BINZ:
+            vm_push(&top, vm_peek(top));
+            if (vm_peek(top) != 0) next = instr->operand;
+            break;
+        default:
+            next = -1;
+            break;
+    }
+
+    sp = top;
+    return next;
+}
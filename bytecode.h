@@ -0,0 +1,92 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#define STACK_SIZE 128
+#define POLL_INTERVAL 4096      // instructions between break key checks
+
+typedef enum {
+    OP_PRINTT,      // operand: offset of the text in the string pool
+    OP_PRINTV,
+    OP_PUSH,        // operand: value
+    OP_POP,
+    OP_DUP,
+    OP_ADD,
+    OP_SUB,
+    OP_BIZ,         // operand: instruction index
+    OP_BINZ,        // operand: instruction index
+    OP_JMP,         // operand: instruction index
+    OP_IN,
+    OP_END,
+    OP_LOAD,        // operand: variable slot
+    OP_STORE,       // operand: variable slot
+    OP_DIM,         // operand: array slot, size from the stack
+    OP_ALOAD,       // operand: array slot, index from the stack
+    OP_ASTORE,      // operand: array slot, index then value from the stack
+    OP_LEN,         // operand: array slot
+    OP_FILL,        // operand: array slot, value from the stack
+    OP_COPY,        // operand: source array, operand2: destination array
+    OP_SUM,         // operand: array slot
+    OP_MIN,         // operand: array slot
+    OP_MAX,         // operand: array slot
+    OP_DOT,         // operand, operand2: array slots
+    // Superinstructions, only produced by the optimiser
+    OP_ADDI,        // push operand + add
+    OP_SUBI,        // push operand + sub (operand minus the top)
+    OP_DUP_BIZ,     // dup + biz, operand: instruction index
+    OP_DUP_BINZ,    // dup + binz, operand: instruction index
+    OP_COUNT
+} Opcode;
+
+typedef struct {
+    int operand;
+    unsigned short line;    // source line index, for errors and profiling
+    unsigned char op;
+    unsigned char operand2; // second array slot for copy and dot
+} Instr;
+
+typedef struct {
+    Instr* code;
+    int count;
+    char* strings;
+    unsigned int string_size;
+    int* line_numbers;      // BASIC line number of every source line
+    int line_count;
+} Bytecode;
+
+// Per source line counters filled in by a profiled run; both arrays need
+// line_count + 1 entries (the last one belongs to the implicit end)
+typedef struct {
+    unsigned int* counts;
+    unsigned long long* cycles;
+} Profile;
+
+#define MAX_VARIABLES 64
+#define MAX_ARRAYS    16
+#define MAX_NAME      16
+
+typedef struct {
+    int* data;
+    int size;
+} IntArray;
+
+extern int stack[STACK_SIZE];
+extern int sp;
+extern int variables[MAX_VARIABLES];
+extern IntArray arrays[MAX_ARRAYS];
+
+int compile_program(Bytecode* bytecode);
+void free_bytecode(Bytecode* bytecode);
+void reset_program_state();
+void execute_bytecode(const Bytecode* bytecode, Profile* profile);
+int execute_instruction(const Bytecode* bytecode, int index);
+int break_pressed();
+
+extern unsigned int instruction_budget;     // 0 = unlimited
+extern unsigned int time_budget_ms;         // 0 = unlimited
+
+unsigned int start_run_limits();
+unsigned int next_poll_interval(unsigned long long executed);
+int run_limit_reached(unsigned long long executed);
+void finish_run_limits();
+
+#endif
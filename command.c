@@ -0,0 +1,193 @@
+#include "command.h"
+#include "metrics.h"
+#include "util.h"
+
+// Commands are looked up through an open-addressed hash table (FNV-1a,
+// linear probing), so dispatch cost no longer depends on table position.
+
+#define COMMAND_SLOTS 128   // power of two, at least twice the command count
+
+int command_errors = 0;
+
+static const Command* command_table = 0;
+static int command_count = 0;
+
+static const Command* slots[COMMAND_SLOTS];
+static unsigned int slot_hashes[COMMAND_SLOTS];
+static int command_metrics[COMMAND_SLOTS / 2];  // "commands.<name>" counters
+
+static unsigned int hash_name(const char* name) {
+    unsigned int hash = 2166136261u;
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void register_commands(const Command* table, int count) {
+    // Keep the table at most half full so probes stay short. Say which
+    // commands are left out rather than have them come up as unknown.
+    if (count > COMMAND_SLOTS / 2) {
+        char buffer[12];
+        command_error("\nCommand table full, raise COMMAND_SLOTS. Not registered: ");
+        print_string(table[COMMAND_SLOTS / 2].name);
+        print_string(" and ");
+        int_to_string(count - COMMAND_SLOTS / 2 - 1, buffer);
+        print_string(buffer);
+        print_string(" more");
+        count = COMMAND_SLOTS / 2;
+    }
+
+    command_table = table;
+    command_count = count;
+
+    for (int i = 0; i < COMMAND_SLOTS; i++) slots[i] = 0;
+
+    for (int i = 0; i < count; i++) {
+        unsigned int hash = hash_name(table[i].name);
+        unsigned int slot = hash & (COMMAND_SLOTS - 1);
+        while (slots[slot]) slot = (slot + 1) & (COMMAND_SLOTS - 1);
+        slots[slot] = &table[i];
+        slot_hashes[slot] = hash;
+        command_metrics[i] = metric_register("commands", table[i].name);
+    }
+}
+
+const Command* find_command(const char* name) {
+    unsigned int hash = hash_name(name);
+    unsigned int slot = hash & (COMMAND_SLOTS - 1);
+
+    while (slots[slot]) {
+        if (slot_hashes[slot] == hash && compare_strings(slots[slot]->name, name))
+            return slots[slot];
+        slot = (slot + 1) & (COMMAND_SLOTS - 1);
+    }
+    return 0;
+}
+
+// Print an error and count it; batch mode reports the count as exit status
+void command_error(const char* message) {
+    print_string(message);
+    command_errors++;
+}
+
+int count_arguments(const char* args) {
+    int count = 0;
+    while (*args) {
+        while (*args == ' ') args++;
+        if (!*args) break;
+        count++;
+        while (*args && *args != ' ') args++;
+    }
+    return count;
+}
+
+// Split a command line at its first space into the name and the rest,
+// truncating each to fit its buffer
+void split_command_line(const char* line, char* name, int name_size, char* args, int args_size) {
+    int name_length = 0;
+    while (*line && *line != ' ') {
+        if (name_length < name_size - 1) name[name_length++] = *line;
+        line++;
+    }
+    name[name_length] = 0;
+
+    int args_length = 0;
+    if (*line) line++;
+    while (*line) {
+        if (args_length < args_size - 1) args[args_length++] = *line;
+        line++;
+    }
+    args[args_length] = 0;
+}
+
+void print_command_usage(const Command* command) {
+    print_string("\nUsage: ");
+    print_string(command->name);
+    if (command->usage[0]) {
+        print_string(" ");
+        print_string(command->usage);
+    }
+}
+
+// Returns 0 when the arguments did not satisfy the command's minimum
+int dispatch_command(const Command* command, const char* args) {
+    if (command->min_args && count_arguments(args) < command->min_args) {
+        print_command_usage(command);
+        command_errors++;
+        return 0;
+    }
+    int metric = command_metrics[command - command_table];
+    if (metric >= 0) metric_inc(metric);
+    command->handler(args);
+    return 1;
+}
+
+void print_command_help() {
+    print_string("\nAvailable commands:");
+    for (int i = 0; i < command_count; i++) {
+        const Command* command = &command_table[i];
+        int column = 2 + string_length(command->name);
+
+        print_string("\n- ");
+        print_string(command->name);
+        if (command->usage[0]) {
+            print_string(" ");
+            print_string(command->usage);
+            column += 1 + string_length(command->usage);
+        }
+        if (command->description[0]) {
+            do {
+                print_string(" ");
+                column++;
+            } while (column < 26);
+            print_string(command->description);
+        }
+    }
+}
+
+// Writes the characters that extend 'prefix' towards the matching command
+// names into 'completion' (with a trailing space once the match is unique)
+// and returns how many commands matched.
+int complete_command(const char* prefix, char* completion, int max_length) {
+    const Command* first = 0;
+    int matches = 0;
+    int common = 0;
+    int prefix_length = string_length(prefix);
+
+    for (int i = 0; i < command_count; i++) {
+        const char* name = command_table[i].name;
+        if (!starts_with(name, prefix)) continue;
+
+        if (!first) {
+            first = &command_table[i];
+            common = string_length(name);
+        } else {
+            int j = prefix_length;
+            while (j < common && name[j] == first->name[j]) j++;
+            common = j;
+        }
+        matches++;
+    }
+
+    int length = 0;
+    if (first) {
+        for (int j = prefix_length; j < common && length < max_length; j++) {
+            completion[length++] = first->name[j];
+        }
+        if (matches == 1 && length < max_length) completion[length++] = ' ';
+    }
+    completion[length] = 0;
+    return matches;
+}
+
+void print_command_matches(const char* prefix) {
+    print_string("\n");
+    for (int i = 0; i < command_count; i++) {
+        if (starts_with(command_table[i].name, prefix)) {
+            print_string(command_table[i].name);
+            print_string("  ");
+        }
+    }
+}
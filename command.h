@@ -0,0 +1,28 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+typedef struct {
+    const char* name;
+    const char* usage;          // argument synopsis shown by help, e.g. "<addr> <value>"
+    const char* description;
+    int min_args;
+    void (*handler)(const char* args);
+    // Optional: consume piped input one line at a time (line is 0 at end of
+    // input). 'state' is zeroed per pipeline stage.
+    void (*filter)(const char* args, const char* line, int* state);
+} Command;
+
+extern int command_errors;
+
+void command_error(const char* message);
+void register_commands(const Command* table, int count);
+const Command* find_command(const char* name);
+int count_arguments(const char* args);
+void split_command_line(const char* line, char* name, int name_size, char* args, int args_size);
+int dispatch_command(const Command* command, const char* args);
+void print_command_usage(const Command* command);
+void print_command_help();
+int complete_command(const char* prefix, char* completion, int max_length);
+void print_command_matches(const char* prefix);
+
+#endif
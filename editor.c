@@ -1,114 +1,375 @@
 #include "editor.h"
+#include "fs.h"
+#include "heap.h"
 #include "util.h"
 
-#define MAX_FILES 10
-
-typedef struct {
-    char name[16];
-    char content[FILE_HEIGHT][FILE_WIDTH + 1]; // +1 for null terminator
-} TextFile;
-
 extern char* video_memory;
 extern unsigned short cursor_pos;
 
-extern TextFile files[MAX_FILES];
-
 #define ARROW_UP    0x48
 #define ARROW_DOWN  0x50
 #define ARROW_LEFT  0x4B
 #define ARROW_RIGHT 0x4D
+#define KEY_HOME    0x47
+#define KEY_END     0x4F
+#define KEY_PGUP    0x49
+#define KEY_PGDN    0x51
+#define KEY_DELETE  0x53
+
+#define EDIT_ROWS    (HEIGHT - 1)   // bottom row is the status bar
+#define TEXT_COLOR   0x1F           // Blue background, white text
+#define STATUS_COLOR 0x70
+#define GAP_MIN      1024
+
+// The text lives in a gap buffer: [text before cursor][gap][text after cursor].
+// Typing only touches the gap, and moving the cursor moves the gap, so edit
+// cost depends on how far the cursor travels rather than on the file size.
+typedef struct {
+    char* buf;
+    unsigned int capacity;
+    unsigned int gap_start;   // == cursor position
+    unsigned int gap_end;
+} GapBuffer;
+
+static GapBuffer gb;
+
+// Shadow copy of the screen, so only cells that really change get written
+static unsigned short shadow[WIDTH * HEIGHT];
+static char saved_screen[WIDTH * HEIGHT * 2];
+
+static unsigned int line_count;
+static unsigned int cur_line, cur_col, want_col;
+static unsigned int top_line, top_pos, left_col;
+static int modified;
+
+static unsigned int gb_length() {
+    return gb.capacity - (gb.gap_end - gb.gap_start);
+}
+
+static char gb_at(unsigned int pos) {
+    if (pos < gb.gap_start) return gb.buf[pos];
+    return gb.buf[pos + (gb.gap_end - gb.gap_start)];
+}
+
+static void gb_move_gap(unsigned int pos) {
+    if (pos < gb.gap_start) {
+        unsigned int count = gb.gap_start - pos;
+        memmove(gb.buf + gb.gap_end - count, gb.buf + pos, count);
+        gb.gap_start -= count;
+        gb.gap_end -= count;
+    } else if (pos > gb.gap_start) {
+        unsigned int count = pos - gb.gap_start;
+        memmove(gb.buf + gb.gap_start, gb.buf + gb.gap_end, count);
+        gb.gap_start += count;
+        gb.gap_end += count;
+    }
+}
+
+static int gb_grow() {
+    unsigned int tail = gb.capacity - gb.gap_end;
+    unsigned int capacity = gb.capacity * 2;
+    if (capacity < GAP_MIN) capacity = GAP_MIN;
+
+    char* buf = (char*)krealloc(gb.buf, capacity);
+    if (!buf) return 0;
+    memmove(buf + capacity - tail, buf + gb.gap_end, tail);
+    gb.buf = buf;
+    gb.gap_end = capacity - tail;
+    gb.capacity = capacity;
+    return 1;
+}
+
+static int gb_load(const TextFile* file) {
+    gb.capacity = file->size + GAP_MIN;
+    gb.buf = (char*)kmalloc(gb.capacity);
+    if (!gb.buf) return 0;
+
+    // Text goes behind the gap so the cursor starts at the top for free
+    gb.gap_start = 0;
+    gb.gap_end = gb.capacity - file->size;
+    if (file->size) memcpy(gb.buf + gb.gap_end, file->data, file->size);
+
+    line_count = 1;
+    for (unsigned int i = 0; i < file->size; i++) {
+        if (file->data[i] == '\n') line_count++;
+    }
+    return 1;
+}
+
+static unsigned int line_start(unsigned int pos) {
+    while (pos > 0 && gb_at(pos - 1) != '\n') pos--;
+    return pos;
+}
+
+static unsigned int line_end(unsigned int pos) {
+    unsigned int len = gb_length();
+    while (pos < len && gb_at(pos) != '\n') pos++;
+    return pos;
+}
 
 void update_cursor_position(int x, int y) {
     cursor_pos = y * WIDTH + x;
     update_cursor();
 }
 
-void clear_screen_blue() {
-    for (int y = 0; y < HEIGHT; y++) {
-        for (int x = 0; x < WIDTH; x++) {
-            int idx = (y * WIDTH + x) * 2;
-            video_memory[idx] = ' ';
-            video_memory[idx + 1] = 0x1F;
-        }
+// --- Cursor movement -------------------------------------------------------
+
+static void move_left() {
+    unsigned int cursor = gb.gap_start;
+    if (cursor == 0) return;
+
+    gb_move_gap(cursor - 1);
+    if (cur_col > 0) {
+        cur_col--;
+    } else {
+        cur_line--;
+        cur_col = gb.gap_start - line_start(gb.gap_start);
     }
+    want_col = cur_col;
 }
 
-void draw_editor_screen(int file_index) {
-    for (int y = 0; y < FILE_HEIGHT; y++) {
-        for (int x = 0; x < FILE_WIDTH; x++) {
-            int idx = (y * WIDTH + x) * 2;
-            video_memory[idx] = files[file_index].content[y][x];
-            video_memory[idx + 1] = 0x1F; // Blue background, white text
-        }
+static void move_right() {
+    unsigned int cursor = gb.gap_start;
+    if (cursor >= gb_length()) return;
+
+    char c = gb_at(cursor);
+    gb_move_gap(cursor + 1);
+    if (c == '\n') {
+        cur_line++;
+        cur_col = 0;
+    } else {
+        cur_col++;
     }
+    want_col = cur_col;
 }
 
-void start_editor(const char* filename) {
-    int file_index = -1;
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (compare_strings(files[i].name, filename)) {
-            file_index = i;
-            break;
-        }
+static void move_up() {
+    if (cur_line == 0) return;
+
+    unsigned int start = gb.gap_start - cur_col;
+    unsigned int prev_start = line_start(start - 1);
+    unsigned int prev_len = (start - 1) - prev_start;
+    unsigned int col = want_col < prev_len ? want_col : prev_len;
+
+    gb_move_gap(prev_start + col);
+    cur_line--;
+    cur_col = col;
+}
+
+static void move_down() {
+    unsigned int end = line_end(gb.gap_start);
+    if (end >= gb_length()) return;
+
+    unsigned int next_start = end + 1;
+    unsigned int next_len = line_end(next_start) - next_start;
+    unsigned int col = want_col < next_len ? want_col : next_len;
+
+    gb_move_gap(next_start + col);
+    cur_line++;
+    cur_col = col;
+}
+
+static void move_home() {
+    gb_move_gap(gb.gap_start - cur_col);
+    cur_col = 0;
+    want_col = 0;
+}
+
+static void move_end() {
+    unsigned int end = line_end(gb.gap_start);
+    cur_col += end - gb.gap_start;
+    gb_move_gap(end);
+    want_col = cur_col;
+}
+
+// --- Editing ---------------------------------------------------------------
+
+static void insert_char(char c) {
+    if (gb.gap_start == gb.gap_end && !gb_grow()) return;
+
+    gb.buf[gb.gap_start++] = c;
+    if (c == '\n') {
+        line_count++;
+        cur_line++;
+        cur_col = 0;
+    } else {
+        cur_col++;
+    }
+    want_col = cur_col;
+    modified = 1;
+}
+
+static void delete_before() {
+    if (gb.gap_start == 0) return;
+
+    char c = gb.buf[--gb.gap_start];
+    if (c == '\n') {
+        // Joined with the previous line
+        line_count--;
+        cur_line--;
+        cur_col = gb.gap_start - line_start(gb.gap_start);
+    } else {
+        cur_col--;
+    }
+    want_col = cur_col;
+    modified = 1;
+}
+
+static void delete_after() {
+    if (gb.gap_end == gb.capacity) return;
+
+    if (gb.buf[gb.gap_end++] == '\n') line_count--;
+    modified = 1;
+}
+
+// --- Drawing ---------------------------------------------------------------
+
+static void put_cell(int index, char c, unsigned char attr) {
+    unsigned short cell = (unsigned char)c | (attr << 8);
+    if (shadow[index] == cell) return;
+
+    shadow[index] = cell;
+    video_memory[index * 2] = c;
+    video_memory[index * 2 + 1] = attr;
+}
+
+// Keep the cursor inside the viewport, scrolling by whole lines/columns
+static void scroll_to_cursor() {
+    if (cur_line < top_line) {
+        top_line = cur_line;
+        top_pos = gb.gap_start - cur_col;
     }
-    if (file_index == -1) {
-        for (int i = 0; i < MAX_FILES; i++) {
-            if (!files[i].name[0]) {
-                copy_string(files[i].name, filename);
-                for (int y = 0; y < FILE_HEIGHT; y++) {
-                    for (int x = 0; x < FILE_WIDTH; x++) {
-                        files[i].content[y][x] = ' ';
-                    }
-                    files[i].content[y][FILE_WIDTH] = 0;
-                }
-                file_index = i;
-                break;
+    while (cur_line >= top_line + EDIT_ROWS) {
+        top_pos = line_end(top_pos) + 1;
+        top_line++;
+    }
+
+    if (cur_col < left_col) left_col = cur_col;
+    if (cur_col >= left_col + WIDTH) left_col = cur_col - WIDTH + 1;
+}
+
+static void draw_text() {
+    unsigned int len = gb_length();
+    unsigned int pos = top_pos;
+    int has_line = 1;
+
+    for (int row = 0; row < EDIT_ROWS; row++) {
+        int col = 0;
+
+        if (has_line) {
+            unsigned int end = line_end(pos);
+            unsigned int from = pos + left_col;
+            for (unsigned int p = from; p < end && col < WIDTH; p++) {
+                put_cell(row * WIDTH + col, gb_at(p), TEXT_COLOR);
+                col++;
             }
+            if (end < len) pos = end + 1;
+            else has_line = 0;
         }
+
+        for (; col < WIDTH; col++) {
+            put_cell(row * WIDTH + col, ' ', TEXT_COLOR);
+        }
+    }
+}
+
+static void append_text(char* dest, int* pos, const char* text) {
+    while (*text && *pos < WIDTH) dest[(*pos)++] = *text++;
+}
+
+static void append_number(char* dest, int* pos, unsigned int value) {
+    char buffer[12];
+    int_to_string((int)value, buffer);
+    append_text(dest, pos, buffer);
+}
+
+static void draw_status(const TextFile* file) {
+    char status[WIDTH + 1];
+    int pos = 0;
+
+    append_text(status, &pos, " ");
+    append_text(status, &pos, file->name);
+    append_text(status, &pos, modified ? " [+]" : "");
+    append_text(status, &pos, "  Ln ");
+    append_number(status, &pos, cur_line + 1);
+    append_text(status, &pos, "/");
+    append_number(status, &pos, line_count);
+    append_text(status, &pos, "  Col ");
+    append_number(status, &pos, cur_col + 1);
+    append_text(status, &pos, "    ESC: save & exit");
+
+    for (int col = 0; col < WIDTH; col++) {
+        char c = col < pos ? status[col] : ' ';
+        put_cell(EDIT_ROWS * WIDTH + col, c, STATUS_COLOR);
     }
-    if (file_index == -1) {
+}
+
+void start_editor(const char* filename) {
+    TextFile* file = create_file(filename);
+    if (!file) {
         print_string("\nNo space for new file.");
         return;
     }
+    if (!gb_load(file)) {
+        print_string("\nOut of memory.");
+        return;
+    }
+
+    cur_line = cur_col = want_col = 0;
+    top_line = top_pos = left_col = 0;
+    modified = 0;
 
-    int cx = 0, cy = 0;
-    clear_screen_blue();
-    draw_editor_screen(file_index);
+    unsigned short saved_cursor = cursor_pos;
+    memcpy(saved_screen, video_memory, sizeof(saved_screen));
+    for (int i = 0; i < WIDTH * HEIGHT; i++) shadow[i] = 0xFFFF;
 
     while (1) {
-        update_cursor_position(cx, cy);
+        scroll_to_cursor();
+        draw_text();
+        draw_status(file);
+        update_cursor_position(cur_col - left_col, cur_line - top_line);
+
         char* key = get_keypress();
 
         if (key[0] == 27) break; // ESC
 
         if (key[0] == 0) {
-            switch (key[1]) {
-                case ARROW_UP: if (cy > 0) cy--; break;
-                case ARROW_DOWN: if (cy < FILE_HEIGHT - 1) cy++; break;
-                case ARROW_LEFT: if (cx > 0) cx--; break;
-                case ARROW_RIGHT: if (cx < FILE_WIDTH - 1) cx++; break;
+            switch ((unsigned char)key[1]) {
+                case ARROW_UP: move_up(); break;
+                case ARROW_DOWN: move_down(); break;
+                case ARROW_LEFT: move_left(); break;
+                case ARROW_RIGHT: move_right(); break;
+                case KEY_HOME: move_home(); break;
+                case KEY_END: move_end(); break;
+                case KEY_DELETE: delete_after(); break;
+                case KEY_PGUP:
+                    for (int i = 0; i < EDIT_ROWS - 1; i++) move_up();
+                    break;
+                case KEY_PGDN:
+                    for (int i = 0; i < EDIT_ROWS - 1; i++) move_down();
+                    break;
             }
         } else if (key[0] == '\b') {
-            if (cx > 0) {
-                cx--;
-                files[file_index].content[cy][cx] = ' ';
-            }
-        } else if (key[0] >= 32 && key[0] <= 126) {
-            files[file_index].content[cy][cx] = key[0];
-            cx = (cx + 1) % FILE_WIDTH;
+            delete_before();
+        } else if (key[0] == '\t') {
+            for (int i = 0; i < 4; i++) insert_char(' ');
         } else if (key[0] == '\n') {
-            if (cy < FILE_HEIGHT - 1) {
-                cy++;
-                cx = 0;
-            }
+            insert_char('\n');
+        } else if (key[0] >= 32 && key[0] <= 126) {
+            insert_char(key[0]);
         }
+    }
 
-
-        // Redraw line with blue background
-        for (int x = 0; x < FILE_WIDTH; x++) {
-            int idx = (cy * WIDTH + x) * 2;
-            video_memory[idx] = files[file_index].content[cy][x];
-            video_memory[idx + 1] = 0x1F; // Blue background
-        }
+    int saved = 1;
+    if (modified) {
+        gb_move_gap(gb_length());
+        saved = file_write(file, gb.buf, gb_length());
     }
+    kfree(gb.buf);
+    gb.buf = 0;
+
+    memcpy(video_memory, saved_screen, sizeof(saved_screen));
+    cursor_pos = saved_cursor;
+    update_cursor();
+    if (!saved) print_string("\nOut of memory, file not saved.");
 }
@@ -0,0 +1,51 @@
+#include "elf.h"
+
+// Only the headers are read here: every PT_LOAD segment becomes a region
+// of the address space and its pages are filled from the file when the
+// program first touches them, so loading takes the same time for any size.
+
+#define ELF_MAGIC    0x464C457F     // "\x7FELF"
+#define ELFCLASS32   1
+#define ELFDATA2LSB  1
+#define ET_EXEC      2
+#define EM_386       3
+#define PT_LOAD      1
+#define PF_W         2
+
+unsigned int elf_load(TextFile* file, AddressSpace* space, const char** error) {
+    const ElfHeader* header = (const ElfHeader*)file->data;
+    if (!header || file->size < sizeof(ElfHeader) || *(const unsigned int*)header->ident != ELF_MAGIC) {
+        *error = "not an ELF file";
+        return 0;
+    }
+    if (header->ident[4] != ELFCLASS32 || header->ident[5] != ELFDATA2LSB ||
+        header->type != ET_EXEC || header->machine != EM_386) {
+        *error = "not a static i386 executable";
+        return 0;
+    }
+    if (header->phentsize != sizeof(ElfProgramHeader) || header->phoff > file->size ||
+        header->phnum > (file->size - header->phoff) / sizeof(ElfProgramHeader)) {
+        *error = "bad program headers";
+        return 0;
+    }
+
+    const ElfProgramHeader* segments = (const ElfProgramHeader*)(file->data + header->phoff);
+    for (int i = 0; i < header->phnum; i++) {
+        const ElfProgramHeader* segment = &segments[i];
+        if (segment->type != PT_LOAD || !segment->memsz) continue;
+
+        unsigned int end = segment->vaddr + segment->memsz;
+        if (end < segment->vaddr || segment->filesz > segment->memsz ||
+            segment->offset > file->size || segment->filesz > file->size - segment->offset ||
+            !address_space_map(space, segment->vaddr, end, segment->offset, segment->filesz, segment->flags & PF_W)) {
+            *error = "bad segment layout";
+            return 0;
+        }
+    }
+
+    if (header->entry < USER_BASE || header->entry >= USER_TOP) {
+        *error = "entry point outside the user window";
+        return 0;
+    }
+    return header->entry;
+}
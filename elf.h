@@ -0,0 +1,66 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include "fs.h"
+#include "paging.h"
+
+// Statically linked ELF32 i386 executables, linked into the user window
+
+typedef struct {
+    unsigned char ident[16];
+    unsigned short type;
+    unsigned short machine;
+    unsigned int version;
+    unsigned int entry;
+    unsigned int phoff;
+    unsigned int shoff;
+    unsigned int flags;
+    unsigned short ehsize;
+    unsigned short phentsize;
+    unsigned short phnum;
+    unsigned short shentsize;
+    unsigned short shnum;
+    unsigned short shstrndx;
+} ElfHeader;
+
+typedef struct {
+    unsigned int type;
+    unsigned int offset;
+    unsigned int vaddr;
+    unsigned int paddr;
+    unsigned int filesz;
+    unsigned int memsz;
+    unsigned int flags;
+    unsigned int align;
+} ElfProgramHeader;
+
+typedef struct {
+    unsigned int name;
+    unsigned int type;
+    unsigned int flags;
+    unsigned int addr;
+    unsigned int offset;
+    unsigned int size;
+    unsigned int link;
+    unsigned int info;
+    unsigned int addralign;
+    unsigned int entsize;
+} ElfSectionHeader;
+
+typedef struct {
+    unsigned int name;
+    unsigned int value;
+    unsigned int size;
+    unsigned char info;
+    unsigned char other;
+    unsigned short shndx;
+} ElfSymbol;
+
+#define SHT_SYMTAB 2
+#define STT_FUNC   2
+
+// Sets up the address space for the program in 'file' and returns its
+// entry point, or 0 with a message in *error
+unsigned int elf_load(TextFile* file, AddressSpace* space, const char** error);
+
+#endif
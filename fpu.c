@@ -0,0 +1,151 @@
+#include "fpu.h"
+#include "heap.h"
+#include "interrupts.h"
+#include "thread.h"
+#include "util.h"
+
+// x87/SSE state is switched lazily. CR0.TS is set whenever a thread is
+// switched in whose registers aren't loaded, so its first FPU or SSE
+// instruction traps (#NM) and the state is restored then. A thread that
+// never touches the FPU never traps and never has its state saved; one
+// that did is saved when it is switched out, which keeps the state
+// correct when another CPU steals the thread.
+
+#define CR0_MP         0x00000002
+#define CR0_EM         0x00000004
+#define CR0_TS         0x00000008
+#define CR0_NE         0x00000020
+#define CR4_OSFXSR     0x00000200
+#define CR4_OSXMMEXCPT 0x00000400
+
+#define CPUID_FXSR     (1 << 24)
+#define CPUID_SSE      (1 << 25)
+#define CPUID_SSE2     (1 << 26)
+
+#define FPU_STATE_SIZE 512          // FXSAVE area (FSAVE needs 108)
+#define MXCSR_DEFAULT  0x1F80       // all SSE exceptions masked
+
+int fpu_has_sse2 = 0;
+static int fpu_has_fxsr = 0;
+static int fpu_has_sse = 0;
+
+static unsigned int read_cr0() {
+    unsigned int value;
+    __asm__ __volatile__ ("movl %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static void write_cr0(unsigned int value) {
+    __asm__ __volatile__ ("movl %0, %%cr0" :: "r"(value) : "memory");
+}
+
+static void set_trap(Cpu* cpu) {
+    write_cr0(read_cr0() | CR0_TS);
+    cpu->fpu_trap = 1;
+}
+
+static void clear_trap(Cpu* cpu) {
+    __asm__ __volatile__ ("clts" ::: "memory");
+    cpu->fpu_trap = 0;
+}
+
+// Called on every CPU during start-up
+void fpu_init() {
+    unsigned int regs[4];
+    cpuid(1, regs);
+    fpu_has_fxsr = (regs[3] & CPUID_FXSR) != 0;
+    fpu_has_sse = fpu_has_fxsr && (regs[3] & CPUID_SSE);
+    fpu_has_sse2 = fpu_has_sse && (regs[3] & CPUID_SSE2);
+
+    write_cr0((read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE);
+    if (fpu_has_sse) {
+        unsigned int cr4;
+        __asm__ __volatile__ ("movl %%cr4, %0" : "=r"(cr4));
+        cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+        __asm__ __volatile__ ("movl %0, %%cr4" :: "r"(cr4));
+    }
+    __asm__ __volatile__ ("fninit");
+
+    Cpu* cpu = this_cpu();
+    cpu->fpu_owner = 0;
+    set_trap(cpu);
+}
+
+static void save_state(unsigned char* state) {
+    if (fpu_has_fxsr) __asm__ __volatile__ ("fxsave (%0)" :: "r"(state) : "memory");
+    else __asm__ __volatile__ ("fnsave (%0)" :: "r"(state) : "memory");
+}
+
+static void restore_state(const unsigned char* state) {
+    if (fpu_has_fxsr) __asm__ __volatile__ ("fxrstor (%0)" :: "r"(state) : "memory");
+    else __asm__ __volatile__ ("frstor (%0)" :: "r"(state) : "memory");
+}
+
+// Load the thread's FPU state on this CPU. Interrupts must be disabled.
+static int activate(Thread* thread) {
+    Cpu* cpu = this_cpu();
+    clear_trap(cpu);
+    if (cpu->fpu_owner == thread && thread->fpu_cpu == cpu->index) return 1;
+
+    if (thread->fpu_state) {
+        restore_state(thread->fpu_state);
+    } else {
+        // kmalloc payloads are 16 byte aligned, as FXSAVE wants
+        thread->fpu_state = (unsigned char*)kmalloc(FPU_STATE_SIZE);
+        if (!thread->fpu_state) {
+            set_trap(cpu);
+            return 0;
+        }
+        __asm__ __volatile__ ("fninit");
+        if (fpu_has_sse) {
+            unsigned int mxcsr = MXCSR_DEFAULT;
+            __asm__ __volatile__ ("ldmxcsr %0" :: "m"(mxcsr));
+        }
+    }
+    cpu->fpu_owner = thread;
+    thread->fpu_cpu = cpu->index;
+    return 1;
+}
+
+// #NM: the current thread used the FPU with CR0.TS set. Returns 0 if the
+// trap can't be handled (no thread yet, out of memory).
+int fpu_handle_trap() {
+    Thread* thread = current_thread;
+    return thread && activate(thread);
+}
+
+// Called by the scheduler before switching stacks, interrupts disabled
+void fpu_switch(Thread* old, Thread* next) {
+    Cpu* cpu = this_cpu();
+    if (!cpu->fpu_trap) {
+        // old used the FPU since it was switched in
+        save_state(old->fpu_state);
+        old->fpu_cpu = cpu->index;
+        set_trap(cpu);
+    }
+
+    // Nobody touched the registers since next had them here: no trap needed
+    if (cpu->fpu_owner == next && next->fpu_cpu == cpu->index) clear_trap(cpu);
+}
+
+// A finished thread's state; its Thread slot may be reused
+void fpu_release(Thread* thread) {
+    kfree(thread->fpu_state);
+    thread->fpu_state = 0;
+    thread->fpu_cpu = -1;
+}
+
+// Loads the state up front so the SSE code that follows doesn't trap.
+// Switching threads inside the section is fine: the state is saved with
+// the thread.
+int kernel_fpu_begin() {
+    if (!fpu_has_sse2) return 0;
+    unsigned int flags = irq_save();
+    int ready = !this_cpu()->fpu_trap || activate(current_thread);
+    irq_restore(flags);
+    return ready;
+}
+
+// Nothing to undo: the registers are saved at the next switch if needed
+void kernel_fpu_end() {
+}
@@ -0,0 +1,24 @@
+#ifndef FPU_H
+#define FPU_H
+
+struct Thread;
+
+extern int fpu_has_sse2;
+
+void fpu_init();
+int fpu_handle_trap();
+void fpu_switch(struct Thread* old, struct Thread* next);
+void fpu_release(struct Thread* thread);
+
+// Kernel code about to use SSE registers (only in thread context, never in
+// an interrupt handler). Returns 0 when there is no SSE2 to use.
+int kernel_fpu_begin();
+void kernel_fpu_end();
+
+// For functions that run between the two: compiled for SSE2, working on
+// four ints at a time at any alignment (they may alias int arrays)
+#define SIMD __attribute__((target("sse2")))
+
+typedef int Vec4 __attribute__((vector_size(16), aligned(4), may_alias));
+
+#endif
@@ -0,0 +1,74 @@
+#include "fs.h"
+#include "heap.h"
+#include "metrics.h"
+#include "util.h"
+
+TextFile files[MAX_FILES] = {0};
+
+static unsigned int file_generation = 0;
+
+TextFile* find_file(const char* name) {
+    metric_inc(METRIC_FILE_LOOKUPS);
+    if (!name[0]) return 0;
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (files[i].name[0] && compare_strings(files[i].name, name))
+            return &files[i];
+    }
+    return 0;
+}
+
+TextFile* create_file(const char* name) {
+    TextFile* file = find_file(name);
+    if (file) return file;
+
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (!files[i].name[0]) {
+            int j = 0;
+            for (; name[j] && j < MAX_FILENAME - 1; j++) files[i].name[j] = name[j];
+            files[i].name[j] = 0;
+            files[i].data = 0;
+            files[i].size = 0;
+            files[i].capacity = 0;
+            files[i].version = ++file_generation;
+            return &files[i];
+        }
+    }
+    return 0;
+}
+
+// Make room for at least 'size' bytes plus the terminating NUL
+static int file_reserve(TextFile* file, unsigned int size) {
+    if (file->data && size < file->capacity) return 1;
+
+    unsigned int capacity = file->capacity ? file->capacity : 64;
+    while (capacity <= size) capacity *= 2;
+
+    char* data = (char*)krealloc(file->data, capacity);
+    if (!data) return 0;
+    file->data = data;
+    file->capacity = capacity;
+    return 1;
+}
+
+int file_write(TextFile* file, const char* data, unsigned int size) {
+    if (!file_reserve(file, size)) return 0;
+    memcpy(file->data, data, size);
+    file->size = size;
+    file->data[size] = 0;
+    file->version = ++file_generation;
+    return 1;
+}
+
+int file_append(TextFile* file, const char* data, unsigned int size) {
+    // The source may be the file itself (e.g. "cat f >> f"), which can move
+    unsigned long offset = (unsigned long)(data - file->data);
+    int self = file->data && data >= file->data && data < file->data + file->size;
+
+    if (!file_reserve(file, file->size + size)) return 0;
+    if (self) data = file->data + offset;
+    memcpy(file->data + file->size, data, size);
+    file->size += size;
+    file->data[file->size] = 0;
+    file->version = ++file_generation;
+    return 1;
+}
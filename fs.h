@@ -0,0 +1,22 @@
+#ifndef FS_H
+#define FS_H
+
+#define MAX_FILES 32
+#define MAX_FILENAME 16
+
+typedef struct {
+    char name[MAX_FILENAME];
+    char* data;             // always NUL terminated when non-zero
+    unsigned int size;
+    unsigned int capacity;
+    unsigned int version;   // changes on every write, used to invalidate caches
+} TextFile;
+
+extern TextFile files[MAX_FILES];
+
+TextFile* find_file(const char* name);
+TextFile* create_file(const char* name);
+int file_write(TextFile* file, const char* data, unsigned int size);
+int file_append(TextFile* file, const char* data, unsigned int size);
+
+#endif
@@ -0,0 +1,221 @@
+#include "heap.h"
+#include "metrics.h"
+#include "spinlock.h"
+#include "util.h"
+
+// Simple kernel heap: boundary-tagged blocks with segregated free lists.
+// Every block starts with a 16 byte header, so payloads stay 16 byte aligned.
+// All CPUs, threads and interrupt handlers share it, so the public calls
+// hold a ticket lock with interrupts disabled.
+
+#define HEAP_ALIGN      16
+#define HEAP_MIN_BLOCK  32
+#define HEAP_BINS       28
+
+#define BLOCK_USED  0xB10C0DE5
+#define BLOCK_FREE  0xF4EEB10C
+
+typedef struct {
+    unsigned int size;       // whole block including header
+    unsigned int prev_size;  // size of the block physically before this one (0 = first)
+    unsigned int magic;
+    unsigned int reserved;
+} BlockHeader;
+
+typedef struct FreeBlock {
+    BlockHeader header;
+    struct FreeBlock* next;
+    struct FreeBlock* prev;
+} FreeBlock;
+
+static FreeBlock* bins[HEAP_BINS];
+static TicketLock heap_lock;
+static char* heap_start = 0;
+static char* heap_end = 0;
+
+unsigned int heap_total_bytes = 0;
+unsigned int heap_used_bytes = 0;
+unsigned int heap_allocations = 0;
+
+static int bin_index(unsigned int size) {
+    int bin = 0;
+    while (size > 1 && bin < HEAP_BINS - 1) {
+        size >>= 1;
+        bin++;
+    }
+    return bin;
+}
+
+static BlockHeader* next_block(BlockHeader* block) {
+    char* next = (char*)block + block->size;
+    return next < heap_end ? (BlockHeader*)next : 0;
+}
+
+static BlockHeader* prev_block(BlockHeader* block) {
+    return block->prev_size ? (BlockHeader*)((char*)block - block->prev_size) : 0;
+}
+
+static void bin_insert(FreeBlock* block) {
+    int bin = bin_index(block->header.size);
+    block->header.magic = BLOCK_FREE;
+    block->prev = 0;
+    block->next = bins[bin];
+    if (bins[bin]) bins[bin]->prev = block;
+    bins[bin] = block;
+}
+
+static void bin_remove(FreeBlock* block) {
+    int bin = bin_index(block->header.size);
+    if (block->prev) block->prev->next = block->next;
+    else bins[bin] = block->next;
+    if (block->next) block->next->prev = block->prev;
+}
+
+void heap_init(void* start, void* end) {
+    unsigned long s = ((unsigned long)start + HEAP_ALIGN - 1) & ~(unsigned long)(HEAP_ALIGN - 1);
+    unsigned long e = (unsigned long)end & ~(unsigned long)(HEAP_ALIGN - 1);
+
+    for (int i = 0; i < HEAP_BINS; i++) bins[i] = 0;
+    heap_start = (char*)s;
+    heap_end = (char*)e;
+    heap_total_bytes = 0;
+    heap_used_bytes = 0;
+    heap_allocations = 0;
+    if (e <= s + HEAP_MIN_BLOCK) return;
+
+    FreeBlock* block = (FreeBlock*)heap_start;
+    block->header.size = (unsigned int)(e - s);
+    block->header.prev_size = 0;
+    block->header.reserved = 0;
+    bin_insert(block);
+    heap_total_bytes = block->header.size;
+}
+
+static unsigned int block_size_for(unsigned int size) {
+    unsigned int total = (size + sizeof(BlockHeader) + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1);
+    return total < HEAP_MIN_BLOCK ? HEAP_MIN_BLOCK : total;
+}
+
+// Cut the tail off a block if it is big enough to be useful on its own
+static void split_block(BlockHeader* block, unsigned int size) {
+    if (block->size - size < HEAP_MIN_BLOCK) return;
+
+    FreeBlock* rest = (FreeBlock*)((char*)block + size);
+    rest->header.size = block->size - size;
+    rest->header.prev_size = size;
+    rest->header.reserved = 0;
+    block->size = size;
+
+    BlockHeader* after = next_block(&rest->header);
+    if (after) after->prev_size = rest->header.size;
+    bin_insert(rest);
+}
+
+static void* alloc_block(unsigned int size) {
+    if (size > 0x7FFFFFF0) return 0;
+    unsigned int needed = block_size_for(size);
+
+    for (int bin = bin_index(needed); bin < HEAP_BINS; bin++) {
+        for (FreeBlock* block = bins[bin]; block; block = block->next) {
+            if (block->header.size < needed) continue;
+
+            bin_remove(block);
+            split_block(&block->header, needed);
+            block->header.magic = BLOCK_USED;
+            heap_used_bytes += block->header.size;
+            heap_allocations++;
+            return (char*)block + sizeof(BlockHeader);
+        }
+    }
+    return 0;
+}
+
+void* kmalloc(unsigned int size) {
+    unsigned int flags = ticket_lock_irqsave(&heap_lock);
+    void* ptr = alloc_block(size);
+    ticket_unlock_irqrestore(&heap_lock, flags);
+    if (ptr) {
+        metric_add(METRIC_HEAP_ALLOCATED, size);
+        metric_inc(METRIC_HEAP_ALLOCATIONS);
+    }
+    return ptr;
+}
+
+void* kzalloc(unsigned int size) {
+    void* ptr = kmalloc(size);
+    if (ptr) memset(ptr, 0, size);
+    return ptr;
+}
+
+static void free_block(void* ptr) {
+    BlockHeader* block = (BlockHeader*)((char*)ptr - sizeof(BlockHeader));
+    if (block->magic != BLOCK_USED) {
+        print_string("\n[heap] bad free\n");
+        return;
+    }
+    heap_used_bytes -= block->size;
+
+    // Merge with the following block
+    BlockHeader* next = next_block(block);
+    if (next && next->magic == BLOCK_FREE) {
+        bin_remove((FreeBlock*)next);
+        block->size += next->size;
+    }
+
+    // Merge with the preceding block
+    BlockHeader* prev = prev_block(block);
+    if (prev && prev->magic == BLOCK_FREE) {
+        bin_remove((FreeBlock*)prev);
+        prev->size += block->size;
+        block->magic = 0;
+        block = prev;
+    }
+
+    next = next_block(block);
+    if (next) next->prev_size = block->size;
+    bin_insert((FreeBlock*)block);
+}
+
+void kfree(void* ptr) {
+    if (!ptr) return;
+    unsigned int flags = ticket_lock_irqsave(&heap_lock);
+    free_block(ptr);
+    ticket_unlock_irqrestore(&heap_lock, flags);
+}
+
+// Grow a block in place when the neighbour is free and large enough
+static int grow_block(BlockHeader* block, unsigned int needed) {
+    BlockHeader* next = next_block(block);
+    if (next && next->magic == BLOCK_FREE && block->size + next->size >= needed) {
+        bin_remove((FreeBlock*)next);
+        heap_used_bytes += next->size;
+        block->size += next->size;
+        BlockHeader* after = next_block(block);
+        if (after) after->prev_size = block->size;
+
+        unsigned int before = block->size;
+        split_block(block, needed);
+        heap_used_bytes -= before - block->size;
+        return 1;
+    }
+    return 0;
+}
+
+void* krealloc(void* ptr, unsigned int size) {
+    if (!ptr) return kmalloc(size);
+
+    BlockHeader* block = (BlockHeader*)((char*)ptr - sizeof(BlockHeader));
+    unsigned int needed = block_size_for(size);
+    if (block->size >= needed) return ptr;
+
+    unsigned int flags = ticket_lock_irqsave(&heap_lock);
+    int grown = grow_block(block, needed);
+    ticket_unlock_irqrestore(&heap_lock, flags);
+    if (grown) return ptr;
+
+    void* fresh = kmalloc(size);
+    if (!fresh) return 0;
+    memcpy(fresh, ptr, block->size - sizeof(BlockHeader));
+    kfree(ptr);
+    return fresh;
+}
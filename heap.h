@@ -0,0 +1,14 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+extern unsigned int heap_total_bytes;
+extern unsigned int heap_used_bytes;
+extern unsigned int heap_allocations;
+
+void heap_init(void* start, void* end);
+void* kmalloc(unsigned int size);
+void* kzalloc(unsigned int size);
+void* krealloc(void* ptr, unsigned int size);
+void kfree(void* ptr);
+
+#endif
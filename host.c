@@ -0,0 +1,637 @@
+#include "basic.h"
+#include "bulk.h"
+#include "bytecode.h"
+#include "command.h"
+#include "fpu.h"
+#include "fs.h"
+#include "heap.h"
+#include "jit.h"
+#include "keyboard.h"
+#include "metrics.h"
+#include "paging.h"
+#include "pipe.h"
+#include "script.h"
+#include "serial.h"
+#include "timer.h"
+#include "util.h"
+#include "workqueue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// The portable part of the kernel (string utilities, the console, the
+// file table, scripts and the EG-Basic compiler and interpreter) built as
+// a Linux program by "make host", for perf, sanitizers and quick timing
+// runs without QEMU. The console draws into a screen buffer in memory;
+// port writes, the keyboard and the serial port are stand-ins below.
+//
+//   egterm-host [-v] [-s] [-r reps] test | bench | <file>...
+//
+// test runs self-checks (exit status = failures), bench times built-in
+// workloads, and files are timed as EG-Basic programs (*.bas) or command
+// scripts. -v shows console output, -s dumps the counters at the end.
+// Results are "BENCH name=... unit=ns" lines, like the kernel's bench.
+
+#define HEAP_SIZE     (64 * 1024 * 1024)
+#define DEFAULT_REPS  11
+#define MAX_REPS      1001
+#define WARMUP_RUNS   2
+
+// --- Stand-ins for the hardware and the kernel modules left out ---
+
+Cpu cpus[MAX_CPUS];
+int cpu_count = 1;
+
+volatile unsigned int timer_ticks = 0;
+int serial_mirror = 0;
+int fpu_has_sse2 = 1;               // every x86-64 CPU has it
+
+static char screen[WIDTH * HEIGHT * 2];
+
+// Cursor and other port writes go nowhere
+void outb(unsigned short port, unsigned char val) {
+}
+
+void outw(unsigned short port, unsigned short val) {
+}
+
+unsigned char inb(unsigned short port) {
+    return 0;
+}
+
+// Serial output is the program's stdout
+void serial_putc(char c) {
+    putchar(c);
+}
+
+void serial_write(const char* str) {
+    fputs(str, stdout);
+}
+
+void serial_flush() {
+    fflush(stdout);
+}
+
+// Posted work runs at the next work_flush(), after each timed run, so
+// repeated posts coalesce the way they do behind the kernel's worker
+static WorkItem* posted_work = 0;
+WorkStats work_stats;
+
+int work_post(WorkItem* work) {
+    if (work->pending) {
+        work_stats.coalesced++;
+        return 0;
+    }
+    work->pending = 1;
+    work->next = posted_work;
+    posted_work = work;
+    work_stats.posted++;
+    return 1;
+}
+
+void work_flush() {
+    while (posted_work) {
+        WorkItem* work = posted_work;
+        posted_work = work->next;
+        work->pending = 0;
+        work->function(work);
+        work_stats.executed++;
+    }
+}
+
+// No keyboard: every key is Enter, 'input' reads 0 and nothing breaks
+unsigned char keyboard_read() {
+    return 0x1C;
+}
+
+int keyboard_break_requested() {
+    return 0;
+}
+
+void keyboard_arm_break(int armed) {
+}
+
+char* get_keypress() {
+    static char enter[2] = { '\n', 0 };
+    return enter;
+}
+
+// The JIT emits i386 code, which a 64-bit process can't run
+int jit_compile(const Bytecode* bytecode, JitCode* jit) {
+    return 0;
+}
+
+void jit_execute(const Bytecode* bytecode, const JitCode* jit) {
+}
+
+void jit_free(JitCode* jit) {
+}
+
+// User space owns its SSE registers
+int kernel_fpu_begin() {
+    return fpu_has_sse2;
+}
+
+void kernel_fpu_end() {
+}
+
+unsigned int paging_free_pages() {
+    return 0;
+}
+
+// --- Commands for scripts ---
+
+static void command_echo(const char* args) {
+    print_string("\n");
+    print_string(args);
+}
+
+static void command_cat(const char* args) {
+    TextFile* file = find_file(args);
+    if (!file) {
+        command_error("\nFile not found.");
+        return;
+    }
+    print_string("\n");
+    if (file->data) print_string(file->data);
+}
+
+static void filter_cat(const char* args, const char* line, int* state) {
+    if (!line) return;
+    print_string("\n");
+    print_string(line);
+}
+
+static void filter_grep(const char* args, const char* line, int* state) {
+    if (line && contains_string(line, args)) {
+        print_string("\n");
+        print_string(line);
+    }
+}
+
+static void command_grep(const char* args) {
+    command_error("\ngrep only works in a pipeline here.");
+}
+
+static void command_basic(const char* args) {
+    load_program(args);
+    run_program();
+}
+
+static void command_run(const char* args) {
+    TextFile* file = find_file(args);
+    int cache_hit;
+    CompiledScript* script = file ? get_compiled_script(file, &cache_hit) : 0;
+    if (!script || script->running) {
+        command_error("\nCannot run script.");
+        return;
+    }
+    run_compiled_script(script);
+}
+
+static const Command host_commands[] = {
+    { "echo",  "<text>",        "Print text",                  0, command_echo },
+    { "cat",   "<file>",        "Print a file",                1, command_cat, filter_cat },
+    { "grep",  "<text>",        "Filter piped lines",          1, command_grep, filter_grep },
+    { "basic", "<file>",        "Load and run an EG-Basic program", 1, command_basic },
+    { "run",   "<file>",        "Run a command script",        1, command_run },
+};
+
+// --- Helpers ---
+
+typedef struct {
+    OutputSink sink;
+    char text[4096];
+    unsigned int length;
+} Capture;
+
+static void capture_write(OutputSink* sink, const char* str) {
+    Capture* capture = (Capture*)sink;
+    while (*str && capture->length < sizeof(capture->text) - 1) capture->text[capture->length++] = *str++;
+    capture->text[capture->length] = 0;
+}
+
+static void capture_start(Capture* capture) {
+    capture->sink.write = capture_write;
+    capture->length = 0;
+    capture->text[0] = 0;
+    set_output_sink(&capture->sink);
+}
+
+static void capture_stop() {
+    set_output_sink(0);
+}
+
+// Counts the values a program prints, for output too long to capture
+typedef struct {
+    OutputSink sink;
+    const char* value;
+    unsigned int count;
+} ValueCounter;
+
+static void count_value(OutputSink* sink, const char* str) {
+    ValueCounter* counter = (ValueCounter*)sink;
+    if (compare_strings(str, counter->value)) counter->count++;
+}
+
+static void clear_screen() {
+    for (int i = 0; i < WIDTH * HEIGHT; i++) {
+        screen[i * 2] = ' ';
+        screen[i * 2 + 1] = color;
+    }
+    cursor_pos = 0;
+}
+
+// One row of the screen without trailing blanks
+static void screen_row(int row, char* text) {
+    int length = 0;
+    for (int col = 0; col < WIDTH; col++) {
+        text[col] = screen[(row * WIDTH + col) * 2];
+        if (text[col] != ' ') length = col + 1;
+    }
+    text[length] = 0;
+}
+
+// Copy a host file into the file table under its base name
+static TextFile* import_file(const char* path) {
+    const char* name = path;
+    for (const char* p = path; *p; p++) {
+        if (*p == '/') name = p + 1;
+    }
+    if (string_length(name) >= MAX_FILENAME) {
+        fprintf(stderr, "%s: name longer than %d characters\n", name, MAX_FILENAME - 1);
+        return 0;
+    }
+
+    FILE* input = fopen(path, "rb");
+    if (!input) {
+        perror(path);
+        return 0;
+    }
+    char* data = 0;
+    unsigned int size = 0;
+    char chunk[4096];
+    size_t count;
+    while ((count = fread(chunk, 1, sizeof(chunk), input)) > 0) {
+        data = (char*)realloc(data, size + count);
+        memcpy(data + size, chunk, count);
+        size += count;
+    }
+    fclose(input);
+
+    TextFile* file = create_file(name);
+    if (!file || !file_write(file, data ? data : "", size)) {
+        fprintf(stderr, "%s: file table full\n", name);
+        file = 0;
+    }
+    free(data);
+    return file;
+}
+
+static TextFile* make_file(const char* name, const char* text) {
+    TextFile* file = create_file(name);
+    if (file) file_write(file, text, string_length(text));
+    return file;
+}
+
+// --- Timing ---
+
+static int reps = DEFAULT_REPS;
+
+static unsigned long long now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int compare_samples(const void* a, const void* b) {
+    unsigned long long x = *(const unsigned long long*)a;
+    unsigned long long y = *(const unsigned long long*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Warm up, then time 'reps' runs; pending console work counts as part of
+// the run that posted it
+static void time_workload(const char* kind, const char* name, void (*run)(const void* arg), const void* arg) {
+    unsigned long long* samples = (unsigned long long*)malloc(reps * sizeof(unsigned long long));
+    unsigned long long* cycles = (unsigned long long*)malloc(reps * sizeof(unsigned long long));
+
+    for (int i = 0; i < WARMUP_RUNS; i++) {
+        run(arg);
+        work_flush();
+    }
+    for (int i = 0; i < reps; i++) {
+        unsigned long long start_tsc = read_tsc();
+        unsigned long long start = now_ns();
+        run(arg);
+        work_flush();
+        samples[i] = now_ns() - start;
+        cycles[i] = read_tsc() - start_tsc;
+    }
+    qsort(samples, reps, sizeof(unsigned long long), compare_samples);
+    qsort(cycles, reps, sizeof(unsigned long long), compare_samples);
+
+    printf("\nBENCH name=%s%s%s reps=%d min=%llu median=%llu p99=%llu unit=ns cycles=%llu\n",
+           kind, kind[0] ? ":" : "", name, reps, samples[0], samples[reps / 2],
+           samples[(reps * 99 + 99) / 100 - 1], cycles[reps / 2]);
+    fflush(stdout);
+    free(samples);
+    free(cycles);
+}
+
+// --- Workloads ---
+
+static void run_basic(const void* arg) {
+    run_program();
+}
+
+static void run_script(const void* arg) {
+    int cache_hit;
+    CompiledScript* script = get_compiled_script((TextFile*)arg, &cache_hit);
+    if (script) run_compiled_script(script);
+}
+
+static void run_print_lines(const void* arg) {
+    for (int i = 0; i < 1000; i++) {
+        print_string("The quick brown fox jumps over the lazy dog, again and again.\n");
+    }
+}
+
+static void run_print_chars(const void* arg) {
+    static const char* const chars[] = { "a", "b", "c", "d", "\n" };
+    for (int i = 0; i < 10000; i++) print_string(chars[i % 5]);
+}
+
+static void run_lookups(const void* arg) {
+    static const char* const names[] = { "loop.bas", "print.bas", "echo.sh", "missing" };
+    for (int i = 0; i < 10000; i++) find_file(names[i & 3]);
+}
+
+static void time_basic(const char* name) {
+    load_program(name);
+    time_workload("basic", name, run_basic, 0);
+}
+
+static const char loop_program[] =
+    "10 push 1000000\n"
+    "20 push -1\n"
+    "30 add\n"
+    "40 binz 20\n"
+    "50 end\n";
+
+static const char print_program[] =
+    "10 push 1000\n"
+    "20 printv\n"
+    "30 push -1\n"
+    "40 add\n"
+    "50 binz 20\n"
+    "60 end\n";
+
+static void run_benchmarks() {
+    make_file("loop.bas", loop_program);
+    make_file("print.bas", print_program);
+
+    char* script = (char*)malloc(200 * 32);
+    script[0] = 0;
+    for (int i = 0; i < 200; i++) copy_string(script + string_length(script), "echo hello from a script\n");
+    TextFile* echo = make_file("echo.sh", script);
+    TextFile* pipe = make_file("pipe.sh", "cat echo.sh | grep hello\ncat echo.sh | grep nothing\n");
+    free(script);
+
+    time_workload("", "print-lines", run_print_lines, 0);
+    time_workload("", "print-chars", run_print_chars, 0);
+    time_workload("", "fs-lookup", run_lookups, 0);
+    time_basic("loop.bas");
+    time_basic("print.bas");
+    time_workload("script", "echo.sh", run_script, echo);
+    time_workload("script", "pipe.sh", run_script, pipe);
+}
+
+static int ends_with(const char* text, const char* suffix) {
+    int length = string_length(text);
+    int suffix_length = string_length(suffix);
+    return length >= suffix_length && compare_strings(text + length - suffix_length, suffix);
+}
+
+static int run_file(const char* path) {
+    TextFile* file = import_file(path);
+    if (!file) return 1;
+    if (ends_with(file->name, ".bas")) time_basic(file->name);
+    else time_workload("script", file->name, run_script, file);
+    return 0;
+}
+
+// --- Self-checks ---
+
+static int failures = 0;
+
+static void check(const char* name, int ok) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", name);
+    if (!ok) failures++;
+}
+
+static void test_strings() {
+    char buffer[24];
+    check("compare_strings", compare_strings("ls", "ls") && !compare_strings("ls", "lsx") && !compare_strings("a", "b"));
+    check("starts_with", starts_with("runbin x", "run") && !starts_with("ru", "run"));
+    check("contains_string", contains_string("hello world", "o w") && !contains_string("hello", "hex"));
+    check("string_to_int", string_to_int("1234x") == 1234);
+    check("hex_to_uint", hex_to_uint("0x1F") == 0x1F && hex_to_uint("ff 2") == 0xFF);
+    int_to_string(-2147483647, buffer);
+    check("int_to_string", compare_strings(buffer, "-2147483647"));
+    u64_to_string(18446744073709551615ULL, buffer);
+    check("u64_to_string", compare_strings(buffer, "18446744073709551615"));
+    check("u64_div", u64_div(10000000000ULL, 7) == 10000000000ULL / 7);
+    itoa(255, buffer, 16);
+    check("itoa", compare_strings(buffer, "FF"));
+}
+
+static void test_commands() {
+    char name[8], args[8];
+    split_command_line("poke b8000 41", name, sizeof(name), args, sizeof(args));
+    check("split_command_line", compare_strings(name, "poke") && compare_strings(args, "b8000 4"));
+    split_command_line("ls", name, sizeof(name), args, sizeof(args));
+    check("split_command_line no args", compare_strings(name, "ls") && !args[0]);
+    split_command_line("shutdown now", name, sizeof(name), args, sizeof(args));
+    check("split_command_line truncates", compare_strings(name, "shutdow") && compare_strings(args, "now"));
+}
+
+// Overlapping copies both ways, with and without SSE2
+static void test_bulk() {
+    int data[64];
+    int ok = 1;
+    for (int sse2 = 0; sse2 < 2; sse2++) {
+        fpu_has_sse2 = sse2;
+        for (int shift = -5; shift <= 5; shift++) {
+            for (int i = 0; i < 64; i++) data[i] = i;
+            bulk_copy(data + 10 + shift, data + 10, 40);
+            for (int i = 0; i < 40; i++) ok = ok && data[10 + shift + i] == 10 + i;
+        }
+    }
+    fpu_has_sse2 = 1;
+    check("bulk_copy overlap", ok);
+}
+
+static void test_console() {
+    char row[WIDTH + 1];
+    clear_screen();
+    print_string("hello\nworld");
+    screen_row(0, row);
+    int first = compare_strings(row, "hello");
+    screen_row(1, row);
+    check("print_string", first && compare_strings(row, "world") && cursor_pos == WIDTH + 5);
+
+    clear_screen();
+    for (int i = 0; i < HEIGHT + 3; i++) {
+        int_to_string(i, row);
+        print_string(row);
+        print_string("\n");
+    }
+    screen_row(HEIGHT - 2, row);
+    check("scrolling", compare_strings(row, "27") && cursor_pos == (HEIGHT - 1) * WIDTH);
+}
+
+static void test_files() {
+    TextFile* file = make_file("test.txt", "one\n");
+    file_append(file, "two\n", 4);
+    check("file_append", find_file("test.txt") == file && compare_strings(file->data, "one\ntwo\n") && file->size == 8);
+    check("find_file missing", find_file("nosuch") == 0);
+}
+
+static void test_heap() {
+    char* a = (char*)kmalloc(100);
+    char* b = (char*)kmalloc(1000);
+    copy_string(a, "abc");
+    a = (char*)krealloc(a, 5000);
+    int ok = a && b && compare_strings(a, "abc") && ((unsigned long)a & 15) == 0;
+    unsigned int used = heap_used_bytes;
+    kfree(a);
+    kfree(b);
+    check("heap", ok && heap_used_bytes < used);
+}
+
+static void test_basic() {
+    Capture capture;
+    make_file("count.bas",
+              "10 push 3\n20 printv\n30 push -1\n40 add\n50 binz 20\n60 printt \"done\"\n70 end\n");
+    load_program("count.bas");
+    capture_start(&capture);
+    run_program();
+    capture_stop();
+    check("basic program", compare_strings(capture.text, "3\n2\n1\ndone\n"));
+
+    // The budget stops a run at exactly that many instructions: one push,
+    // then printv and jmp in turn, so an even budget prints budget / 2
+    // values. Across two polls, then within the first one.
+    make_file("forever.bas", "10 push 7\n20 printv\n30 jmp 20\n");
+    load_program("forever.bas");
+    unsigned int budgets[2] = { 2 * POLL_INTERVAL + 2, 1000 };
+    int exact = 1;
+    for (int i = 0; i < 2; i++) {
+        ValueCounter counter = { { count_value }, "7", 0 };
+        unsigned long long before = metric_values[0].values[METRIC_BASIC_INSTRUCTIONS];
+        instruction_budget = budgets[i];
+        set_output_sink(&counter.sink);
+        run_program();
+        set_output_sink(0);
+        instruction_budget = 0;
+        exact = exact && counter.count == budgets[i] / 2 &&
+                metric_values[0].values[METRIC_BASIC_INSTRUCTIONS] - before == budgets[i];
+    }
+    check("instruction budget", exact);
+
+    make_file("bad.bas", "10 push x\n");
+    load_program("bad.bas");
+    capture_start(&capture);
+    run_program();
+    capture_stop();
+    check("basic syntax error", contains_string(capture.text, "push needs a number"));
+}
+
+static void test_scripts() {
+    Capture capture;
+    TextFile* file = make_file("test.sh", "echo first\n\necho second\ncat test.sh | grep echo\nnosuch\n");
+    int cache_hit;
+    CompiledScript* script = get_compiled_script(file, &cache_hit);
+    capture_start(&capture);
+    if (script) run_compiled_script(script);
+    capture_stop();
+    check("script", script && !cache_hit && compare_strings(capture.text,
+          "\nfirst\nsecond\necho first\necho second\ncat test.sh | grep echo\nUnknown command: nosuch"));
+
+    get_compiled_script(file, &cache_hit);
+    int cached = cache_hit;
+    file_append(file, "echo third\n", 11);
+    get_compiled_script(file, &cache_hit);
+    check("script cache", cached && !cache_hit);
+}
+
+// A line too long for a pipe is cut, not split into two lines
+static void test_pipes() {
+    static char text[4600];
+    int length = 0;
+    while (length < 4500) text[length++] = 'x';
+    copy_string(text + length, "y\nshort y\n");
+    make_file("long.txt", text);
+
+    Capture capture;
+    Pipeline pipeline;
+    int errors = command_errors;
+    capture_start(&capture);
+    if (parse_pipeline("cat long.txt | grep y", &pipeline, 0)) run_pipeline(&pipeline);
+    capture_stop();
+    check("pipe long line", command_errors == errors + 1 && compare_strings(capture.text,
+          "\nshort y\nLines cut after cat: 1 longer than 4095 characters"));
+}
+
+static void run_tests() {
+    test_strings();
+    test_commands();
+    test_bulk();
+    test_console();
+    test_files();
+    test_heap();
+    test_basic();
+    test_scripts();
+    test_pipes();
+    printf("%d failed\n", failures);
+}
+
+static void usage() {
+    fprintf(stderr, "usage: egterm-host [-v] [-s] [-r reps] test | bench | <file>...\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    int show_stats = 0;
+    int first = 1;
+    for (; first < argc && argv[first][0] == '-'; first++) {
+        if (compare_strings(argv[first], "-v")) serial_mirror = 1;
+        else if (compare_strings(argv[first], "-s")) show_stats = 1;
+        else if (compare_strings(argv[first], "-r") && first + 1 < argc) reps = string_to_int(argv[++first]);
+        else usage();
+    }
+    if (first == argc || reps < 1 || reps > MAX_REPS) usage();
+
+    char* heap = (char*)malloc(HEAP_SIZE);
+    heap_init(heap, heap + HEAP_SIZE);
+    video_memory = screen;
+    clear_screen();
+    metrics_init();
+    register_commands(host_commands, sizeof(host_commands) / sizeof(host_commands[0]));
+
+    int status = 0;
+    if (compare_strings(argv[first], "test")) {
+        run_tests();
+        status = failures;
+    } else if (compare_strings(argv[first], "bench")) {
+        run_benchmarks();
+    } else {
+        for (int i = first; i < argc; i++) status += run_file(argv[i]);
+    }
+
+    if (show_stats) metrics_dump();
+    printf("\n");
+    return status;
+}
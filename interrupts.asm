@@ -0,0 +1,323 @@
+; Interrupt entry points, GDT reload, the thread context switch and the
+; ring 3 entry and exit paths
+
+section .text
+
+extern interrupt_handler
+extern syscall_dispatch
+
+KERNEL_DATA     equ 0x10
+USER_CODE       equ 0x1B    ; GDT entry 3, RPL 3
+USER_DATA       equ 0x23    ; GDT entry 4, RPL 3
+SYSCALL_VECTOR  equ 0x80
+TSS_TO_CPU_GS   equ 0x40    ; TSS selector - per-CPU data selector (MAX_CPUS * 8)
+
+; Kernel data segments, and GS for the CPU we are on: its TSS selector
+; (loaded by cpu_segment_init) sits a fixed distance after its data selector.
+; Until the TSS is loaded GS is left alone.
+%macro KERNEL_SEGMENTS 0
+    mov ax, KERNEL_DATA
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    str ax
+    test ax, ax
+    jz %%no_tss
+    sub ax, TSS_TO_CPU_GS
+    mov gs, ax
+%%no_tss:
+%endmacro
+
+; Every stub leaves the same frame behind: an error code (0 when the CPU
+; does not push one) and the vector number, then jumps to interrupt_common.
+%macro ISR_NOERR 1
+global isr%1
+isr%1:
+    push dword 0
+    push dword %1
+    jmp interrupt_common
+%endmacro
+
+%macro ISR_ERR 1
+global isr%1
+isr%1:
+    push dword %1
+    jmp interrupt_common
+%endmacro
+
+; CPU exceptions
+ISR_NOERR 0
+ISR_NOERR 1
+ISR_NOERR 2
+ISR_NOERR 3
+ISR_NOERR 4
+ISR_NOERR 5
+ISR_NOERR 6
+ISR_NOERR 7
+ISR_ERR 8
+ISR_NOERR 9
+ISR_ERR 10
+ISR_ERR 11
+ISR_ERR 12
+ISR_ERR 13
+ISR_ERR 14
+ISR_NOERR 15
+ISR_NOERR 16
+ISR_ERR 17
+ISR_NOERR 18
+ISR_NOERR 19
+ISR_NOERR 20
+ISR_ERR 21
+ISR_NOERR 22
+ISR_NOERR 23
+ISR_NOERR 24
+ISR_NOERR 25
+ISR_NOERR 26
+ISR_NOERR 27
+ISR_NOERR 28
+ISR_ERR 29
+ISR_ERR 30
+ISR_NOERR 31
+
+; Hardware IRQs 0-15, remapped to 32-47
+ISR_NOERR 32
+ISR_NOERR 33
+ISR_NOERR 34
+ISR_NOERR 35
+ISR_NOERR 36
+ISR_NOERR 37
+ISR_NOERR 38
+ISR_NOERR 39
+ISR_NOERR 40
+ISR_NOERR 41
+ISR_NOERR 42
+ISR_NOERR 43
+ISR_NOERR 44
+ISR_NOERR 45
+ISR_NOERR 46
+ISR_NOERR 47
+
+; Local APIC vectors 48-63 (timer, spurious)
+ISR_NOERR 48
+ISR_NOERR 49
+ISR_NOERR 50
+ISR_NOERR 51
+ISR_NOERR 52
+ISR_NOERR 53
+ISR_NOERR 54
+ISR_NOERR 55
+ISR_NOERR 56
+ISR_NOERR 57
+ISR_NOERR 58
+ISR_NOERR 59
+ISR_NOERR 60
+ISR_NOERR 61
+ISR_NOERR 62
+ISR_NOERR 63
+
+interrupt_common:
+    pusha
+    push ds
+    push es
+    push fs
+    push gs
+    KERNEL_SEGMENTS
+    cld
+    push esp                ; InterruptFrame*
+    call interrupt_handler
+    add esp, 4
+    pop gs
+    pop fs
+    pop es
+    pop ds
+    popa
+    add esp, 8              ; vector and error code
+    iret
+
+; int 0x80 from ring 3: a trap gate, so interrupts stay enabled
+global isr_syscall
+isr_syscall:
+    push dword 0
+    push dword SYSCALL_VECTOR
+    jmp interrupt_common
+
+; SYSENTER lands here with ESP pointing at this CPU's TSS (SYSENTER_ESP_MSR)
+; and interrupts off. The user side passes its return address in EDX and
+; its stack in ECX; the frame built here looks like the one int 0x80 leaves
+; so syscall_dispatch does not care which way a call came in.
+global sysenter_entry
+sysenter_entry:
+    mov esp, [esp + 4]      ; TSS.esp0: top of this thread's kernel stack
+    push dword USER_DATA
+    push ecx                ; user stack
+    push dword 0x202        ; SYSEXIT restores no flags; user code runs with IF set
+    push dword USER_CODE
+    push edx                ; user return address
+    push dword 0
+    push dword SYSCALL_VECTOR
+    pusha
+    push ds
+    push es
+    push fs
+    push gs
+    KERNEL_SEGMENTS
+    cld
+    sti
+    push esp                ; InterruptFrame*
+    call syscall_dispatch
+    add esp, 4
+    cli
+    pop gs
+    pop fs
+    pop es
+    pop ds
+    popa                    ; EAX holds the result
+    add esp, 8
+    mov edx, [esp]          ; user eip
+    mov ecx, [esp + 12]     ; user esp
+    sti                     ; takes effect after SYSEXIT
+    sysexit
+
+; int user_enter(unsigned int entry, unsigned int user_esp,
+;                unsigned int* kernel_esp, unsigned int* tss_esp0)
+; Drops to ring 3 at entry. The kernel stack pointer is stored twice: for
+; user_return, and as the stack the CPU switches to on the next trap.
+global user_enter
+user_enter:
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov eax, [esp + 28]
+    mov [eax], esp
+    mov eax, [esp + 32]
+    mov [eax], esp
+    mov ecx, [esp + 20]
+    mov edx, [esp + 24]
+    mov ax, USER_DATA
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    push dword USER_DATA
+    push edx
+    push dword 0x202        ; interrupts on, IOPL 0
+    push dword USER_CODE
+    push ecx
+    iret
+
+; void user_return(unsigned int kernel_esp, int status)
+; Abandons the ring 3 program and its kernel frames; user_enter returns status.
+global user_return
+user_return:
+    mov eax, [esp + 8]
+    mov esp, [esp + 4]
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
+
+; void gdt_flush(const void* descriptor)
+global gdt_flush
+gdt_flush:
+    mov eax, [esp + 4]
+    lgdt [eax]
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    jmp 0x08:.reload_cs
+.reload_cs:
+    ret
+
+; void context_switch(unsigned int* save_esp, unsigned int next_esp)
+; Saves the callee-saved registers on the current stack, stores the stack
+; pointer and continues on the other thread's stack.
+global context_switch
+context_switch:
+    mov eax, [esp + 4]
+    mov edx, [esp + 8]
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov [eax], esp
+    mov esp, edx
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
+
+section .data
+
+; Stub addresses, indexed by vector, for the IDT setup in interrupts.c
+global isr_table
+isr_table:
+    dd isr0
+    dd isr1
+    dd isr2
+    dd isr3
+    dd isr4
+    dd isr5
+    dd isr6
+    dd isr7
+    dd isr8
+    dd isr9
+    dd isr10
+    dd isr11
+    dd isr12
+    dd isr13
+    dd isr14
+    dd isr15
+    dd isr16
+    dd isr17
+    dd isr18
+    dd isr19
+    dd isr20
+    dd isr21
+    dd isr22
+    dd isr23
+    dd isr24
+    dd isr25
+    dd isr26
+    dd isr27
+    dd isr28
+    dd isr29
+    dd isr30
+    dd isr31
+    dd isr32
+    dd isr33
+    dd isr34
+    dd isr35
+    dd isr36
+    dd isr37
+    dd isr38
+    dd isr39
+    dd isr40
+    dd isr41
+    dd isr42
+    dd isr43
+    dd isr44
+    dd isr45
+    dd isr46
+    dd isr47
+    dd isr48
+    dd isr49
+    dd isr50
+    dd isr51
+    dd isr52
+    dd isr53
+    dd isr54
+    dd isr55
+    dd isr56
+    dd isr57
+    dd isr58
+    dd isr59
+    dd isr60
+    dd isr61
+    dd isr62
+    dd isr63
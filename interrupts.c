@@ -0,0 +1,248 @@
+#include "interrupts.h"
+#include "basic.h"
+#include "fpu.h"
+#include "paging.h"
+#include "serial.h"
+#include "smp.h"
+#include "symbols.h"
+#include "syscall.h"
+#include "thread.h"
+#include "util.h"
+
+// Flat GDT with kernel and user segments, one extra data segment per CPU
+// (loaded into GS, see smp.h) and one TSS per CPU, IDT for the CPU
+// exceptions, the 16 legacy IRQs, the local APIC vectors and int 0x80, and
+// the 8259 PIC pair remapped out of the way of the exception vectors.
+
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA    0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA    0xA1
+#define PIC_EOI      0x20
+
+#define IDT_ENTRIES  256
+#define ISR_STUBS    64
+
+#define KERNEL_CODE  0x08
+#define KERNEL_DATA  0x10
+#define EXCEPTION_NO_FPU 7      // device not available: lazy FPU switch
+#define EXCEPTION_PAGE_FAULT 14
+#define CPU_SEGMENTS 5          // first per-CPU GDT entry
+#define TSS_SEGMENTS (CPU_SEGMENTS + MAX_CPUS)  // interrupts.asm relies on the distance
+
+typedef struct {
+    unsigned short limit_low;
+    unsigned short base_low;
+    unsigned char base_middle;
+    unsigned char access;
+    unsigned char granularity;
+    unsigned char base_high;
+} __attribute__((packed)) GdtEntry;
+
+typedef struct {
+    unsigned short offset_low;
+    unsigned short selector;
+    unsigned char zero;
+    unsigned char type;
+    unsigned short offset_high;
+} __attribute__((packed)) IdtEntry;
+
+typedef struct {
+    unsigned short limit;
+    unsigned int base;
+} __attribute__((packed)) DescriptorPointer;
+
+// Only esp0/ss0 are used: the stack a trap from ring 3 switches to
+typedef struct {
+    unsigned int prev_task;
+    unsigned int esp0, ss0, esp1, ss1, esp2, ss2;
+    unsigned int cr3, eip, eflags;
+    unsigned int eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    unsigned int es, cs, ss, ds, fs, gs, ldt;
+    unsigned short trap, iomap_base;
+} Tss;
+
+extern unsigned int isr_table[ISR_STUBS];
+void gdt_flush(const DescriptorPointer* descriptor);
+void isr_syscall();
+
+static GdtEntry gdt[TSS_SEGMENTS + MAX_CPUS];
+static Tss tss[MAX_CPUS];
+static IdtEntry idt[IDT_ENTRIES];
+static IrqHandler irq_handlers[16];
+static IrqHandler apic_handlers[ISR_STUBS - LAPIC_VECTORS];
+
+static DescriptorPointer gdtr;
+static DescriptorPointer idtr;
+
+static const char* exception_names[32] = {
+    "divide error", "debug", "NMI", "breakpoint", "overflow", "bound range",
+    "invalid opcode", "device not available", "double fault", "coprocessor overrun",
+    "invalid TSS", "segment not present", "stack fault", "general protection",
+    "page fault", "reserved", "x87 error", "alignment check", "machine check",
+    "SIMD error", "virtualisation", "control protection",
+};
+
+static void set_gdt_entry(int index, unsigned int base, unsigned int limit, unsigned char access, unsigned char flags) {
+    gdt[index].limit_low = limit & 0xFFFF;
+    gdt[index].base_low = base & 0xFFFF;
+    gdt[index].base_middle = (base >> 16) & 0xFF;
+    gdt[index].access = access;
+    gdt[index].granularity = ((limit >> 16) & 0x0F) | (flags << 4);
+    gdt[index].base_high = (base >> 24) & 0xFF;
+}
+
+static void set_idt_entry(int vector, unsigned int handler, unsigned char type) {
+    idt[vector].offset_low = handler & 0xFFFF;
+    idt[vector].selector = KERNEL_CODE;
+    idt[vector].zero = 0;
+    idt[vector].type = type;
+    idt[vector].offset_high = handler >> 16;
+}
+
+static void remap_pic() {
+    outb(PIC1_COMMAND, 0x11);       // start initialisation, expect ICW4
+    outb(PIC2_COMMAND, 0x11);
+    outb(PIC1_DATA, IRQ_BASE);      // vector offsets
+    outb(PIC2_DATA, IRQ_BASE + 8);
+    outb(PIC1_DATA, 0x04);          // slave on IRQ2
+    outb(PIC2_DATA, 0x02);
+    outb(PIC1_DATA, 0x01);          // 8086 mode
+    outb(PIC2_DATA, 0x01);
+    outb(PIC1_DATA, 0xFB);          // everything masked except the cascade
+    outb(PIC2_DATA, 0xFF);
+}
+
+void interrupts_init() {
+    set_gdt_entry(0, 0, 0, 0, 0);
+    set_gdt_entry(1, 0, 0xFFFFF, 0x9A, 0xC);   // kernel code
+    set_gdt_entry(2, 0, 0xFFFFF, 0x92, 0xC);   // kernel data
+    set_gdt_entry(3, 0, 0xFFFFF, 0xFA, 0xC);   // user code
+    set_gdt_entry(4, 0, 0xFFFFF, 0xF2, 0xC);   // user data
+    gdtr.limit = sizeof(gdt) - 1;
+    gdtr.base = (unsigned int)gdt;
+    gdt_flush(&gdtr);
+
+    for (int i = 0; i < ISR_STUBS; i++) {
+        set_idt_entry(i, isr_table[i], 0x8E);  // present, ring 0, interrupt gate
+    }
+    set_idt_entry(SYSCALL_VECTOR, (unsigned int)isr_syscall, 0xEF);    // ring 3, trap gate
+    idtr.limit = sizeof(idt) - 1;
+    idtr.base = (unsigned int)idt;
+    __asm__ __volatile__ ("lidt %0" :: "m"(idtr));
+
+    remap_pic();
+}
+
+// Application processors share the tables set up by the boot CPU
+void interrupts_init_ap() {
+    gdt_flush(&gdtr);
+    __asm__ __volatile__ ("lidt %0" :: "m"(idtr));
+}
+
+// Point GS of the calling CPU at its per-CPU data and load its TSS
+void cpu_segment_init(int cpu, void* data) {
+    int index = CPU_SEGMENTS + cpu;
+    set_gdt_entry(index, (unsigned int)data, 0xFFFFF, 0x92, 0xC);
+    unsigned short selector = index * 8;
+    __asm__ __volatile__ ("movw %0, %%gs" :: "r"(selector) : "memory");
+
+    tss[cpu].ss0 = KERNEL_DATA;
+    tss[cpu].iomap_base = sizeof(Tss);     // no I/O bitmap: ring 3 gets no ports
+    set_gdt_entry(TSS_SEGMENTS + cpu, (unsigned int)&tss[cpu], sizeof(Tss) - 1, 0x89, 0x0);
+    selector = (TSS_SEGMENTS + cpu) * 8;
+    __asm__ __volatile__ ("ltr %0" :: "r"(selector) : "memory");
+}
+
+// The TSS of a CPU; SYSENTER finds esp0 through it
+void* cpu_tss(int cpu) {
+    return &tss[cpu];
+}
+
+// Where a CPU finds the kernel stack for traps out of ring 3
+unsigned int* tss_kernel_stack(int cpu) {
+    return &tss[cpu].esp0;
+}
+
+void tss_set_kernel_stack(unsigned int esp0) {
+    tss[this_cpu()->index].esp0 = esp0;
+}
+
+// Handlers for local APIC vectors acknowledge the APIC themselves
+void interrupt_install(int vector, IrqHandler handler) {
+    apic_handlers[vector - LAPIC_VECTORS] = handler;
+}
+
+void irq_install(int irq, IrqHandler handler) {
+    irq_handlers[irq] = handler;
+
+    unsigned short port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) & ~(1 << (irq & 7)));
+}
+
+static void panic(InterruptFrame* frame) {
+    char buffer[16];
+    set_output_sink(0);
+    print_string("\n[panic] ");
+    print_string(frame->vector < 32 && exception_names[frame->vector] ? exception_names[frame->vector] : "unknown exception");
+    print_string(" at eip 0x");
+    itoa(frame->eip, buffer, 16);
+    print_string(buffer);
+    int symbol = symbol_find(frame->eip);
+    if (symbol >= 0) {
+        print_string(" (");
+        print_string(symbol_name(symbol));
+        print_string(")");
+    }
+    print_string(", error 0x");
+    itoa(frame->error, buffer, 16);
+    print_string(buffer);
+    print_string("\n");
+    serial_flush();
+    while (1) __asm__ __volatile__ ("cli; hlt");
+}
+
+void interrupt_handler(InterruptFrame* frame) {
+    if (frame->vector == SYSCALL_VECTOR) {
+        syscall_dispatch(frame);
+        return;
+    }
+
+    if (frame->vector < IRQ_BASE) {
+        if (frame->vector == EXCEPTION_NO_FPU && fpu_handle_trap()) return;
+        if (frame->vector == EXCEPTION_PAGE_FAULT) {
+            int result = paging_handle_fault(frame);
+            if (result > 0) return;
+            if (result < 0) user_fault(frame, "segmentation fault");
+        }
+        if (frame->cs & 3) user_fault(frame, frame->vector < 32 ? exception_names[frame->vector] : 0);
+        panic(frame);
+        return;
+    }
+
+    if (frame->vector >= LAPIC_VECTORS) {
+        IrqHandler handler = apic_handlers[frame->vector - LAPIC_VECTORS];
+        if (handler) handler(frame);
+        scheduler_preempt();
+        return;
+    }
+
+    int irq = frame->vector - IRQ_BASE;
+
+    // IRQ 7 and 15 fire spuriously; the in-service register tells
+    if (irq == 7 || irq == 15) {
+        unsigned short command = irq == 7 ? PIC1_COMMAND : PIC2_COMMAND;
+        outb(command, 0x0B);
+        if (!(inb(command) & 0x80)) {
+            if (irq == 15) outb(PIC1_COMMAND, PIC_EOI);
+            return;
+        }
+    }
+
+    // Acknowledge first: the handler may switch to another thread
+    if (irq >= 8) outb(PIC2_COMMAND, PIC_EOI);
+    outb(PIC1_COMMAND, PIC_EOI);
+
+    if (irq_handlers[irq]) irq_handlers[irq](frame);
+    scheduler_preempt();
+}
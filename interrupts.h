@@ -0,0 +1,55 @@
+#ifndef INTERRUPTS_H
+#define INTERRUPTS_H
+
+#define IRQ_BASE     32     // PIC interrupts are remapped to vectors 32-47
+#define IRQ_TIMER    0
+#define IRQ_KEYBOARD 1
+
+#define LAPIC_VECTORS         48    // local APIC vectors start here
+#define LAPIC_TIMER_VECTOR    48
+#define LAPIC_SPURIOUS_VECTOR 63
+#define SYSCALL_VECTOR        0x80
+
+// Register state pushed by the stubs in interrupts.asm
+typedef struct {
+    unsigned int gs, fs, es, ds;
+    unsigned int edi, esi, ebp, esp_unused, ebx, edx, ecx, eax;
+    unsigned int vector, error;
+    unsigned int eip, cs, eflags;
+    unsigned int user_esp, user_ss;     // only present after a ring change
+} InterruptFrame;
+
+typedef void (*IrqHandler)(InterruptFrame* frame);
+
+void interrupts_init();
+void interrupts_init_ap();
+void cpu_segment_init(int cpu, void* data);
+void* cpu_tss(int cpu);
+unsigned int* tss_kernel_stack(int cpu);
+void tss_set_kernel_stack(unsigned int esp0);
+void irq_install(int irq, IrqHandler handler);
+void interrupt_install(int vector, IrqHandler handler);
+
+#ifdef HOSTED
+// Built as a Linux program (make host): there are no interrupts to mask
+static inline unsigned int irq_save() { return 0; }
+static inline void irq_restore(unsigned int flags) {}
+static inline void irq_enable() {}
+#else
+// Disable interrupts, returning the previous state for irq_restore()
+static inline unsigned int irq_save() {
+    unsigned int flags;
+    __asm__ __volatile__ ("pushf; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void irq_restore(unsigned int flags) {
+    if (flags & 0x200) __asm__ __volatile__ ("sti" ::: "memory");
+}
+
+static inline void irq_enable() {
+    __asm__ __volatile__ ("sti" ::: "memory");
+}
+#endif
+
+#endif
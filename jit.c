@@ -0,0 +1,330 @@
+#include "jit.h"
+#include "heap.h"
+#include "util.h"
+
+// Translates EG-Basic bytecode into i386 machine code.
+//
+// Register use inside generated code:
+//   EBX  stack pointer (index into stack[], same meaning as sp)
+//   EAX  cached top of stack; stack[1..sp-1] live in memory, stack[sp]
+//        is only written back ("spilled") when leaving native code
+//
+// Every instruction gets a native fast path where it makes sense. Anything
+// else (printing, input, stack overflow/underflow, break and budget checks)
+// spills the registers and calls jit_helper(), which runs the instruction
+// through the interpreter and tells the native code where to continue.
+
+#define MAX_INSTR_BYTES   96
+#define MAX_STUB_BYTES    80
+
+#define STACK_ADDR ((unsigned int)stack)
+#define SP_ADDR    ((unsigned int)&sp)
+
+#define CC_JE  0x84
+#define CC_JNE 0x85
+#define CC_JL  0x8C
+#define CC_JGE 0x8D
+
+#define TARGET_EXIT -1
+
+typedef struct {
+    unsigned char* field;   // rel32 to patch
+    int target;             // instruction index or TARGET_EXIT
+} Fixup;
+
+typedef struct {
+    unsigned char* field;
+    int index;
+    int poll;
+} SlowPath;
+
+typedef struct {
+    unsigned char* pos;
+    Fixup* fixups;
+    int fixup_count;
+    SlowPath* slow_paths;
+    int slow_count;
+    JitCode* jit;
+} Emitter;
+
+static const Bytecode* running_bytecode = 0;
+static int poll_counter = 0;
+static unsigned int poll_interval = 0;
+static unsigned long long executed = 0;
+
+// Called from generated code with the registers spilled to stack[]/sp.
+// Returns the instruction index to continue at, or -1 to leave.
+int jit_helper(int index, int poll) {
+    if (poll) {
+        // Native code only counts backward branches, so loop iterations
+        // stand in for instructions against the instruction budget
+        executed += poll_interval;
+        poll_interval = next_poll_interval(executed);
+        poll_counter = poll_interval + 1;   // the branch resumed at counts again
+        return run_limit_reached(executed) ? -1 : index;
+    }
+    return execute_instruction(running_bytecode, index);
+}
+
+static void emit8(Emitter* e, unsigned char value) {
+    *e->pos++ = value;
+}
+
+static void emit32(Emitter* e, unsigned int value) {
+    memcpy(e->pos, &value, 4);
+    e->pos += 4;
+}
+
+static void patch_rel32(unsigned char* field, unsigned char* target) {
+    unsigned int rel = (unsigned int)target - (unsigned int)(field + 4);
+    memcpy(field, &rel, 4);
+}
+
+static void add_fixup(Emitter* e, unsigned char* field, int target) {
+    e->fixups[e->fixup_count].field = field;
+    e->fixups[e->fixup_count].target = target;
+    e->fixup_count++;
+}
+
+static void add_slow_path(Emitter* e, unsigned char* field, int index, int poll) {
+    e->slow_paths[e->slow_count].field = field;
+    e->slow_paths[e->slow_count].index = index;
+    e->slow_paths[e->slow_count].poll = poll;
+    e->slow_count++;
+}
+
+// mov [stack + ebx*4], eax
+static void emit_spill(Emitter* e) {
+    emit8(e, 0x89); emit8(e, 0x04); emit8(e, 0x9D); emit32(e, STACK_ADDR);
+}
+
+// mov eax, [stack + ebx*4]
+static void emit_load_top(Emitter* e) {
+    emit8(e, 0x8B); emit8(e, 0x04); emit8(e, 0x9D); emit32(e, STACK_ADDR);
+}
+
+// mov [sp], ebx
+static void emit_store_sp(Emitter* e) {
+    emit8(e, 0x89); emit8(e, 0x1D); emit32(e, SP_ADDR);
+}
+
+// mov ebx, [sp]
+static void emit_load_sp(Emitter* e) {
+    emit8(e, 0x8B); emit8(e, 0x1D); emit32(e, SP_ADDR);
+}
+
+// cmp ebx, imm32
+static void emit_cmp_sp(Emitter* e, int value) {
+    emit8(e, 0x81); emit8(e, 0xFB); emit32(e, (unsigned int)value);
+}
+
+// jcc rel32, returns the field to patch
+static unsigned char* emit_jcc(Emitter* e, unsigned char cc) {
+    emit8(e, 0x0F); emit8(e, cc);
+    unsigned char* field = e->pos;
+    emit32(e, 0);
+    return field;
+}
+
+// jmp rel32, returns the field to patch
+static unsigned char* emit_jmp(Emitter* e) {
+    emit8(e, 0xE9);
+    unsigned char* field = e->pos;
+    emit32(e, 0);
+    return field;
+}
+
+// Fall back to the interpreter for one instruction (or a break poll)
+static void emit_helper_call(Emitter* e, int index, int poll) {
+    emit_spill(e);
+    emit_store_sp(e);
+    emit8(e, 0x68); emit32(e, (unsigned int)poll);      // push poll
+    emit8(e, 0x68); emit32(e, (unsigned int)index);     // push index
+    emit8(e, 0xE8);                                     // call jit_helper
+    unsigned char* call = e->pos;
+    emit32(e, 0);
+    patch_rel32(call, (unsigned char*)jit_helper);
+    emit8(e, 0x83); emit8(e, 0xC4); emit8(e, 0x08);     // add esp, 8
+
+    emit8(e, 0x83); emit8(e, 0xF8); emit8(e, 0xFF);     // cmp eax, -1
+    add_fixup(e, emit_jcc(e, CC_JE), TARGET_EXIT);      // memory is in sync already
+
+    emit8(e, 0x89); emit8(e, 0xC1);                     // mov ecx, eax
+    emit_load_sp(e);
+    emit_load_top(e);
+    emit8(e, 0xFF); emit8(e, 0x24); emit8(e, 0x8D);     // jmp [entry_points + ecx*4]
+    emit32(e, (unsigned int)e->jit->entry_points);
+}
+
+// Guard a stack precondition; failures take the interpreter path
+static void emit_guard(Emitter* e, int index, int value, unsigned char cc) {
+    emit_cmp_sp(e, value);
+    add_slow_path(e, emit_jcc(e, cc), index, 0);
+}
+
+static void emit_poll(Emitter* e, int index) {
+    emit8(e, 0xFF); emit8(e, 0x0D); emit32(e, (unsigned int)&poll_counter);  // dec dword [poll_counter]
+    add_slow_path(e, emit_jcc(e, CC_JE), index, 1);
+}
+
+static void emit_instruction(Emitter* e, const Instr* instr, int index) {
+    int backward = instr->operand <= index;
+
+    switch (instr->op) {
+        case OP_PUSH:
+            emit_guard(e, index, STACK_SIZE - 1, CC_JGE);
+            emit_spill(e);
+            emit8(e, 0x43);                                     // inc ebx
+            emit8(e, 0xB8); emit32(e, (unsigned int)instr->operand);  // mov eax, imm32
+            break;
+        case OP_POP:
+            emit_guard(e, index, 1, CC_JL);
+            emit8(e, 0x4B);                                     // dec ebx
+            emit_load_top(e);
+            break;
+        case OP_DUP:
+            emit_guard(e, index, 1, CC_JL);
+            emit_guard(e, index, STACK_SIZE - 1, CC_JGE);
+            emit_spill(e);
+            emit8(e, 0x43);                                     // inc ebx
+            break;
+        case OP_ADD:
+            // a + b where b is the top: eax += stack[sp - 1]
+            emit_guard(e, index, 2, CC_JL);
+            emit8(e, 0x4B);                                     // dec ebx
+            emit8(e, 0x03); emit8(e, 0x04); emit8(e, 0x9D); emit32(e, STACK_ADDR);
+            break;
+        case OP_SUB:
+            // top minus the value below it: eax -= stack[sp - 1]
+            emit_guard(e, index, 2, CC_JL);
+            emit8(e, 0x4B);                                     // dec ebx
+            emit8(e, 0x2B); emit8(e, 0x04); emit8(e, 0x9D); emit32(e, STACK_ADDR);
+            break;
+        case OP_LOAD:
+            emit_guard(e, index, STACK_SIZE - 1, CC_JGE);
+            emit_spill(e);
+            emit8(e, 0x43);                                     // inc ebx
+            emit8(e, 0xA1); emit32(e, (unsigned int)&variables[instr->operand]);  // mov eax, [var]
+            break;
+        case OP_STORE:
+            emit_guard(e, index, 1, CC_JL);
+            emit8(e, 0xA3); emit32(e, (unsigned int)&variables[instr->operand]);  // mov [var], eax
+            emit8(e, 0x4B);                                     // dec ebx
+            emit_load_top(e);
+            break;
+        case OP_ADDI:
+            emit_guard(e, index, 1, CC_JL);
+            emit_guard(e, index, STACK_SIZE - 1, CC_JGE);
+            emit8(e, 0x05); emit32(e, (unsigned int)instr->operand);  // add eax, imm32
+            break;
+        case OP_SUBI:
+            emit_guard(e, index, 1, CC_JL);
+            emit_guard(e, index, STACK_SIZE - 1, CC_JGE);
+            emit8(e, 0xF7); emit8(e, 0xD8);                     // neg eax
+            emit8(e, 0x05); emit32(e, (unsigned int)instr->operand);  // add eax, imm32
+            break;
+        case OP_BIZ:
+        case OP_BINZ:
+            if (backward) emit_poll(e, index);
+            emit_guard(e, index, 1, CC_JL);
+            emit8(e, 0x85); emit8(e, 0xC0);                     // test eax, eax
+            add_fixup(e, emit_jcc(e, instr->op == OP_BIZ ? CC_JE : CC_JNE), instr->operand);
+            break;
+        case OP_DUP_BIZ:
+        case OP_DUP_BINZ:
+            if (backward) emit_poll(e, index);
+            emit_guard(e, index, 1, CC_JL);
+            emit_guard(e, index, STACK_SIZE - 1, CC_JGE);
+            emit_spill(e);
+            emit8(e, 0x43);                                     // inc ebx
+            emit8(e, 0x85); emit8(e, 0xC0);                     // test eax, eax
+            add_fixup(e, emit_jcc(e, instr->op == OP_DUP_BIZ ? CC_JE : CC_JNE), instr->operand);
+            break;
+        case OP_JMP:
+            if (backward) emit_poll(e, index);
+            add_fixup(e, emit_jmp(e), instr->operand);
+            break;
+        case OP_END:
+            emit_spill(e);
+            emit_store_sp(e);
+            add_fixup(e, emit_jmp(e), TARGET_EXIT);
+            break;
+        default:
+            // printt, printv, in, arrays and anything without a native translation
+            emit_helper_call(e, index, 0);
+            break;
+    }
+}
+
+void jit_free(JitCode* jit) {
+    kfree(jit->code);
+    kfree(jit->entry_points);
+    jit->code = 0;
+    jit->entry_points = 0;
+    jit->size = 0;
+}
+
+int jit_compile(const Bytecode* bytecode, JitCode* jit) {
+    int count = bytecode->count;
+    unsigned int capacity = count * (MAX_INSTR_BYTES + 3 * MAX_STUB_BYTES) + 64;
+
+    jit->code = (unsigned char*)kmalloc(capacity);
+    jit->entry_points = (unsigned int*)kmalloc(count * sizeof(unsigned int));
+    Fixup* fixups = (Fixup*)kmalloc(count * 5 * sizeof(Fixup));
+    SlowPath* slow_paths = (SlowPath*)kmalloc(count * 3 * sizeof(SlowPath));
+    if (!jit->code || !jit->entry_points || !fixups || !slow_paths) {
+        kfree(fixups);
+        kfree(slow_paths);
+        jit_free(jit);
+        return 0;
+    }
+
+    Emitter e;
+    e.pos = jit->code;
+    e.fixups = fixups;
+    e.fixup_count = 0;
+    e.slow_paths = slow_paths;
+    e.slow_count = 0;
+    e.jit = jit;
+
+    // Prologue: save callee-saved registers, load sp and the top of stack
+    emit8(&e, 0x55); emit8(&e, 0x53); emit8(&e, 0x56); emit8(&e, 0x57);   // push ebp/ebx/esi/edi
+    emit_load_sp(&e);
+    emit_load_top(&e);
+
+    for (int i = 0; i < count; i++) {
+        jit->entry_points[i] = (unsigned int)e.pos;
+        emit_instruction(&e, &bytecode->code[i], i);
+    }
+
+    // Out-of-line slow paths keep the hot code straight
+    for (int i = 0; i < e.slow_count; i++) {
+        patch_rel32(e.slow_paths[i].field, e.pos);
+        emit_helper_call(&e, e.slow_paths[i].index, e.slow_paths[i].poll);
+    }
+
+    unsigned char* exit = e.pos;
+    emit8(&e, 0x5F); emit8(&e, 0x5E); emit8(&e, 0x5B); emit8(&e, 0x5D);   // pop edi/esi/ebx/ebp
+    emit8(&e, 0xC3);                                                      // ret
+
+    for (int i = 0; i < e.fixup_count; i++) {
+        int target = e.fixups[i].target;
+        unsigned char* address = target == TARGET_EXIT ? exit : (unsigned char*)jit->entry_points[target];
+        patch_rel32(e.fixups[i].field, address);
+    }
+
+    jit->size = (unsigned int)(e.pos - jit->code);
+    kfree(fixups);
+    kfree(slow_paths);
+    return 1;
+}
+
+void jit_execute(const Bytecode* bytecode, const JitCode* jit) {
+    running_bytecode = bytecode;
+    poll_interval = start_run_limits();
+    poll_counter = poll_interval + 1;   // hits 0 on the branch after the interval
+    executed = 0;
+    ((void (*)())jit->code)();
+    running_bytecode = 0;
+    finish_run_limits();
+}
@@ -0,0 +1,16 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "bytecode.h"
+
+typedef struct {
+    unsigned char* code;
+    unsigned int size;
+    unsigned int* entry_points;     // native address of every instruction
+} JitCode;
+
+int jit_compile(const Bytecode* bytecode, JitCode* jit);
+void jit_execute(const Bytecode* bytecode, const JitCode* jit);
+void jit_free(JitCode* jit);
+
+#endif
@@ -2,6 +2,28 @@
 #include "basic.h"
 #include "editor.h"
 #include "boot.h"
+#include "fs.h"
+#include "heap.h"
+#include "command.h"
+#include "script.h"
+#include "pipe.h"
+#include "serial.h"
+#include "interrupts.h"
+#include "timer.h"
+#include "keyboard.h"
+#include "thread.h"
+#include "smp.h"
+#include "fpu.h"
+#include "syscall.h"
+#include "paging.h"
+#include "elf.h"
+#include "bench.h"
+#include "membench.h"
+#include "profile.h"
+#include "symbols.h"
+#include "trace.h"
+#include "metrics.h"
+#include "workqueue.h"
 #include "multiboot.h"
 
 void executeCommand();
@@ -9,7 +31,6 @@ void executeCommand();
 #define VIDEO_MEMORY (char*)0xB8000
 #define WIDTH 80
 #define HEIGHT 25
-#define KEYBOARD_PORT 0x60
 #define MAX_LINE_LENGTH 80
 
 #define CMOS_ADDR 0x70
@@ -23,6 +44,10 @@ void executeCommand();
 
 #define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
 
+#define DEBUG_EXIT_PORT 0xF4      // QEMU -device isa-debug-exit,iobase=0xf4,iosize=0x04
+
+#define HEAP_LIMIT 0x40000000     // keep the heap below 1 GB
+
 extern char _kernel_start;
 extern char _kernel_end;
 
@@ -31,10 +56,12 @@ unsigned char buffer_index = 0;
 
 char command_buffer[64] = {0};
 char argument_buffer[64] = {0};
+int input_is_pipeline = 0;
 
 unsigned int mem_lower_kb = 0;
 unsigned int mem_upper_kb = 0;
 multiboot_info_t* boot_info = 0;
+int batch_mode = 0;
 
 char scancode_to_ascii[128] = {
     0, 27, '1','2','3','4','5','6','7','8','9','0','ß','´','\b',
@@ -44,13 +71,6 @@ char scancode_to_ascii[128] = {
     '*', 0, ' ', 0,
 };
 
-typedef struct {
-    char name[16];
-    char content[FILE_HEIGHT][FILE_WIDTH + 1];
-} TextFile;
-
-TextFile files[MAX_FILES] = {0};
-
 typedef struct {
     int line_number;
     char line[MAX_LINE_LENGTH];
@@ -61,7 +81,8 @@ char* get_keypress() {
     static int shift_pressed = 0;
 
     while (1) {
-        unsigned char scancode = inb(KEYBOARD_PORT);
+        // The keyboard interrupt queues scancodes; sleep until one arrives
+        unsigned char scancode = keyboard_read();
 
         // Shift press
         if (scancode == 0x2A || scancode == 0x36) {
@@ -77,18 +98,17 @@ char* get_keypress() {
 
         if (scancode == 0xE0) {
             // Extended key prefix
-            unsigned char extcode = inb(KEYBOARD_PORT);
-
+            unsigned char extcode;
             while (1) {
-                extcode = inb(KEYBOARD_PORT);
+                extcode = keyboard_read();
                 if (extcode < 0x80) break; // Ignore key releases
             }
             result[0] = 0;       // Signal extended
             result[1] = extcode; // Actual arrow code
+            TRACE(TRACE_KEYPRESS, 0, extcode);
             return result;
         }
 
-
         if (scancode < 128) {
             char ascii = scancode_to_ascii[scancode];
 
@@ -127,9 +147,7 @@ char* get_keypress() {
 
                 result[0] = ascii;
                 result[1] = scancode;
-
-                // Wait for key release (optional)
-                while (inb(KEYBOARD_PORT) != (scancode | 0x80));
+                TRACE(TRACE_KEYPRESS, (unsigned char)ascii, scancode);
                 return result;
             }
         }
@@ -145,45 +163,16 @@ unsigned char bcd_to_binary(unsigned char bcd) {
     return ((bcd / 16) * 10) + (bcd & 0x0F);
 }
 
-void wait_release(unsigned char pressed_scancode) {
-    unsigned char release_code = pressed_scancode | 0x80;
-    while (1) {
-        if (inb(KEYBOARD_PORT) == release_code) break;
-    }
-}
-
 void parse_buffer() {
-    buffer_index = 0;
-    int arg_index = 0;
-    int cmd_index = 0;
-    int command0argument1 = 0;
-
-    char current_character = input_buffer[buffer_index];
-    while (current_character != 0) {
-        if (current_character == ' ' && command0argument1 == 0) {
-            command0argument1 = 1;
-        } else {
-            if (command0argument1) {
-                if (arg_index < sizeof(argument_buffer) - 1)
-                    argument_buffer[arg_index++] = current_character;
-            } else {
-                if (cmd_index < sizeof(command_buffer) - 1)
-                    command_buffer[cmd_index++] = current_character;
-            }
-        }
-        buffer_index++;
-        current_character = input_buffer[buffer_index];
-    }
-
-    command_buffer[cmd_index] = 0;
-    argument_buffer[arg_index] = 0;
+    split_command_line(input_buffer, command_buffer, sizeof(command_buffer), argument_buffer, sizeof(argument_buffer));
+    input_is_pipeline = is_pipeline(input_buffer);
 }
 
 void wait_for_kb_controller() {
     while (inb(0x64) & 0x02);
 }
 
-void command_reboot() {
+void command_reboot(const char* args) {
     print_string("\nRebooting...\n");
     __asm__ __volatile__("cli");
     wait_for_kb_controller();
@@ -191,7 +180,7 @@ void command_reboot() {
     while (1) __asm__ __volatile__("hlt");
 }
 
-void command_rtc_time() {
+void command_rtc_time(const char* args) {
     unsigned char sec = bcd_to_binary(read_rtc_register(CMOS_SEC));
     unsigned char min = bcd_to_binary(read_rtc_register(CMOS_MIN));
     unsigned char hour = bcd_to_binary(read_rtc_register(CMOS_HOUR));
@@ -213,52 +202,82 @@ void command_rtc_time() {
     int_to_string(2000 + year, buffer); print_string(buffer);
 }
 
-void command_benchmark() {
-    print_string("\nBenchmarking CPU for 5 seconds...\n");
-
-    // Wait for next second to align start time
-    unsigned char start_sec = bcd_to_binary(read_rtc_register(CMOS_SEC));
-    unsigned char current_sec;
-    do {
-        current_sec = bcd_to_binary(read_rtc_register(CMOS_SEC));
-    } while (current_sec == start_sec);
-
-    // Start benchmarking
-    unsigned int iterations = 0;
-    start_sec = bcd_to_binary(read_rtc_register(CMOS_SEC));
-
-    do {
-        iterations++;
-        current_sec = bcd_to_binary(read_rtc_register(CMOS_SEC));
-    } while (((current_sec - start_sec) & 0x3F) < 5); // handles wrap-around
-
-    char buffer[64];
-    print_string("Done.\nIterations: ");
-    int_to_string(iterations, buffer);
-    print_string(buffer);
-    print_string("\n");
-
-    print_string("Benchmark Index: ");
-    int_to_string(iterations / 100000, buffer); // scaled for readability
-    print_string(buffer);
-    print_string(" (x10^5 iters/5s)\n");
+void command_profile(const char* args) {
+    if (compare_strings(args, "start")) {
+        if (!profile_start()) {
+            command_error("\nOut of memory.");
+            return;
+        }
+        print_string("\nProfiling started (");
+        char buffer[16];
+        int_to_string(symbol_count(), buffer);
+        print_string(buffer);
+        print_string(" kernel functions).");
+    } else if (compare_strings(args, "stop")) {
+        profile_stop();
+        print_string("\nProfiling stopped.");
+    } else if (compare_strings(args, "report")) {
+        profile_report();
+    } else {
+        command_error("\nUsage: profile start|stop|report");
+    }
 }
 
+void command_stats(const char* args) {
+    if (!*args) {
+        metrics_print();
+    } else if (compare_strings(args, "reset")) {
+        metrics_reset();
+        print_string("\nCounters reset.");
+    } else if (compare_strings(args, "dump")) {
+        metrics_dump();
+    } else {
+        command_error("\nUsage: stats [reset|dump]");
+    }
+}
 
-void command_poke() {
-    char* addr_str = argument_buffer;
-    char* value_str = argument_buffer;
+void command_trace(const char* args) {
+#ifndef CONFIG_TRACE
+    command_error("\nTracepoints are compiled out (build with -DCONFIG_TRACE).");
+#else
+    if (compare_strings(args, "on")) {
+        trace_enabled = 1;
+    } else if (compare_strings(args, "off")) {
+        trace_enabled = 0;
+    } else if (compare_strings(args, "clear")) {
+        trace_clear();
+    } else if (compare_strings(args, "dump")) {
+        trace_dump();
+    } else {
+        command_error("\nUsage: trace on|off|clear|dump");
+    }
+#endif
+}
 
-    while (*value_str && *value_str != ' ') value_str++;
-    if (*value_str == 0) {
-        print_string("\nUsage: poke <addr> <value>");
+// bench smp and bench syscall have their own reports; everything else is
+// a registered micro-benchmark
+void command_bench(const char* args) {
+    if (compare_strings(args, "smp")) {
+        smp_benchmark();
+        return;
+    }
+    if (compare_strings(args, "syscall")) {
+        syscall_benchmark();
         return;
     }
+    run_benchmarks(args);
+}
 
-    *value_str = 0;
-    value_str++;
+void command_membench(const char* args) {
+    membench(args);
+}
+
+void command_poke(const char* args) {
+    const char* value_str = args;
+    while (*value_str && *value_str != ' ') value_str++;
+    while (*value_str == ' ') value_str++;
 
-    unsigned int addr = hex_to_uint(addr_str);
+    unsigned int addr = hex_to_uint(args);
     unsigned char value = (unsigned char)hex_to_uint(value_str);
     unsigned char* ptr = (unsigned char*)addr;
     *ptr = value;
@@ -272,13 +291,8 @@ void command_poke() {
 
 }
 
-void command_peek() {
-    if (argument_buffer[0] == 0) {
-        print_string("\nUsage: peek <addr>");
-        return;
-    }
-
-    unsigned int addr = hex_to_uint(argument_buffer);
+void command_peek(const char* args) {
+    unsigned int addr = hex_to_uint(args);
     unsigned char value = *((unsigned char*)addr);
 
     print_string("\nValue at address: 0x");
@@ -289,36 +303,151 @@ void command_peek() {
     print_string(out);
 }
 
-void command_echo() {
+void command_echo(const char* args) {
     print_string("\n");
-    print_string(argument_buffer);
+    print_string(args);
 }
 
-void command_ls() {
+void command_ls(const char* args) {
+    char buffer[16];
     print_string("\nFiles:\n");
     for (int i = 0; i < MAX_FILES; i++) {
         if (files[i].name[0]) {
             print_string("- ");
             print_string(files[i].name);
-            print_string("\n");
+            print_string(" (");
+            int_to_string(files[i].size, buffer);
+            print_string(buffer);
+            print_string(" bytes)\n");
         }
     }
 }
 
-void command_cat() {
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (compare_strings(files[i].name, argument_buffer)) {
-            print_string("\n");
-            for (int y = 0; y < FILE_HEIGHT; y++) {
-                print_string(files[i].content[y]);
-            }
-            return;
+void command_cat(const char* args) {
+    TextFile* file = find_file(args);
+    if (!file) {
+        command_error("\nFile not found.");
+        return;
+    }
+    print_string("\n");
+    if (!file->data) return;
+
+    // Files end with a newline; the prompt already starts a new line
+    unsigned int last = file->size - 1;
+    if (file->size && file->data[last] == '\n') {
+        file->data[last] = 0;
+        print_string(file->data);
+        file->data[last] = '\n';
+    } else {
+        print_string(file->data);
+    }
+}
+
+// Filters see the previous pipeline stage's output one line at a time
+// (line == 0 once it ends). Run on their own they read the file named by
+// their last argument.
+
+void filter_cat(const char* args, const char* line, int* state) {
+    if (!line) return;
+    print_string("\n");
+    print_string(line);
+}
+
+void filter_grep(const char* args, const char* line, int* state) {
+    if (!line) return;
+
+    char pattern[64];
+    int i = 0;
+    while (args[i] && args[i] != ' ' && i < 63) {
+        pattern[i] = args[i];
+        i++;
+    }
+    pattern[i] = 0;
+
+    if (contains_string(line, pattern)) {
+        print_string("\n");
+        print_string(line);
+    }
+}
+
+void filter_wc(const char* args, const char* line, int* state) {
+    if (line) {
+        state[0]++;
+        state[1] += count_arguments(line);
+        state[2] += string_length(line) + 1;
+        return;
+    }
+
+    char buffer[16];
+    print_string("\n");
+    int_to_string(state[0], buffer); print_string(buffer); print_string(" lines, ");
+    int_to_string(state[1], buffer); print_string(buffer); print_string(" words, ");
+    int_to_string(state[2], buffer); print_string(buffer); print_string(" chars");
+}
+
+void filter_head(const char* args, const char* line, int* state) {
+    if (!line) return;
+
+    int limit = (args[0] >= '0' && args[0] <= '9') ? string_to_int(args) : 10;
+    if (state[0]++ < limit) {
+        print_string("\n");
+        print_string(line);
+    }
+}
+
+void run_filter_on_file(const char* args, void (*filter)(const char*, const char*, int*)) {
+    // Split off the last argument as the file name
+    int end = string_length(args);
+    while (end > 0 && args[end - 1] == ' ') end--;
+    int start = end;
+    while (start > 0 && args[start - 1] != ' ') start--;
+
+    char name[MAX_FILENAME];
+    int length = 0;
+    for (int i = start; i < end && length < MAX_FILENAME - 1; i++) name[length++] = args[i];
+    name[length] = 0;
+
+    char params[64];
+    length = 0;
+    for (int i = 0; i < start && length < 63; i++) params[length++] = args[i];
+    while (length > 0 && params[length - 1] == ' ') length--;
+    params[length] = 0;
+
+    TextFile* file = find_file(name);
+    if (!file) {
+        command_error("\nFile not found.");
+        return;
+    }
+
+    int state[4] = {0};
+    char line[256];
+    unsigned int pos = 0;
+    while (file->data && pos < file->size) {
+        int len = 0;
+        while (pos < file->size && file->data[pos] != '\n') {
+            if (len < (int)sizeof(line) - 1) line[len++] = file->data[pos];
+            pos++;
         }
+        pos++;
+        line[len] = 0;
+        filter(params, line, state);
     }
-    print_string("\nFile not found.");
+    filter(params, 0, state);
+}
+
+void command_grep(const char* args) {
+    run_filter_on_file(args, filter_grep);
+}
+
+void command_wc(const char* args) {
+    run_filter_on_file(args, filter_wc);
+}
+
+void command_head(const char* args) {
+    run_filter_on_file(args, filter_head);
 }
 
-void command_clear() {
+void command_clear(const char* args) {
     cursor_pos = 0;
     for (int i = 0; i <= WIDTH * HEIGHT; i++) {
         video_memory[i * 2] = 0;
@@ -328,7 +457,7 @@ void command_clear() {
 
 extern multiboot_info_t* boot_info;
 
-void command_info() {
+void command_info(const char* args) {
     char buffer[64];
 
     print_string("\nSystem Info:");
@@ -346,6 +475,9 @@ void command_info() {
     print_string("\n- CPU Brand: ");
     print_string(cpu_brand);
 
+    print_string("\n- CPUs: ");
+    int_to_string(cpu_count, buffer); print_string(buffer);
+
 
     // Stack Pointer
     unsigned int esp;
@@ -429,13 +561,8 @@ void command_info() {
     }
 }
 
-void command_color() {
-    if (argument_buffer[0] == 0) {
-        print_string("\nUsage: color <hex>");
-        return;
-    }
-
-    change_color(argument_buffer);
+void command_color(const char* args) {
+    change_color(args);
     print_string("\n[OK] Color changed to 0x");
     char buf[4];
     unsigned char val = color;
@@ -445,101 +572,475 @@ void command_color() {
     print_string(buf);
 }
 
-void command_shutdown() {
-    outw(0x604, 0x2000);
+// Power off with an exit status. In batch mode the status goes to QEMU's
+// isa-debug-exit device (QEMU exits with status * 2 + 1); otherwise, and if
+// that device is missing, try the ACPI shutdown ports of the usual emulators.
+void power_off(int status) {
+    print_string("\nPowering off...\n");
+    work_flush();           // deferred serial output and cursor moves
+    serial_flush();
+    __asm__ __volatile__("cli");
+
+    if (batch_mode) outb(DEBUG_EXIT_PORT, (unsigned char)status);
+
+    outw(0x604, 0x2000);   // QEMU (piix4/ich9 ACPI)
+    outw(0xB004, 0x2000);  // Bochs and older QEMU
+    outw(0x4004, 0x3400);  // VirtualBox
+
+    print_string("It is now safe to turn off your computer.");
+    while (1) __asm__ __volatile__("hlt");
+}
+
+void command_shutdown(const char* args) {
+    power_off(args[0] ? string_to_int(args) : 0);
+}
+
+void print_cycles(const char* label, unsigned long long cycles) {
+    char buffer[24];
+    print_string(label);
+    u64_to_string(cycles, buffer);
+    print_string(buffer);
+    print_string(" cycles");
 }
 
-void command_run() {
-    if (argument_buffer[0] == 0) {
-        print_string("\nUsage: run <filename>");
+void run_script(TextFile* file, int timed) {
+    unsigned long long start = read_tsc();
+    int cache_hit;
+    CompiledScript* script = get_compiled_script(file, &cache_hit);
+    unsigned long long compiled = read_tsc();
+    if (!script) {
+        print_string("\nOut of memory.");
+        return;
+    }
+    if (script->running) {
+        print_string("\nScript is already running.");
         return;
     }
 
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (compare_strings(files[i].name, argument_buffer)) {
-            print_string("\nRunning script: ");
-            print_string(argument_buffer);
-            print_string("\n");
+    print_string("\nRunning script: ");
+    print_string(file->name);
+    print_string("\n");
 
-            for (int y = 0; y < FILE_HEIGHT; y++) {
-                const char* line = files[i].content[y];
-                int skip = 1;
-                for (int c = 0; line[c]; c++) {
-                    if (line[c] != ' ' && line[c] != '\t' && line[c] != '\r' && line[c] != '\n') {
-                        skip = 0;
-                        break;
-                    }
-                }
-                if (skip) continue;
+    run_compiled_script(script);
 
-                copy_string(input_buffer, line);
-                parse_buffer();
-                executeCommand();
-            }
-            return;
+    if (timed) {
+        unsigned long long finished = read_tsc();
+        print_cycles(cache_hit ? "\n[run] cached: " : "\n[run] compile: ", compiled - start);
+        print_cycles(", execute: ", finished - compiled);
+    }
+}
+
+void command_run(const char* args) {
+    int timed = 0;
+    if (starts_with(args, "-t ")) {
+        timed = 1;
+        args += 3;
+        while (*args == ' ') args++;
+    }
+
+    TextFile* file = find_file(args);
+    if (!file) {
+        command_error("\nFile not found.");
+        return;
+    }
+    run_script(file, timed);
+}
+
+// Load a static ELF32 executable and run it in ring 3 until it exits
+void command_runbin(const char* args) {
+    int verbose = 0;
+    if (starts_with(args, "-v ")) {
+        verbose = 1;
+        args += 3;
+        while (*args == ' ') args++;
+    }
+
+    TextFile* file = find_file(args);
+    if (!file) {
+        command_error("\nFile not found.");
+        return;
+    }
+    if (!paging_enabled) {
+        command_error("\nPrograms need paging (a CPU with 4 MB pages).");
+        return;
+    }
+
+    unsigned long long start = read_tsc();
+    AddressSpace* space = address_space_create(file, 0);
+    if (!space) {
+        command_error("\nOut of memory.");
+        return;
+    }
+    const char* error = "too many segments";
+    unsigned int entry = elf_load(file, space, &error);
+    if (!entry || !address_space_map(space, USER_TOP - USER_STACK_SIZE, USER_TOP, 0, 0, 1)) {
+        command_error("\nCannot run: ");
+        print_string(error);
+        address_space_destroy(space);
+        return;
+    }
+    unsigned long long cycles = read_tsc() - start;
+
+    char buffer[24];
+    if (verbose) {
+        print_string("\n[runbin] started in ");
+        if (tsc_khz) {
+            u64_to_string(u64_div(cycles * 1000, tsc_khz), buffer);
+            print_string(buffer);
+            print_string(" us (");
         }
+        u64_to_string(cycles, buffer);
+        print_string(buffer);
+        print_string(tsc_khz ? " cycles)" : " cycles");
+    }
+    print_string("\n");
+
+    // argc, argv and envp are all zero: the stack starts out as zero pages
+    int status = run_user(space, entry, USER_TOP - 16);
+
+    if (verbose) {
+        print_string("\n[runbin] exit status ");
+        int_to_string(status, buffer);
+        print_string(buffer);
+        print_string(", ");
+        int_to_string(space->pages, buffer);
+        print_string(buffer);
+        print_string(" pages touched");
     }
+    address_space_destroy(space);
+    if (status) {
+        command_error("\nProgram exited with status ");
+        int_to_string(status, buffer);
+        print_string(buffer);
+    }
+}
 
-    print_string("\nFile not found.");
+void command_ps(const char* args) {
+    print_string("\nID  STATE     PRI  CPU  TIME(ms)  NAME");
+
+    unsigned long long now = read_tsc();
+    for (int i = 0; i < MAX_THREADS; i++) {
+        Thread* thread = &threads[i];
+        if (thread->state == THREAD_UNUSED) continue;
+
+        unsigned long long cycles = thread->cpu_cycles;
+        if (thread->state == THREAD_RUNNING) cycles += now - thread->switched_in;
+
+        char buffer[24];
+        print_string("\n");
+        int_to_string(thread->id, buffer);
+        print_padded(buffer, 4);
+        print_padded(thread_state_name(thread->state), 10);
+        int_to_string(thread->priority, buffer);
+        print_padded(buffer, 5);
+        int_to_string(thread->cpu, buffer);
+        print_padded(buffer, 5);
+        if (tsc_khz) u64_to_string(u64_div(cycles, tsc_khz), buffer);
+        else copy_string(buffer, "?");
+        print_padded(buffer, 10);
+        print_string(thread->name);
+    }
 }
 
-void executeCommand() {
-    if (compare_strings(command_buffer, "echo")) {
-        command_echo();
-    } else if (compare_strings(command_buffer, "help")) {
-        print_string("\nAvailable commands:\n");
-        print_string("- echo <text>\n");
-        print_string("- clear\n");
-        print_string("- help\n");
-        print_string("- poke <address> <value>\n");
-        print_string("- peek <address>\n");
-        print_string("- editor <file name>\n");
-        print_string("- ls\n");
-        print_string("- cat <file name>\n");
-        print_string("- eg-basic\n");
-        print_string("- rtc-time\n");
-        print_string("- info\n");
-        print_string("- color <hex>         (e.g. 0F = black on white)\n");
-        print_string("- reboot");
-    } else if (compare_strings(command_buffer, "poke")) {
-        command_poke();
-    } else if (compare_strings(command_buffer, "peek")) {
-        command_peek();
-    } else if (compare_strings(command_buffer, "reboot")) {
-        command_reboot();
-    } else if (compare_strings(command_buffer, "clear")){
-        command_clear();
-    } else if (compare_strings(command_buffer, "eg-basic")) {
-        start_basic_repl();
-    } else if (compare_strings(command_buffer,"cat")) {
-        command_cat();
-    } else if (compare_strings(command_buffer, "ls")) {
-        command_ls();
-    } else if (compare_strings(command_buffer, "editor")) {
-       if (argument_buffer[0]) start_editor(argument_buffer);
-       else print_string("Usage: editor <filename>");
-    } else if (compare_strings(command_buffer, "rtc-time")) {
-        command_rtc_time();
-    } else if (compare_strings(command_buffer, "info")) {
-        command_info();
-    } else if (compare_strings(command_buffer, "benchmark")) {
-        command_benchmark();
-    } else if (compare_strings(command_buffer, "color")) {
-        command_color();
-    } else if (compare_strings(command_buffer, "run")) {
-        command_run();
-    } else if (compare_strings(command_buffer, "shutdown")) {
-        command_shutdown();
+static void print_microseconds(unsigned long long cycles) {
+    char buffer[24];
+    if (tsc_khz) {
+        u64_to_string(u64_div(cycles * 1000, tsc_khz), buffer);
+        print_string(buffer);
+        print_string(" us");
+    } else {
+        u64_to_string(cycles, buffer);
+        print_string(buffer);
+        print_string(" cycles");
+    }
+}
+
+void command_workq(const char* args) {
+    char buffer[16];
+    print_string("\nWork queue: ");
+    int_to_string(work_stats.depth, buffer);
+    print_string(buffer);
+    print_string(" waiting (max ");
+    int_to_string(work_stats.max_depth, buffer);
+    print_string(buffer);
+    print_string("), ");
+    int_to_string(work_stats.posted, buffer);
+    print_string(buffer);
+    print_string(" posted, ");
+    int_to_string(work_stats.coalesced, buffer);
+    print_string(buffer);
+    print_string(" coalesced, ");
+    int_to_string(work_stats.executed, buffer);
+    print_string(buffer);
+    print_string(" run");
+
+    print_string("\nLatency: avg ");
+    print_microseconds(work_stats.executed ? u64_div(work_stats.latency_total, work_stats.executed) : 0);
+    print_string(", max ");
+    print_microseconds(work_stats.latency_max);
+}
+
+// "command &" runs in a job thread; the line is a heap copy owned by the job
+void run_job(void* arg) {
+    char* line = (char*)arg;
+
+    if (is_pipeline(line)) {
+        Pipeline pipeline;
+        if (parse_pipeline(line, &pipeline, 0)) run_pipeline(&pipeline);
     } else {
-        print_string("\nUnknown command: ");
+        char* args = line;
+        while (*args && *args != ' ') args++;
+        if (*args) *args++ = 0;
+
+        const Command* command = find_command(line);
+        if (!command) {
+            command_error("\nUnknown command: ");
+            print_string(line);
+        } else {
+            dispatch_command(command, args);
+        }
+    }
+
+    char buffer[16];
+    print_string("\n[");
+    int_to_string(current_thread->id, buffer);
+    print_string(buffer);
+    print_string("] done");
+    kfree(line);
+}
+
+// Strips a trailing '&' from the input; returns 1 if there was one
+int is_background(char* line) {
+    int length = string_length(line);
+    while (length > 0 && line[length - 1] == ' ') length--;
+    if (length == 0 || line[length - 1] != '&') return 0;
+
+    length--;
+    while (length > 0 && line[length - 1] == ' ') length--;
+    line[length] = 0;
+    return 1;
+}
+
+void start_job(const char* line) {
+    char* copy = (char*)kmalloc(string_length(line) + 1);
+    if (!copy) {
+        command_error("\nOut of memory.");
+        return;
+    }
+    copy_string(copy, line);
+
+    char name[THREAD_NAME];
+    int length = 0;
+    while (line[length] && line[length] != ' ' && length < THREAD_NAME - 1) {
+        name[length] = line[length];
+        length++;
+    }
+    name[length] = 0;
+
+    Thread* thread = thread_create(name, PRIORITY_NORMAL, run_job, copy);
+    if (!thread) {
+        kfree(copy);
+        command_error("\nToo many threads.");
+        return;
+    }
+
+    char buffer[16];
+    print_string("\n[");
+    int_to_string(thread->id, buffer);
+    print_string(buffer);
+    print_string("] started");
+}
+
+void command_help(const char* args) {
+    print_command_help();
+}
+
+void command_editor(const char* args) {
+    start_editor(args);
+}
+
+void command_basic(const char* args) {
+    start_basic_repl();
+}
+
+// Dispatch, help text, argument checks and tab completion all come from here.
+// Commands with a filter can also take the output of another command: a | b
+Command commands[] = {
+    { "help",      "",                "List commands",                          0, command_help },
+    { "echo",      "<text>",          "Print text",                             0, command_echo },
+    { "clear",     "",                "Clear the screen",                       0, command_clear },
+    { "poke",      "<addr> <value>",  "Write a byte (hex) to memory",           2, command_poke },
+    { "peek",      "<addr>",          "Read a byte (hex) from memory",          1, command_peek },
+    { "editor",    "<file>",          "Edit a text file",                       1, command_editor },
+    { "ls",        "",                "List files",                             0, command_ls },
+    { "cat",       "<file>",          "Print a file",                           1, command_cat, filter_cat },
+    { "grep",      "<text> <file>",   "Print lines containing text",            2, command_grep, filter_grep },
+    { "wc",        "<file>",          "Count lines, words and characters",      1, command_wc, filter_wc },
+    { "head",      "[n] <file>",      "Print the first n (10) lines",           1, command_head, filter_head },
+    { "run",       "[-t] <file>",     "Run a command script (-t: show timing)", 1, command_run },
+    { "runbin",    "[-v] <file>",     "Run an ELF32 program (-v: show startup time)", 1, command_runbin },
+    { "eg-basic",  "",                "Start the EG-Basic REPL",                0, command_basic },
+    { "rtc-time",  "",                "Show the RTC date and time",             0, command_rtc_time },
+    { "info",      "",                "Show system information",                0, command_info },
+    { "color",     "<hex>",           "Set text color (e.g. 0F = white on black)", 1, command_color },
+    { "bench",     "[name|list] [n]", "Micro-benchmarks (also: bench smp|syscall)", 0, command_bench },
+    { "membench",  "[MB]",            "Memory bandwidth and latency (MB per array)", 0, command_membench },
+    { "profile",   "start|stop|report", "Sample where the kernel spends its time", 1, command_profile },
+    { "stats",     "[reset|dump]",    "Show kernel counters (dump: key=value to serial)", 0, command_stats },
+    { "trace",     "on|off|clear|dump", "Record timestamped events, dump to serial", 1, command_trace },
+    { "ps",        "",                "List threads and their CPU time",        0, command_ps },
+    { "workq",     "",                "Show deferred work queue statistics",    0, command_workq },
+    { "reboot",    "",                "Reboot the machine",                     0, command_reboot },
+    { "shutdown",  "[status]",        "Power off (status = batch exit code)",   0, command_shutdown },
+};
+
+static void run_input() {
+    if (input_is_pipeline) {
+        // "a | b", "a > file", "a >> file"
+        Pipeline pipeline;
+        if (parse_pipeline(input_buffer, &pipeline, 0)) run_pipeline(&pipeline);
+        return;
+    }
+    if (!command_buffer[0]) return;
+
+    const Command* command = find_command(command_buffer);
+    if (!command) {
+        command_error("\nUnknown command: ");
         print_string(command_buffer);
+        return;
+    }
+    dispatch_command(command, argument_buffer);
+}
+
+void executeCommand() {
+    int errors = command_errors;
+    TRACE(TRACE_COMMAND_BEGIN, *(const unsigned int*)input_buffer, 0);
+    run_input();
+    TRACE(TRACE_COMMAND_END, command_errors - errors, 0);
+}
+
+// Tab completes the command name while no argument has been typed yet
+void complete_input() {
+    for (int i = 0; i < buffer_index; i++) {
+        if (input_buffer[i] == ' ') return;
+    }
+    input_buffer[buffer_index] = 0;
+
+    char completion[64];
+    int room = 126 - buffer_index;
+    if (room > 63) room = 63;
+    int matches = complete_command(input_buffer, completion, room);
+    if (completion[0]) {
+        for (int i = 0; completion[i]; i++) input_buffer[buffer_index++] = completion[i];
+        input_buffer[buffer_index] = 0;
+        print_string(completion);
+    } else if (matches > 1) {
+        print_command_matches(input_buffer);
+        print_string("\n> ");
+        print_string(input_buffer);
+    }
+}
+
+// The heap takes all upper memory after the kernel image, the symbol table
+// and any GRUB modules
+void init_heap(multiboot_info_t* mbi) {
+    unsigned int start = (unsigned int)&_kernel_end;
+    if (symbols_end(mbi) > start) start = symbols_end(mbi);
+    unsigned int end = 0x100000 + 32 * 1024 * 1024;  // assume 32 MB without a memory map
+
+    if (mbi->flags & 0x1) end = 0x100000 + mbi->mem_upper * 1024;
+    if (end > HEAP_LIMIT) end = HEAP_LIMIT;
+
+    if (mbi->flags & 0x8) {
+        multiboot_module_t* mods = (multiboot_module_t*)mbi->mods_addr;
+        for (unsigned int i = 0; i < mbi->mods_count; i++) {
+            if (mods[i].mod_end > start) start = mods[i].mod_end;
+        }
     }
+
+    heap_init((void*)start, (void*)end);
+}
+
+// Look up "key" or "key=value" on the GRUB command line
+int get_boot_option(multiboot_info_t* mbi, const char* key, char* value, int max_length) {
+    if (!(mbi->flags & 0x4) || !mbi->cmdline) return 0;
+
+    const char* p = (const char*)mbi->cmdline;
+    while (*p) {
+        while (*p == ' ') p++;
+        const char* k = key;
+        while (*k && *p == *k) {
+            p++;
+            k++;
+        }
+        if (!*k && (*p == '=' || *p == ' ' || *p == 0)) {
+            int length = 0;
+            if (*p == '=') {
+                p++;
+                while (*p && *p != ' ' && length < max_length - 1) value[length++] = *p++;
+            }
+            value[length] = 0;
+            return 1;
+        }
+        while (*p && *p != ' ') p++;
+    }
+    return 0;
+}
+
+// GRUB modules become files, named after the last path component of their
+// module line ("module /boot/test.txt test.txt" -> test.txt)
+void load_modules(multiboot_info_t* mbi) {
+    if (!(mbi->flags & 0x8)) return;
+
+    multiboot_module_t* mods = (multiboot_module_t*)mbi->mods_addr;
+    for (unsigned int i = 0; i < mbi->mods_count; i++) {
+        const char* name = mods[i].string ? (const char*)mods[i].string : "module";
+        const char* base = name;
+        for (const char* p = name; *p && *p != ' '; p++) {
+            if (*p == '/') base = p + 1;
+        }
+        // Prefer an explicit name after the path
+        for (const char* p = name; *p; p++) {
+            if (*p == ' ' && p[1] && p[1] != ' ') base = p + 1;
+        }
+
+        char file_name[MAX_FILENAME];
+        int length = 0;
+        while (base[length] && base[length] != ' ' && length < MAX_FILENAME - 1) {
+            file_name[length] = base[length];
+            length++;
+        }
+        file_name[length] = 0;
+
+        TextFile* file = create_file(file_name);
+        if (file) file_write(file, (const char*)mods[i].mod_start, mods[i].mod_end - mods[i].mod_start);
+    }
+}
+
+// batch=<file>: run a script without a prompt, mirror output to serial and
+// power off with the number of failed commands as exit status
+void run_batch(const char* name) {
+    TextFile* file = find_file(name);
+    if (!file) {
+        command_error("\nBatch script not found: ");
+        print_string(name);
+    } else {
+        run_script(file, 0);
+    }
+    power_off(command_errors > 127 ? 127 : command_errors);
 }
 
 void kernel_main(unsigned int magic, unsigned int addr) {
 
     multiboot_info_t* mbi = (multiboot_info_t*)addr;
 
+    // Descriptor tables and the per-CPU segment come first: print_string
+    // reads the output sink through it
+    interrupts_init();
+    smp_init_boot_cpu();
+    fpu_init();
+    syscall_init_cpu();
+
     if (magic != MULTIBOOT_BOOTLOADER_MAGIC) {
         print_string("Invalid GRUB magic\n");
         return;
@@ -547,6 +1048,18 @@ void kernel_main(unsigned int magic, unsigned int addr) {
 
     boot_info = (multiboot_info_t*)addr;
 
+    symbols_init(mbi);
+    init_heap(mbi);
+
+    // Interrupts on: timer, keyboard and the scheduler (this code becomes
+    // the "shell" thread)
+    timer_init();
+    keyboard_init();
+    scheduler_init();
+    workqueue_init();
+    paging_init();
+    irq_enable();
+
     if (mbi->flags & 1) {
         mem_lower_kb = mbi->mem_lower;
         mem_upper_kb = mbi->mem_upper;
@@ -564,7 +1077,26 @@ void kernel_main(unsigned int magic, unsigned int addr) {
     }
 
     get_cpu_brand();
-    
+    calibrate_tsc();
+
+    metrics_init();
+    register_commands(commands, sizeof(commands) / sizeof(commands[0]));
+    bench_init();
+    membench_init(mbi);
+
+    serial_init();
+    load_modules(mbi);
+
+    char batch_file[MAX_FILENAME];
+    if (get_boot_option(mbi, "serial", batch_file, sizeof(batch_file))) serial_mirror = 1;
+    if (!get_boot_option(mbi, "nosmp", batch_file, sizeof(batch_file))) smp_init();
+    paging_enable();    // after the ACPI scan: its tables may lie in the user window
+    if (get_boot_option(mbi, "batch", batch_file, sizeof(batch_file))) {
+        batch_mode = 1;
+        serial_mirror = 1;
+        run_batch(batch_file);
+    }
+
     simulate_boot(mbi);
 
     while (1) {
@@ -588,6 +1120,8 @@ void kernel_main(unsigned int magic, unsigned int addr) {
                 video_memory[index] = ' ';
                 video_memory[index + 1] = color;
                 update_cursor();
+            } else if (character == '\t') {
+                complete_input();
             } else if (character != '\n') {
                 input_buffer[buffer_index++] = character;
                 char characterToPrint[2] = {character, 0};
@@ -596,6 +1130,10 @@ void kernel_main(unsigned int magic, unsigned int addr) {
         }
 
         input_buffer[buffer_index] = 0;
+        if (is_background(input_buffer)) {
+            if (input_buffer[0]) start_job(input_buffer);
+            continue;
+        }
         parse_buffer();
         executeCommand();
     }
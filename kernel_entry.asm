@@ -4,11 +4,20 @@ align 4
     dd 0x00000000         ; flags
     dd 0xE4524FFE         ; checksum (-(magic + flags))
 
+section .bss
+align 16
+global boot_stack_bottom
+global boot_stack_top
+boot_stack_bottom:
+    resb 16384            ; multiboot leaves ESP undefined, bring our own
+boot_stack_top:
+
 section .text
 global _start
 
 _start:
     cli
+    mov esp, boot_stack_top
     extern kernel_main
     push ebx              ; multiboot_info pointer
     push eax              ; magic number
@@ -0,0 +1,68 @@
+#include "keyboard.h"
+#include "interrupts.h"
+#include "metrics.h"
+#include "thread.h"
+#include "trace.h"
+#include "util.h"
+
+// The keyboard interrupt queues raw scancodes; readers sleep until one
+// arrives instead of spinning on the controller.
+
+#define KEYBOARD_DATA   0x60
+#define KEYBOARD_STATUS 0x64
+#define QUEUE_SIZE      128     // power of two
+#define SCANCODE_C      0x2E
+
+static unsigned char queue[QUEUE_SIZE];
+static volatile unsigned int head = 0;     // next write
+static volatile unsigned int tail = 0;     // next read
+static WaitQueue readers = {0};
+static Spinlock keyboard_lock;      // queue and readers
+
+static volatile int break_armed = 0;
+static volatile int break_requested = 0;
+
+static void keyboard_interrupt(InterruptFrame* frame) {
+    unsigned char scancode = inb(KEYBOARD_DATA);
+    TRACE(TRACE_KEY_IRQ, scancode, 0);
+    if (scancode < 0x80) metric_inc(METRIC_KEYSTROKES);     // presses, not releases
+
+    // While a program runs, 'c' stops it instead of being typed
+    if (break_armed && scancode == SCANCODE_C) {
+        break_requested = 1;
+        return;
+    }
+    spin_lock(&keyboard_lock);
+    if (head - tail < QUEUE_SIZE) {
+        queue[head % QUEUE_SIZE] = scancode;
+        head++;
+    }
+    wait_queue_wake_all(&readers);
+    spin_unlock(&keyboard_lock);
+}
+
+void keyboard_init() {
+    while (inb(KEYBOARD_STATUS) & 1) inb(KEYBOARD_DATA);   // drop stale bytes
+    irq_install(IRQ_KEYBOARD, keyboard_interrupt);
+}
+
+// Next scancode (presses and releases), sleeping until there is one
+unsigned char keyboard_read() {
+    unsigned int flags = spin_lock_irqsave(&keyboard_lock);
+    while (head == tail) wait_queue_sleep(&readers, &keyboard_lock);
+    unsigned char scancode = queue[tail % QUEUE_SIZE];
+    tail++;
+    spin_unlock_irqrestore(&keyboard_lock, flags);
+    return scancode;
+}
+
+void keyboard_arm_break(int armed) {
+    break_requested = 0;
+    break_armed = armed;
+}
+
+int keyboard_break_requested() {
+    if (!break_requested) return 0;
+    break_requested = 0;
+    return 1;
+}
@@ -0,0 +1,9 @@
+#ifndef KEYBOARD_H
+#define KEYBOARD_H
+
+void keyboard_init();
+unsigned char keyboard_read();
+int keyboard_break_requested();
+void keyboard_arm_break(int armed);
+
+#endif
@@ -0,0 +1,316 @@
+#include "membench.h"
+#include "bench.h"
+#include "command.h"
+#include "fpu.h"
+#include "heap.h"
+#include "serial.h"
+#include "util.h"
+
+// Bandwidth follows STREAM: three arrays well past the caches and four
+// kernels over them, the best of a few runs, counting the bytes each
+// kernel reads and writes. The elements are 32-bit integers moved 16 bytes
+// at a time with SSE2 (see bulk.c) instead of STREAM's doubles, which
+// would need the x87 in the kernel; the memory traffic is the same.
+//
+// Latency follows a chain of pointers, one per cache line, in a random
+// cyclic order: every load waits for the previous one and the prefetchers
+// can't guess the next line. The working set doubles from 4 KB until it
+// is far past the last cache level. RAM is mapped with 4 MB pages, so TLB
+// misses stay out of the numbers until the largest sizes.
+//
+// Tables go to the screen; every result also goes to the serial port as
+// one "MEMBENCH test=..." line between MEMBENCH-BEGIN and MEMBENCH-END.
+
+#define LINE_SIZE       64
+#define STREAM_RUNS     5
+#define MIN_ARRAY       (1024 * 1024)
+#define MAX_ARRAY       (64 * 1024 * 1024)
+#define LATENCY_MIN_SET 4096
+#define LATENCY_LOADS   (1 << 20)           // at least this many per size
+
+enum { STREAM_COPY, STREAM_SCALE, STREAM_ADD, STREAM_TRIAD, STREAM_KERNELS };
+
+static const char* const kernel_names[STREAM_KERNELS] = { "copy", "scale", "add", "triad" };
+static const unsigned int kernel_arrays[STREAM_KERNELS] = { 2, 2, 3, 3 };  // touched per element
+
+static unsigned long long usable_bytes = 0;
+static volatile unsigned int membench_sink;
+
+// RAM the firmware reports as usable (mem_upper without a memory map)
+void membench_init(multiboot_info_t* mbi) {
+    if (mbi->flags & 0x40) {
+        multiboot_memory_map_t* mmap = (multiboot_memory_map_t*)mbi->mmap_addr;
+        while ((unsigned int)mmap < mbi->mmap_addr + mbi->mmap_length) {
+            if (mmap->type == 1) usable_bytes += ((unsigned long long)mmap->len_high << 32) | mmap->len_low;
+            mmap = (multiboot_memory_map_t*)((unsigned int)mmap + mmap->size + sizeof(mmap->size));
+        }
+    } else if (mbi->flags & 0x1) {
+        usable_bytes = (unsigned long long)mbi->mem_upper * 1024;
+    }
+}
+
+// Each array gets a sixteenth of RAM, as a power of two
+static unsigned int default_array_size() {
+    unsigned long long target = usable_bytes / 16;
+    unsigned int size = MIN_ARRAY;
+    while (size < MAX_ARRAY && (unsigned long long)size * 2 <= target) size *= 2;
+    return size;
+}
+
+// --- Bandwidth ---
+
+SIMD static void stream_sse2(int kernel, int* a, int* b, int* c, unsigned int count) {
+    unsigned int i;
+    switch (kernel) {
+    case STREAM_COPY:
+        for (i = 0; i < count; i += 4) *(Vec4*)(c + i) = *(const Vec4*)(a + i);
+        break;
+    case STREAM_SCALE:
+        for (i = 0; i < count; i += 4) {
+            Vec4 v = *(const Vec4*)(c + i);
+            *(Vec4*)(b + i) = v + v + v;
+        }
+        break;
+    case STREAM_ADD:
+        for (i = 0; i < count; i += 4) *(Vec4*)(c + i) = *(const Vec4*)(a + i) + *(const Vec4*)(b + i);
+        break;
+    case STREAM_TRIAD:
+        for (i = 0; i < count; i += 4) {
+            Vec4 v = *(const Vec4*)(c + i);
+            *(Vec4*)(a + i) = *(const Vec4*)(b + i) + v + v + v;
+        }
+        break;
+    }
+}
+
+static void stream_scalar(int kernel, int* a, int* b, int* c, unsigned int count) {
+    unsigned int i;
+    switch (kernel) {
+    case STREAM_COPY:
+        for (i = 0; i < count; i++) c[i] = a[i];
+        break;
+    case STREAM_SCALE:
+        for (i = 0; i < count; i++) b[i] = 3 * c[i];
+        break;
+    case STREAM_ADD:
+        for (i = 0; i < count; i++) c[i] = a[i] + b[i];
+        break;
+    case STREAM_TRIAD:
+        for (i = 0; i < count; i++) a[i] = b[i] + 3 * c[i];
+        break;
+    }
+}
+
+// value / divisor for 64-bit divisors: drop low bits until u64_div copes
+static unsigned long long div64(unsigned long long value, unsigned long long divisor) {
+    while (divisor > 0xFFFFFFFF) {
+        value >>= 1;
+        divisor >>= 1;
+    }
+    return divisor ? u64_div(value, (unsigned int)divisor) : 0;
+}
+
+// "12.34" from hundredths
+static void print_hundredths(unsigned long long value, int width) {
+    char buffer[24];
+    unsigned long long whole = u64_div(value, 100);
+    unsigned int fraction = (unsigned int)(value - whole * 100);
+    u64_to_string(whole, buffer);
+    int length = string_length(buffer);
+    buffer[length++] = '.';
+    buffer[length++] = '0' + fraction / 10;
+    buffer[length++] = '0' + fraction % 10;
+    buffer[length] = 0;
+    print_string(buffer);
+    for (; length < width; length++) print_string(" ");
+}
+
+static void print_size(unsigned int bytes, int width) {
+    char buffer[16];
+    int mb = bytes >= 1024 * 1024;
+    int_to_string(mb ? bytes >> 20 : bytes >> 10, buffer);
+    print_string(buffer);
+    print_string(mb ? " MB" : " KB");
+    for (int length = string_length(buffer) + 3; length < width; length++) print_string(" ");
+}
+
+static void serial_value(const char* key, unsigned long long value) {
+    char buffer[24];
+    serial_write(" ");
+    serial_write(key);
+    serial_write("=");
+    u64_to_string(value, buffer);
+    serial_write(buffer);
+}
+
+static void run_stream(int* a, int* b, int* c, unsigned int size) {
+    unsigned int count = size / sizeof(int);
+    for (unsigned int i = 0; i < count; i++) {
+        a[i] = 1;
+        b[i] = 2;
+        c[i] = 0;
+    }
+
+    unsigned long long best[STREAM_KERNELS];
+    for (int k = 0; k < STREAM_KERNELS; k++) best[k] = ~0ULL;
+
+    // One FPU hand-over for the lot; a thread switch in between is fine
+    int simd = kernel_fpu_begin();
+    for (int run = 0; run < STREAM_RUNS; run++) {
+        for (int k = 0; k < STREAM_KERNELS; k++) {
+            unsigned long long start = serialized_tsc();
+            if (simd) stream_sse2(k, a, b, c, count);
+            else stream_scalar(k, a, b, c, count);
+            unsigned long long cycles = serialized_tsc() - start;
+            if (cycles < best[k]) best[k] = cycles;
+        }
+    }
+    if (simd) kernel_fpu_end();
+    membench_sink = a[count - 1];
+
+    char buffer[16];
+    print_string("\nSTREAM: 3 arrays of ");
+    print_size(size, 0);
+    print_string(", best of ");
+    int_to_string(STREAM_RUNS, buffer);
+    print_string(buffer);
+    print_string(simd ? " (SSE2)" : " (scalar)");
+    print_string("\nKERNEL   GB/S      CYCLES");
+
+    for (int k = 0; k < STREAM_KERNELS; k++) {
+        unsigned long long bytes = (unsigned long long)kernel_arrays[k] * size;
+        unsigned long long mb_per_s = u64_div(div64(bytes * tsc_khz, best[k]), 1000);
+        print_string("\n");
+        print_string(kernel_names[k]);
+        for (int length = string_length(kernel_names[k]); length < 9; length++) print_string(" ");
+        print_hundredths(u64_div(mb_per_s, 10), 10);
+        u64_to_string(best[k], buffer);
+        print_string(buffer);
+
+        serial_write("\nMEMBENCH test=");
+        serial_write(kernel_names[k]);
+        serial_value("array_bytes", size);
+        serial_value("bytes", bytes);
+        serial_value("cycles", best[k]);
+        serial_value("mb_s", mb_per_s);
+    }
+}
+
+// --- Latency ---
+
+static unsigned int next_random(unsigned int* state) {
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// Link the first 'size' bytes into one cycle through every line in random
+// order (Sattolo's shuffle), working on line numbers in place first
+static void* build_chain(unsigned char* base, unsigned int size) {
+    unsigned int lines = size / LINE_SIZE;
+    for (unsigned int i = 0; i < lines; i++) *(unsigned int*)(base + i * LINE_SIZE) = i;
+
+    unsigned int seed = 0x9E3779B9;
+    for (unsigned int i = lines - 1; i > 0; i--) {
+        unsigned int j = next_random(&seed) % i;
+        unsigned int* x = (unsigned int*)(base + i * LINE_SIZE);
+        unsigned int* y = (unsigned int*)(base + j * LINE_SIZE);
+        unsigned int swap = *x;
+        *x = *y;
+        *y = swap;
+    }
+
+    for (unsigned int i = 0; i < lines; i++) {
+        unsigned int* slot = (unsigned int*)(base + i * LINE_SIZE);
+        *slot = (unsigned int)(base + *slot * LINE_SIZE);
+    }
+    return base;
+}
+
+// 'loads' is a multiple of 8
+static void* chase(void* start, unsigned int loads) {
+    void** p = (void**)start;
+    for (unsigned int i = 0; i < loads; i += 8) {
+        p = (void**)*p; p = (void**)*p; p = (void**)*p; p = (void**)*p;
+        p = (void**)*p; p = (void**)*p; p = (void**)*p; p = (void**)*p;
+    }
+    return p;
+}
+
+static void run_latency(unsigned char* buffer, unsigned int largest) {
+    print_string("\n\nLatency: random pointer chase, one load per line");
+    print_string("\nWORKING SET  NS/LOAD   CYCLES/LOAD");
+
+    for (unsigned int size = LATENCY_MIN_SET; size && size <= largest; size *= 2) {
+        unsigned int lines = size / LINE_SIZE;
+        unsigned int loads = lines * 2 > LATENCY_LOADS ? lines * 2 : LATENCY_LOADS;
+
+        void* start = build_chain(buffer, size);
+        start = chase(start, lines);        // warm the caches and the TLB
+        unsigned long long begin = serialized_tsc();
+        void* end = chase(start, loads);
+        unsigned long long cycles = serialized_tsc() - begin;
+        membench_sink = (unsigned int)end;
+
+        unsigned long long ns = u64_div(cycles * 1000000, tsc_khz);
+        unsigned long long ps_per_load = u64_div(ns * 1000, loads);
+
+        print_string("\n");
+        print_size(size, 13);
+        print_hundredths(u64_div(ps_per_load, 10), 10);
+        print_hundredths(u64_div(cycles * 100, loads), 0);
+
+        serial_write("\nMEMBENCH test=latency");
+        serial_value("size", size);
+        serial_value("loads", loads);
+        serial_value("cycles", cycles);
+        serial_value("ps_per_load", ps_per_load);
+    }
+}
+
+// membench [MB per array]
+void membench(const char* args) {
+    if (!tsc_khz) {
+        command_error("\nThe TSC is not calibrated; no time base.");
+        return;
+    }
+
+    unsigned int size = default_array_size();
+    if (*args) {
+        int mb = string_to_int(args);
+        if (mb < 1 || mb > MAX_ARRAY / (1024 * 1024)) {
+            command_error("\nArray size must be 1-64 MB.");
+            return;
+        }
+        size = mb * 1024 * 1024;
+    }
+
+    // Settle for smaller arrays when the heap can't hold three
+    unsigned char* buffer = 0;
+    while (!(buffer = (unsigned char*)kmalloc(3 * size)) && size > MIN_ARRAY) size /= 2;
+    if (!buffer) {
+        command_error("\nOut of memory.");
+        return;
+    }
+
+    serial_write("\nMEMBENCH-BEGIN version=\"");
+    serial_write(kernel_version);
+    serial_write("\" cpu=\"");
+    serial_write(cpu_brand);
+    serial_write("\"");
+    serial_value("tsc_khz", tsc_khz);
+    serial_value("ram_kb", usable_bytes >> 10);
+    serial_value("array_bytes", size);
+
+    run_stream((int*)buffer, (int*)(buffer + size), (int*)(buffer + 2 * size), size);
+
+    // The chase uses the whole allocation, up to a power of two
+    unsigned int largest = LATENCY_MIN_SET;
+    while (largest * 2 <= 3 * size) largest *= 2;
+    run_latency(buffer, largest);
+
+    serial_write("\nMEMBENCH-END\n");
+    kfree(buffer);
+}
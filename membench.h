@@ -0,0 +1,13 @@
+#ifndef MEMBENCH_H
+#define MEMBENCH_H
+
+#include "multiboot.h"
+
+// The memory system as the kernel sees it: STREAM-style bandwidth
+// (copy, scale, add, triad) and load latency from a random pointer chase
+// over growing working sets
+
+void membench_init(multiboot_info_t* mbi);
+void membench(const char* args);
+
+#endif
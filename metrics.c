@@ -0,0 +1,126 @@
+#include "metrics.h"
+#include "heap.h"
+#include "paging.h"
+#include "serial.h"
+#include "timer.h"
+#include "util.h"
+
+typedef struct {
+    const char* name;
+    const char* label;                  // printed as name.label, may be 0
+    unsigned long long (*read)();       // gauges only
+} Metric;
+
+MetricRow metric_values[MAX_CPUS];
+
+static Metric metrics[MAX_METRICS] = {
+    [METRIC_CHARS_PRINTED]      = { "console.chars" },
+    [METRIC_SCROLLS]            = { "console.scrolls" },
+    [METRIC_CURSOR_WRITES]      = { "console.cursor_port_writes" },
+    [METRIC_KEYSTROKES]         = { "keyboard.keys" },
+    [METRIC_BASIC_INSTRUCTIONS] = { "basic.instructions" },
+    [METRIC_FILE_LOOKUPS]       = { "fs.lookups" },
+    [METRIC_HEAP_ALLOCATED]     = { "heap.allocated_bytes" },
+    [METRIC_HEAP_ALLOCATIONS]   = { "heap.allocations" },
+};
+static int metric_count = METRIC_BUILTIN_COUNT;
+
+static unsigned long long read_heap_used() {
+    return heap_used_bytes;
+}
+
+static unsigned long long read_heap_free() {
+    return heap_total_bytes - heap_used_bytes;
+}
+
+static unsigned long long read_free_pages() {
+    return paging_free_pages();
+}
+
+static unsigned long long read_uptime() {
+    return timer_ticks * (1000 / TIMER_HZ);
+}
+
+void metrics_init() {
+    gauge_register("heap.used_bytes", read_heap_used);
+    gauge_register("heap.free_bytes", read_heap_free);
+    gauge_register("paging.free_pages", read_free_pages);
+    gauge_register("uptime_ms", read_uptime);
+}
+
+// Returns the new counter's ID, or -1 when the registry is full
+int metric_register(const char* name, const char* label) {
+    if (metric_count == MAX_METRICS) return -1;
+    metrics[metric_count].name = name;
+    metrics[metric_count].label = label;
+    return metric_count++;
+}
+
+int gauge_register(const char* name, unsigned long long (*read)()) {
+    int id = metric_register(name, 0);
+    if (id >= 0) metrics[id].read = read;
+    return id;
+}
+
+static unsigned long long metric_value(int id) {
+    if (metrics[id].read) return metrics[id].read();
+    unsigned long long total = 0;
+    for (int cpu = 0; cpu < cpu_count; cpu++) total += metric_values[cpu].values[id];
+    return total;
+}
+
+// Counters only: gauges show the current state
+void metrics_reset() {
+    memset(metric_values, 0, sizeof(metric_values));
+}
+
+static int print_name(const Metric* metric) {
+    print_string(metric->name);
+    int length = string_length(metric->name);
+    if (metric->label) {
+        print_string(".");
+        print_string(metric->label);
+        length += 1 + string_length(metric->label);
+    }
+    return length;
+}
+
+// Counters that never moved are left out
+void metrics_print() {
+    char buffer[24];
+    print_string("\nCOUNTER                            VALUE");
+    for (int i = 0; i < metric_count; i++) {
+        unsigned long long value = metric_value(i);
+        if (!value && !metrics[i].read) continue;
+
+        print_string("\n");
+        int length = print_name(&metrics[i]);
+        if (metrics[i].read) {
+            print_string(" (gauge)");
+            length += 8;
+        }
+        for (; length < 35; length++) print_string(" ");
+        u64_to_string(value, buffer);
+        print_string(buffer);
+    }
+}
+
+// key=value lines on serial, every metric, for scraping
+void metrics_dump() {
+    char buffer[24];
+    serial_write("\nSTATS-BEGIN\n");
+    for (int i = 0; i < metric_count; i++) {
+        serial_write(metrics[i].name);
+        if (metrics[i].label) {
+            serial_write(".");
+            serial_write(metrics[i].label);
+        }
+        serial_write("=");
+        u64_to_string(metric_value(i), buffer);
+        serial_write(buffer);
+        serial_write("\n");
+    }
+    serial_write("STATS-END\n");
+    serial_flush();
+    print_string("\nStatistics sent to serial");
+}
@@ -0,0 +1,46 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "smp.h"
+
+// Named 64-bit counters, kept per CPU so hot paths never share a cache
+// line or take a lock, and gauges, read from a function when printed.
+// An increment is a plain add on the CPU's own slot: one that races with
+// a migration of the same thread may be lost, which is fine for statistics.
+
+#define MAX_METRICS 96
+
+// Fixed counters; more (one per command) are added with metric_register
+enum {
+    METRIC_CHARS_PRINTED,
+    METRIC_SCROLLS,
+    METRIC_CURSOR_WRITES,
+    METRIC_KEYSTROKES,
+    METRIC_BASIC_INSTRUCTIONS,
+    METRIC_FILE_LOOKUPS,
+    METRIC_HEAP_ALLOCATED,
+    METRIC_HEAP_ALLOCATIONS,
+    METRIC_BUILTIN_COUNT
+};
+
+// One row per CPU, starting on a cache line of its own
+typedef struct {
+    unsigned long long values[MAX_METRICS];
+} __attribute__((aligned(64))) MetricRow;
+
+extern MetricRow metric_values[MAX_CPUS];
+
+static inline void metric_add(int id, unsigned long long amount) {
+    metric_values[this_cpu()->index].values[id] += amount;
+}
+
+#define metric_inc(id) metric_add((id), 1)
+
+void metrics_init();
+int metric_register(const char* name, const char* label);
+int gauge_register(const char* name, unsigned long long (*read)());
+void metrics_print();
+void metrics_reset();
+void metrics_dump();
+
+#endif
@@ -9,7 +9,7 @@ typedef struct {
     unsigned int cmdline;
     unsigned int mods_count;
     unsigned int mods_addr;
-    unsigned int syms[4];
+    unsigned int syms[4];       // flag 0x20: ELF section headers (num, size, addr, shndx)
     unsigned int mmap_length;
     unsigned int mmap_addr;
 } __attribute__((packed)) multiboot_info_t;
@@ -23,4 +23,11 @@ typedef struct {
     unsigned int type;
 } __attribute__((packed)) multiboot_memory_map_t;
 
+typedef struct {
+    unsigned int mod_start;
+    unsigned int mod_end;
+    unsigned int string;
+    unsigned int reserved;
+} __attribute__((packed)) multiboot_module_t;
+
 #endif
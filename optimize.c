@@ -0,0 +1,240 @@
+#include "optimize.h"
+#include "heap.h"
+#include "util.h"
+
+// Peephole optimiser for compiled EG-Basic programs. Instructions are first
+// only marked as removed; a final pass compacts the code and remaps jumps.
+// A removed jump target continues at the next instruction that survives.
+//
+// Folding and fusing never look across a jump target, so a pair is only
+// rewritten when nothing can jump between its two halves. Like the real
+// pair, folded code reports the same stack errors, except that a push into a
+// completely full stack may overflow one instruction later or not at all.
+
+typedef struct {
+    Instr* code;
+    int count;
+    char* removed;
+    char* target;
+} Optimizer;
+
+static int is_jump(unsigned char op) {
+    return op == OP_BIZ || op == OP_BINZ || op == OP_JMP || op == OP_DUP_BIZ || op == OP_DUP_BINZ;
+}
+
+// First surviving instruction at or after index
+static int live_from(const Optimizer* o, int index) {
+    while (index < o->count && o->removed[index]) index++;
+    return index;
+}
+
+static int next_live(const Optimizer* o, int index) {
+    return live_from(o, index + 1);
+}
+
+static void find_targets(Optimizer* o) {
+    memset(o->target, 0, o->count);
+    for (int i = 0; i < o->count; i++) {
+        if (!o->removed[i] && is_jump(o->code[i].op)) {
+            int t = live_from(o, o->code[i].operand);
+            if (t < o->count) o->target[t] = 1;
+        }
+    }
+}
+
+// Point jumps at the final destination of a chain of jmps
+static int thread_jumps(Optimizer* o, OptimizeStats* stats) {
+    int changed = 0;
+
+    for (int i = 0; i < o->count; i++) {
+        Instr* instr = &o->code[i];
+        if (o->removed[i] || !is_jump(instr->op)) continue;
+
+        int t = live_from(o, instr->operand);
+        for (int hops = 0; t < o->count && o->code[t].op == OP_JMP && hops < o->count; hops++) {
+            t = live_from(o, o->code[t].operand);
+        }
+        if (t != instr->operand) {
+            instr->operand = t;
+            stats->threaded++;
+            changed = 1;
+        }
+
+        if (instr->op == OP_JMP && t < o->count && o->code[t].op == OP_END) {
+            instr->op = OP_END;
+            instr->operand = 0;
+            stats->threaded++;
+            changed = 1;
+        } else if (instr->op == OP_JMP && t == next_live(o, i)) {
+            o->removed[i] = 1;
+            stats->threaded++;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+static int fold_constants(Optimizer* o, OptimizeStats* stats) {
+    int changed = 0;
+
+    for (int i = 0; i < o->count; i++) {
+        if (o->removed[i] || o->code[i].op != OP_PUSH) continue;
+
+        int j = next_live(o, i);
+        if (j >= o->count || o->target[j]) continue;
+
+        if (o->code[j].op == OP_POP) {
+            // push k / pop leaves the stack as it was
+            o->removed[i] = 1;
+            o->removed[j] = 1;
+            stats->folded++;
+            changed = 1;
+            continue;
+        }
+        if (o->code[j].op != OP_PUSH) continue;
+
+        int k = next_live(o, j);
+        if (k >= o->count || o->target[k]) continue;
+
+        int a = o->code[i].operand;
+        int b = o->code[j].operand;
+        if (o->code[k].op == OP_ADD) {
+            o->code[i].operand = a + b;
+        } else if (o->code[k].op == OP_SUB) {
+            o->code[i].operand = b - a;     // top minus the value below it
+        } else {
+            continue;
+        }
+        o->removed[j] = 1;
+        o->removed[k] = 1;
+        stats->folded++;
+        changed = 1;
+    }
+    return changed;
+}
+
+static int remove_unreachable(Optimizer* o, OptimizeStats* stats) {
+    char* reached = (char*)kzalloc(o->count);
+    int* work = (int*)kmalloc(o->count * sizeof(int));
+    int changed = 0;
+    if (!reached || !work) {
+        kfree(reached);
+        kfree(work);
+        return 0;
+    }
+
+    int pending = 0;
+    int start = live_from(o, 0);
+    if (start < o->count) {
+        reached[start] = 1;
+        work[pending++] = start;
+    }
+
+    while (pending) {
+        int i = work[--pending];
+        unsigned char op = o->code[i].op;
+        int successors[2];
+        int n = 0;
+
+        if (op != OP_JMP && op != OP_END) successors[n++] = next_live(o, i);
+        if (is_jump(op)) successors[n++] = live_from(o, o->code[i].operand);
+
+        for (int s = 0; s < n; s++) {
+            int next = successors[s];
+            if (next < o->count && !reached[next]) {
+                reached[next] = 1;
+                work[pending++] = next;
+            }
+        }
+    }
+
+    for (int i = 0; i < o->count; i++) {
+        if (!o->removed[i] && !reached[i]) {
+            o->removed[i] = 1;
+            stats->dead++;
+            changed = 1;
+        }
+    }
+
+    kfree(reached);
+    kfree(work);
+    return changed;
+}
+
+static void fuse_pairs(Optimizer* o, OptimizeStats* stats) {
+    for (int i = 0; i < o->count; i++) {
+        if (o->removed[i]) continue;
+
+        int j = next_live(o, i);
+        if (j >= o->count || o->target[j]) continue;
+
+        Instr* first = &o->code[i];
+        Instr* second = &o->code[j];
+        unsigned char fused;
+
+        if (first->op == OP_PUSH && second->op == OP_ADD) fused = OP_ADDI;
+        else if (first->op == OP_PUSH && second->op == OP_SUB) fused = OP_SUBI;
+        else if (first->op == OP_DUP && second->op == OP_BIZ) fused = OP_DUP_BIZ;
+        else if (first->op == OP_DUP && second->op == OP_BINZ) fused = OP_DUP_BINZ;
+        else continue;
+
+        if (first->op == OP_DUP) first->operand = second->operand;
+        first->op = fused;
+        o->removed[j] = 1;
+        stats->fused++;
+    }
+}
+
+// Drop removed instructions and renumber jump targets
+static void compact(Optimizer* o, Bytecode* bytecode) {
+    int* new_index = (int*)o->target;   // reused: at least count ints were allocated
+    int next = 0;
+
+    for (int i = 0; i < o->count; i++) {
+        new_index[i] = next;
+        if (!o->removed[i]) next++;
+    }
+
+    for (int i = 0; i < o->count; i++) {
+        if (o->removed[i]) continue;
+        Instr instr = o->code[i];
+        if (is_jump(instr.op)) instr.operand = new_index[instr.operand];
+        o->code[new_index[i]] = instr;
+    }
+    bytecode->count = next;
+}
+
+// Returns 0 if there was no memory to work with; the code is then unchanged
+int optimize_bytecode(Bytecode* bytecode, OptimizeStats* stats) {
+    memset(stats, 0, sizeof(OptimizeStats));
+    stats->before = bytecode->count;
+    stats->after = bytecode->count;
+
+    Optimizer o;
+    o.code = bytecode->code;
+    o.count = bytecode->count;
+    o.removed = (char*)kzalloc(o.count);
+    o.target = (char*)kmalloc(o.count * sizeof(int));
+    if (!o.removed || !o.target) {
+        kfree(o.removed);
+        kfree(o.target);
+        return 0;
+    }
+
+    int changed = 1;
+    while (changed) {
+        find_targets(&o);
+        changed = thread_jumps(&o, stats);
+        find_targets(&o);
+        changed |= fold_constants(&o, stats);
+        changed |= remove_unreachable(&o, stats);
+    }
+    find_targets(&o);
+    fuse_pairs(&o, stats);
+    compact(&o, bytecode);
+
+    kfree(o.removed);
+    kfree(o.target);
+    stats->after = bytecode->count;
+    return 1;
+}
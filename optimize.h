@@ -0,0 +1,17 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "bytecode.h"
+
+typedef struct {
+    int before;         // instructions coming out of the compiler
+    int after;
+    int folded;         // constant pushes combined
+    int threaded;       // jumps retargeted past other jumps
+    int dead;           // unreachable instructions dropped
+    int fused;          // pairs turned into superinstructions
+} OptimizeStats;
+
+int optimize_bytecode(Bytecode* bytecode, OptimizeStats* stats);
+
+#endif
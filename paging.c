@@ -0,0 +1,214 @@
+#include "paging.h"
+#include "heap.h"
+#include "spinlock.h"
+#include "thread.h"
+#include "util.h"
+
+// Two-level i386 paging. Everything below USER_BASE and from USER_TOP up
+// (RAM, VGA, the local APIC, ACPI and PCI holes) is identity mapped with
+// 4 MB pages, so the kernel part of every page directory is the same set
+// of entries and a new address space costs one page copy. User pages come
+// from a pool of 4 KB frames set aside from the heap at boot and are only
+// mapped when a program first touches them.
+
+#define PTE_PRESENT   0x001
+#define PTE_WRITABLE  0x002
+#define PTE_USER      0x004
+#define PTE_NO_CACHE  0x010
+#define PTE_LARGE     0x080             // 4 MB page in a directory entry
+
+#define PF_PRESENT    0x1               // error code: protection violation
+
+#define CR0_WP        0x00010000
+#define CR0_PG        0x80000000
+#define CR4_PSE       0x00000010
+#define CPUID_PSE     (1 << 3)
+
+#define LARGE_PAGE    0x400000
+#define USER_FIRST_PDE (USER_BASE / LARGE_PAGE)
+#define USER_LAST_PDE  (USER_TOP / LARGE_PAGE)
+#define MMIO_BASE      0xC0000000       // uncached from here up
+
+#define PAGE_POOL_MAX  (16 * 1024 * 1024)
+
+int paging_enabled = 0;
+
+static unsigned int kernel_directory[1024] __attribute__((aligned(PAGE_SIZE)));
+
+static Spinlock pool_lock;
+static unsigned int* free_frames = 0;  // each free frame holds the next one
+static unsigned int free_count = 0;
+
+static void free_frame(void* frame) {
+    unsigned int flags = spin_lock_irqsave(&pool_lock);
+    *(unsigned int**)frame = free_frames;
+    free_frames = (unsigned int*)frame;
+    free_count++;
+    spin_unlock_irqrestore(&pool_lock, flags);
+}
+
+static void* allocate_frame() {
+    unsigned int flags = spin_lock_irqsave(&pool_lock);
+    unsigned int* frame = free_frames;
+    if (frame) {
+        free_frames = *(unsigned int**)frame;
+        free_count--;
+    }
+    spin_unlock_irqrestore(&pool_lock, flags);
+    if (frame) memset(frame, 0, PAGE_SIZE);
+    return frame;
+}
+
+unsigned int paging_free_pages() {
+    return free_count;
+}
+
+// Builds the kernel mappings and the frame pool; paging_enable() turns
+// them on per CPU. Needs 4 MB pages (PSE), which every CPU since the
+// Pentium has; without it paging stays off and no programs can be loaded.
+void paging_init() {
+    unsigned int regs[4];
+    cpuid(1, regs);
+    if (!(regs[3] & CPUID_PSE)) return;
+
+    unsigned int pool_size = heap_total_bytes / 4;
+    if (pool_size > PAGE_POOL_MAX) pool_size = PAGE_POOL_MAX;
+    unsigned char* pool = (unsigned char*)kmalloc(pool_size + PAGE_SIZE);
+    if (!pool) return;
+    unsigned int first = ((unsigned int)pool + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    for (unsigned int frame = first; frame + PAGE_SIZE <= (unsigned int)pool + pool_size + PAGE_SIZE; frame += PAGE_SIZE) {
+        free_frame((void*)frame);
+    }
+
+    for (unsigned int i = 0; i < 1024; i++) {
+        if (i >= USER_FIRST_PDE && i < USER_LAST_PDE) continue;
+        unsigned int flags = PTE_PRESENT | PTE_WRITABLE | PTE_LARGE;
+        if (i * LARGE_PAGE >= MMIO_BASE) flags |= PTE_NO_CACHE;
+        kernel_directory[i] = i * LARGE_PAGE | flags;
+    }
+    paging_enabled = 1;
+}
+
+// Called on every CPU once paging_init has run
+void paging_enable() {
+    if (!paging_enabled) return;
+    unsigned int cr4, cr0;
+    __asm__ __volatile__ ("movl %%cr4, %0" : "=r"(cr4));
+    __asm__ __volatile__ ("movl %0, %%cr4" :: "r"(cr4 | CR4_PSE));
+    __asm__ __volatile__ ("movl %0, %%cr3" :: "r"(kernel_directory) : "memory");
+    __asm__ __volatile__ ("movl %%cr0, %0" : "=r"(cr0));
+    __asm__ __volatile__ ("movl %0, %%cr0" :: "r"(cr0 | CR0_PG | CR0_WP) : "memory");
+}
+
+// Load the page directory a thread runs with (0: the kernel's). Kernel
+// threads could run in any directory, but a program's is freed when it
+// exits and must not stay loaded anywhere.
+void paging_switch(AddressSpace* space) {
+    if (!paging_enabled) return;
+    unsigned int wanted = space ? (unsigned int)space->directory : (unsigned int)kernel_directory;
+    unsigned int loaded;
+    __asm__ __volatile__ ("movl %%cr3, %0" : "=r"(loaded));
+    if (loaded != wanted) __asm__ __volatile__ ("movl %0, %%cr3" :: "r"(wanted) : "memory");
+}
+
+// kernel_user: the kernel mappings are reachable from ring 3 too, for
+// test code that is part of the kernel image (benchmark syscall)
+AddressSpace* address_space_create(TextFile* image, int kernel_user) {
+    if (!paging_enabled) return 0;
+    AddressSpace* space = (AddressSpace*)kzalloc(sizeof(AddressSpace));
+    if (!space) return 0;
+    space->directory = (unsigned int*)allocate_frame();
+    if (!space->directory) {
+        kfree(space);
+        return 0;
+    }
+    memcpy(space->directory, kernel_directory, PAGE_SIZE);
+    if (kernel_user) {
+        for (int i = 0; i < 1024; i++) {
+            if (space->directory[i]) space->directory[i] |= PTE_USER;
+        }
+    }
+    space->image = image;
+    return space;
+}
+
+// Nothing is mapped here: the pages appear as they are touched
+int address_space_map(AddressSpace* space, unsigned int start, unsigned int end,
+                      unsigned int offset, unsigned int size, int writable) {
+    if (space->region_count == MAX_REGIONS) return 0;
+    if (start < USER_BASE || end > USER_TOP || start >= end || size > end - start) return 0;
+    MemoryRegion* region = &space->regions[space->region_count++];
+    region->start = start;
+    region->end = end;
+    region->offset = offset;
+    region->size = size;
+    region->writable = writable;
+    return 1;
+}
+
+void address_space_destroy(AddressSpace* space) {
+    if (!space) return;
+    for (int i = USER_FIRST_PDE; i < USER_LAST_PDE; i++) {
+        if (!(space->directory[i] & PTE_PRESENT)) continue;
+        unsigned int* table = (unsigned int*)(space->directory[i] & ~(PAGE_SIZE - 1));
+        for (int j = 0; j < 1024; j++) {
+            if (table[j] & PTE_PRESENT) free_frame((void*)(table[j] & ~(PAGE_SIZE - 1)));
+        }
+        free_frame(table);
+    }
+    free_frame(space->directory);
+    kfree(space);
+}
+
+// Copy the part of the image a region contributes to this page
+static void fill_page(AddressSpace* space, MemoryRegion* region, unsigned int page, unsigned char* frame) {
+    unsigned int from = region->start > page ? region->start : page;
+    unsigned int to = region->start + region->size;
+    if (to > page + PAGE_SIZE) to = page + PAGE_SIZE;
+    if (from >= to) return;
+
+    unsigned int offset = region->offset + (from - region->start);
+    unsigned int image_size = space->image ? space->image->size : 0;
+    if (offset >= image_size) return;
+    if (to - from > image_size - offset) to = from + (image_size - offset);
+    memcpy(frame + (from - page), space->image->data + offset, to - from);
+}
+
+// 1: the page is mapped now, -1: a bad access by the program (or by a
+// system call on its behalf), 0: not a user page at all
+int paging_handle_fault(InterruptFrame* frame) {
+    unsigned int address;
+    __asm__ __volatile__ ("movl %%cr2, %0" : "=r"(address));
+    AddressSpace* space = current_thread->address_space;
+    if (!space || address < USER_BASE || address >= USER_TOP) return 0;
+    if (frame->error & PF_PRESENT) return -1;
+
+    unsigned int page = address & ~(PAGE_SIZE - 1);
+    int found = 0;
+    int writable = 0;
+    for (int i = 0; i < space->region_count; i++) {
+        MemoryRegion* region = &space->regions[i];
+        if (region->start < page + PAGE_SIZE && region->end > page) {
+            found = 1;
+            writable |= region->writable;
+        }
+    }
+    if (!found) return -1;
+
+    unsigned int* entry = &space->directory[page / LARGE_PAGE];
+    if (!(*entry & PTE_PRESENT)) {
+        void* table = allocate_frame();
+        if (!table) return -1;
+        *entry = (unsigned int)table | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
+    }
+    unsigned char* data = (unsigned char*)allocate_frame();
+    if (!data) return -1;
+
+    // Segments that share a page (unaligned ELF layouts) each add their part
+    for (int i = 0; i < space->region_count; i++) fill_page(space, &space->regions[i], page, data);
+
+    unsigned int* table = (unsigned int*)(*entry & ~(PAGE_SIZE - 1));
+    table[(page / PAGE_SIZE) & 1023] = (unsigned int)data | PTE_PRESENT | PTE_USER | (writable ? PTE_WRITABLE : 0);
+    space->pages++;
+    return 1;
+}
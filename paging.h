@@ -0,0 +1,45 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include "fs.h"
+#include "interrupts.h"
+
+// The kernel keeps an identity mapping of everything outside the user
+// window; programs get the window to themselves, filled in on page faults.
+
+#define PAGE_SIZE        4096
+#define USER_BASE        0x40000000
+#define USER_TOP         0xC0000000
+#define USER_STACK_SIZE  (1024 * 1024)
+#define MAX_REGIONS      8
+
+// Part of the user window backed by bytes of the program image (or zeros
+// past 'size')
+typedef struct {
+    unsigned int start, end;
+    unsigned int offset, size;
+    int writable;
+} MemoryRegion;
+
+typedef struct AddressSpace {
+    unsigned int* directory;
+    TextFile* image;                // read at fault time, never copied up front
+    MemoryRegion regions[MAX_REGIONS];
+    int region_count;
+    unsigned int pages;             // pages faulted in so far
+} AddressSpace;
+
+extern int paging_enabled;
+
+void paging_init();
+void paging_enable();
+void paging_switch(AddressSpace* space);
+int paging_handle_fault(InterruptFrame* frame);
+unsigned int paging_free_pages();
+
+AddressSpace* address_space_create(TextFile* image, int kernel_user);
+int address_space_map(AddressSpace* space, unsigned int start, unsigned int end,
+                      unsigned int offset, unsigned int size, int writable);
+void address_space_destroy(AddressSpace* space);
+
+#endif
@@ -0,0 +1,258 @@
+#include "pipe.h"
+#include "heap.h"
+
+// Command output normally starts with "\n" to get off the prompt line.
+// Pipes and files drop that first line break so captured text starts clean.
+
+static void pipe_sink_write(OutputSink* sink, const char* str) {
+    Pipe* pipe = (Pipe*)sink;
+    pipe_write(pipe, str, string_length(str));
+}
+
+void pipe_init(Pipe* pipe, void (*consume)(Pipe* pipe, const char* line), void* context) {
+    pipe->sink.write = pipe_sink_write;
+    pipe->length = 0;
+    pipe->cutting = 0;
+    pipe->truncated = 0;
+    pipe->at_start = 1;
+    pipe->consume = consume;
+    pipe->context = context;
+}
+
+// Hand the buffered line to the consumer, terminated in place instead of
+// copied out, and start the next one at the front
+static void pipe_deliver(Pipe* pipe) {
+    pipe->data[pipe->length] = 0;
+    pipe->length = 0;
+    pipe->cutting = 0;
+    pipe->consume(pipe, pipe->data);
+}
+
+void pipe_write(Pipe* pipe, const char* data, unsigned int length) {
+    for (unsigned int i = 0; i < length; i++) {
+        char c = data[i];
+        if (pipe->at_start) {
+            pipe->at_start = 0;
+            if (c == '\n') continue;
+        }
+
+        if (c == '\n') {
+            pipe_deliver(pipe);
+            continue;
+        }
+        // Keep one slot free for the terminator
+        if (pipe->length == PIPE_SIZE - 1) {
+            if (!pipe->cutting) pipe->truncated++;
+            pipe->cutting = 1;
+            continue;
+        }
+        pipe->data[pipe->length++] = c;
+    }
+}
+
+void pipe_close(Pipe* pipe) {
+    if (pipe->length) pipe_deliver(pipe);
+    pipe->consume(pipe, 0);
+}
+
+// --- Pipelines ---------------------------------------------------------------
+
+typedef struct {
+    OutputSink sink;
+    TextFile* file;
+    int at_start;
+} FileSink;
+
+static void file_sink_write(OutputSink* sink, const char* str) {
+    FileSink* file_sink = (FileSink*)sink;
+    if (file_sink->at_start) {
+        file_sink->at_start = 0;
+        if (*str == '\n') str++;
+    }
+    file_append(file_sink->file, str, string_length(str));
+}
+
+// Files store newline terminated lines
+static void end_with_newline(TextFile* file) {
+    if (file->size && file->data[file->size - 1] != '\n') file_append(file, "\n", 1);
+}
+
+int is_pipeline(const char* line) {
+    for (; *line; line++) {
+        if (*line == '|' || *line == '>') return 1;
+    }
+    return 0;
+}
+
+static void report(int quiet, const char* message, const char* detail) {
+    if (quiet) return;
+    command_error(message);
+    print_string(detail);
+}
+
+// Parse one "name args" segment [start, end) into a stage
+static int parse_stage(const char* start, const char* end, Stage* stage, int first, int quiet) {
+    char name[STAGE_ARGS];
+    int length = 0;
+
+    while (start < end && *start == ' ') start++;
+    while (end > start && end[-1] == ' ') end--;
+    while (start < end && *start != ' ' && length < STAGE_ARGS - 1) name[length++] = *start++;
+    name[length] = 0;
+    while (start < end && *start == ' ') start++;
+
+    if (!name[0]) {
+        report(quiet, "\nMissing command in pipeline", "");
+        return 0;
+    }
+
+    stage->command = find_command(name);
+    if (!stage->command) {
+        report(quiet, "\nUnknown command: ", name);
+        return 0;
+    }
+
+    length = 0;
+    while (start < end && length < STAGE_ARGS - 1) stage->args[length++] = *start++;
+    stage->args[length] = 0;
+
+    // Stages fed by a pipe get their input from there instead of arguments
+    int piped = !first && stage->command->filter;
+    if (!piped && count_arguments(stage->args) < stage->command->min_args) {
+        if (!quiet) {
+            print_command_usage(stage->command);
+            command_errors++;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+int parse_pipeline(const char* line, Pipeline* pipeline, int quiet) {
+    pipeline->stage_count = 0;
+    pipeline->redirect = REDIRECT_NONE;
+    pipeline->target[0] = 0;
+
+    const char* start = line;
+    const char* p = line;
+    while (1) {
+        if (*p == '|' || *p == '>' || *p == 0) {
+            if (pipeline->stage_count == MAX_STAGES) {
+                report(quiet, "\nToo many pipeline stages", "");
+                return 0;
+            }
+            Stage* stage = &pipeline->stages[pipeline->stage_count];
+            if (!parse_stage(start, p, stage, pipeline->stage_count == 0, quiet)) return 0;
+            pipeline->stage_count++;
+        }
+
+        if (*p == '|') {
+            start = ++p;
+            continue;
+        }
+        if (*p == '>') break;
+        if (*p == 0) return 1;
+        p++;
+    }
+
+    // Redirection target: "> file" or ">> file"
+    p++;
+    pipeline->redirect = REDIRECT_WRITE;
+    if (*p == '>') {
+        pipeline->redirect = REDIRECT_APPEND;
+        p++;
+    }
+    while (*p == ' ') p++;
+
+    int length = 0;
+    while (*p && *p != ' ' && length < MAX_FILENAME - 1) pipeline->target[length++] = *p++;
+    pipeline->target[length] = 0;
+    while (*p == ' ') p++;
+
+    if (!length || *p) {
+        report(quiet, "\nUsage: <command> > <file>", "");
+        return 0;
+    }
+    return 1;
+}
+
+// Runs stage N+1 for every line stage N produced
+static void stage_consume(Pipe* pipe, const char* line) {
+    Stage* stage = (Stage*)pipe->context;
+    OutputSink* saved = output_sink;
+    set_output_sink(stage->output);
+
+    if (stage->command->filter) {
+        stage->command->filter(stage->args, line, stage->state);
+    } else if (!line) {
+        // Not a filter: ignore the input and run once it has ended
+        stage->command->handler(stage->args);
+    }
+
+    set_output_sink(saved);
+}
+
+void run_pipeline(Pipeline* pipeline) {
+    int pipes_needed = pipeline->stage_count - 1;
+    Pipe* pipes = 0;
+    if (pipes_needed > 0) {
+        pipes = (Pipe*)kmalloc(pipes_needed * sizeof(Pipe));
+        if (!pipes) {
+            print_string("\nOut of memory.");
+            return;
+        }
+    }
+
+    FileSink file_sink;
+    OutputSink* final_output = output_sink;
+    if (pipeline->redirect != REDIRECT_NONE) {
+        TextFile* file = create_file(pipeline->target);
+        if (!file) {
+            print_string("\nNo space for new file.");
+            kfree(pipes);
+            return;
+        }
+        if (pipeline->redirect == REDIRECT_WRITE) file_write(file, "", 0);
+        else end_with_newline(file);
+        file_sink.sink.write = file_sink_write;
+        file_sink.file = file;
+        file_sink.at_start = 1;
+        final_output = &file_sink.sink;
+    }
+
+    for (int i = 0; i < pipeline->stage_count; i++) {
+        Stage* stage = &pipeline->stages[i];
+        for (int j = 0; j < 4; j++) stage->state[j] = 0;
+        if (i + 1 < pipeline->stage_count) {
+            pipe_init(&pipes[i], stage_consume, &pipeline->stages[i + 1]);
+            stage->output = &pipes[i].sink;
+        } else {
+            stage->output = final_output;
+        }
+    }
+
+    OutputSink* saved = output_sink;
+    set_output_sink(pipeline->stages[0].output);
+    dispatch_command(pipeline->stages[0].command, pipeline->stages[0].args);
+    set_output_sink(saved);
+
+    // Closing pipe N flushes into stage N+1, which may still write into pipe N+1
+    for (int i = 0; i < pipes_needed; i++) pipe_close(&pipes[i]);
+
+    for (int i = 0; i < pipes_needed; i++) {
+        if (!pipes[i].truncated) continue;
+        char buffer[12];
+        command_error("\nLines cut after ");
+        print_string(pipeline->stages[i].command->name);
+        print_string(": ");
+        int_to_string(pipes[i].truncated, buffer);
+        print_string(buffer);
+        print_string(" longer than ");
+        int_to_string(PIPE_SIZE - 1, buffer);
+        print_string(buffer);
+        print_string(" characters");
+    }
+
+    if (pipeline->redirect != REDIRECT_NONE) end_with_newline(file_sink.file);
+    kfree(pipes);
+}
@@ -0,0 +1,53 @@
+#ifndef PIPE_H
+#define PIPE_H
+
+#include "util.h"
+#include "command.h"
+#include "fs.h"
+
+#define PIPE_SIZE 4096      // longest line a pipe passes on, plus its terminator
+#define MAX_STAGES 4
+#define STAGE_ARGS 64
+
+// Line buffer between two pipeline stages. The producer prints into it
+// through 'sink'; every completed line is handed to 'consume' in place, so
+// nothing is buffered beyond the current line. A line longer than
+// PIPE_SIZE - 1 characters is cut there, not split, and counted.
+typedef struct Pipe {
+    OutputSink sink;
+    char data[PIPE_SIZE];
+    unsigned int length;        // characters of the current line
+    int cutting;                // dropping the rest of the current line
+    unsigned int truncated;     // lines cut so far
+    int at_start;
+    void (*consume)(struct Pipe* pipe, const char* line);   // line == 0: end of input
+    void* context;
+} Pipe;
+
+void pipe_init(Pipe* pipe, void (*consume)(Pipe* pipe, const char* line), void* context);
+void pipe_write(Pipe* pipe, const char* data, unsigned int length);
+void pipe_close(Pipe* pipe);
+
+#define REDIRECT_NONE   0
+#define REDIRECT_WRITE  1   // >
+#define REDIRECT_APPEND 2   // >>
+
+typedef struct {
+    const Command* command;
+    char args[STAGE_ARGS];
+    int state[4];
+    OutputSink* output;
+} Stage;
+
+typedef struct {
+    int stage_count;
+    Stage stages[MAX_STAGES];
+    int redirect;
+    char target[MAX_FILENAME];
+} Pipeline;
+
+int is_pipeline(const char* line);
+int parse_pipeline(const char* line, Pipeline* pipeline, int quiet);
+void run_pipeline(Pipeline* pipeline);
+
+#endif
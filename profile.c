@@ -0,0 +1,115 @@
+#include "profile.h"
+#include "heap.h"
+#include "symbols.h"
+#include "util.h"
+
+// One counter per kernel function plus a few catch-all buckets. Samples
+// are counted straight into the histogram from the timer interrupt, so a
+// profile can run for any length of time in fixed memory.
+
+#define BUCKET_USER    0        // ring 3 programs
+#define BUCKET_UNKNOWN 1        // no symbol (assembly stubs, no symbol table)
+#define EXTRA_BUCKETS  2
+#define REPORT_TOP     15
+
+static volatile int profiling = 0;
+static unsigned int* counts = 0;        // EXTRA_BUCKETS, then one per symbol
+static int bucket_count = 0;
+static unsigned int total_samples = 0;
+
+static inline void atomic_increment(unsigned int* counter) {
+    __asm__ __volatile__ ("lock incl %0" : "+m"(*counter) :: "memory");
+}
+
+// Called from the timer interrupt handlers (PIT and local APIC)
+void profile_sample(InterruptFrame* frame) {
+    if (!profiling) return;
+
+    int bucket = BUCKET_UNKNOWN;
+    if (frame->cs & 3) {
+        bucket = BUCKET_USER;
+    } else {
+        int symbol = symbol_find(frame->eip);
+        if (symbol >= 0) bucket = EXTRA_BUCKETS + symbol;
+    }
+    atomic_increment(&counts[bucket]);
+    atomic_increment(&total_samples);
+}
+
+// Clears the previous profile; returns 0 when out of memory. The
+// histogram is allocated once and never freed: another CPU may still be
+// inside profile_sample when profiling is switched off.
+int profile_start() {
+    profiling = 0;
+    if (!counts) {
+        int buckets = EXTRA_BUCKETS + symbol_count();
+        counts = (unsigned int*)kmalloc(buckets * sizeof(unsigned int));
+        if (!counts) return 0;
+        bucket_count = buckets;
+    }
+    memset(counts, 0, bucket_count * sizeof(unsigned int));
+    total_samples = 0;
+    profiling = 1;
+    return 1;
+}
+
+void profile_stop() {
+    profiling = 0;
+}
+
+static const char* bucket_name(int bucket) {
+    if (bucket == BUCKET_USER) return "[user programs]";
+    if (bucket == BUCKET_UNKNOWN) return "[unknown]";
+    return symbol_name(bucket - EXTRA_BUCKETS);
+}
+
+// The busiest functions, by share of all samples taken so far
+void profile_report() {
+    char buffer[16];
+    if (!counts || !total_samples) {
+        print_string("\nNo samples. Use 'profile start' first.");
+        return;
+    }
+    if (!symbol_count()) print_string("\n(no kernel symbols from the boot loader)");
+
+    print_string("\nSAMPLES  SHARE   FUNCTION");
+    unsigned int total = total_samples;
+
+    // Pick the top entries by repeated scans; the histogram is left intact
+    // so the report can be repeated while sampling continues
+    unsigned int previous = 0xFFFFFFFF;
+    int previous_bucket = -1;
+    for (int shown = 0; shown < REPORT_TOP; shown++) {
+        int best = -1;
+        for (int i = 0; i < bucket_count; i++) {
+            unsigned int count = counts[i];
+            if (!count || count > previous || (count == previous && i <= previous_bucket)) continue;
+            if (best < 0 || count > counts[best]) best = i;
+        }
+        if (best < 0) break;
+
+        unsigned int count = counts[best];
+        unsigned int share = (unsigned int)u64_div((unsigned long long)count * 1000, total);
+        print_string("\n");
+        int_to_string(count, buffer);
+        print_string(buffer);
+        for (int pad = string_length(buffer); pad < 9; pad++) print_string(" ");
+        int_to_string(share / 10, buffer);
+        int length = string_length(buffer);
+        buffer[length++] = '.';
+        buffer[length++] = '0' + share % 10;
+        buffer[length++] = '%';
+        buffer[length] = 0;
+        print_string(buffer);
+        for (int pad = length; pad < 8; pad++) print_string(" ");
+        print_string(bucket_name(best));
+
+        previous = count;
+        previous_bucket = best;
+    }
+
+    print_string("\nTotal: ");
+    int_to_string(total, buffer);
+    print_string(buffer);
+    print_string(profiling ? " samples (still sampling)" : " samples");
+}
@@ -0,0 +1,14 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "interrupts.h"
+
+// Sampling profiler: the timer interrupts on every CPU record where they
+// interrupted the kernel
+
+void profile_sample(InterruptFrame* frame);
+int profile_start();
+void profile_stop();
+void profile_report();
+
+#endif
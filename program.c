@@ -0,0 +1,229 @@
+#include "program.h"
+#include "heap.h"
+#include "util.h"
+
+// The program is a B+tree keyed by line number. Leaves hold the line text
+// (one heap string per line, any length) and are chained for listing.
+// Inner nodes keep the smallest line number below each child and the number
+// of lines in every subtree, so both "line 1200" and "the 500th line" are
+// found in O(log n).
+
+#define NODE_KEYS   32
+#define SPARE_NODES 8       // enough for a split at every level of a full tree
+
+typedef struct ProgramNode {
+    int leaf;
+    int count;
+    unsigned int lines;                         // lines in this subtree
+    int keys[NODE_KEYS + 1];                    // one spare slot before a split
+    union {
+        char* text[NODE_KEYS + 1];
+        struct ProgramNode* child[NODE_KEYS + 1];
+    };
+    struct ProgramNode* next;                   // next leaf
+} ProgramNode;
+
+static ProgramNode* root = 0;
+
+// Nodes for splits are set aside before an insert starts, so running out
+// of memory can never leave a half-split tree behind
+static ProgramNode* spare[SPARE_NODES];
+static int spare_count = 0;
+
+static int reserve_nodes() {
+    while (spare_count < SPARE_NODES) {
+        ProgramNode* node = (ProgramNode*)kmalloc(sizeof(ProgramNode));
+        if (!node) return 0;
+        spare[spare_count++] = node;
+    }
+    return 1;
+}
+
+static ProgramNode* new_node(int leaf) {
+    ProgramNode* node = spare[--spare_count];
+    memset(node, 0, sizeof(ProgramNode));
+    node->leaf = leaf;
+    return node;
+}
+
+static void free_node(ProgramNode* node) {
+    for (int i = 0; i < node->count; i++) {
+        if (node->leaf) kfree(node->text[i]);
+        else free_node(node->child[i]);
+    }
+    kfree(node);
+}
+
+void program_clear() {
+    if (root) free_node(root);
+    root = 0;
+}
+
+int program_line_count() {
+    return root ? (int)root->lines : 0;
+}
+
+// Index of the last key <= number, or -1 if every key is larger
+static int node_slot(const ProgramNode* node, int number) {
+    int low = 0;
+    int high = node->count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (node->keys[mid] <= number) low = mid + 1;
+        else high = mid - 1;
+    }
+    return high;
+}
+
+static void count_lines(ProgramNode* node) {
+    if (node->leaf) {
+        node->lines = node->count;
+        return;
+    }
+    node->lines = 0;
+    for (int i = 0; i < node->count; i++) node->lines += node->child[i]->lines;
+}
+
+// Move the upper half of an overfull node into a new right sibling
+static ProgramNode* split_node(ProgramNode* node) {
+    ProgramNode* right = new_node(node->leaf);
+    int keep = node->count / 2;
+    right->count = node->count - keep;
+    memcpy(right->keys, node->keys + keep, right->count * sizeof(int));
+    memcpy(right->child, node->child + keep, right->count * sizeof(void*));
+    node->count = keep;
+
+    if (node->leaf) {
+        right->next = node->next;
+        node->next = right;
+    }
+    count_lines(node);
+    count_lines(right);
+    return right;
+}
+
+static void insert_slot(ProgramNode* node, int slot, int key, void* value) {
+    memmove(node->keys + slot + 1, node->keys + slot, (node->count - slot) * sizeof(int));
+    memmove(node->child + slot + 1, node->child + slot, (node->count - slot) * sizeof(void*));
+    node->keys[slot] = key;
+    node->child[slot] = (ProgramNode*)value;
+    node->count++;
+}
+
+// Returns a new right sibling if the node split, sets *result
+static ProgramNode* insert_line(ProgramNode* node, int number, char* text, int* result) {
+    int slot = node_slot(node, number);
+
+    if (node->leaf) {
+        if (slot >= 0 && node->keys[slot] == number) {
+            kfree(node->text[slot]);
+            node->text[slot] = text;
+            *result = LINE_REPLACED;
+            return 0;
+        }
+        insert_slot(node, slot + 1, number, text);
+        node->lines++;
+        *result = LINE_ADDED;
+    } else {
+        if (slot < 0) slot = 0;
+        ProgramNode* child = node->child[slot];
+        ProgramNode* sibling = insert_line(child, number, text, result);
+        node->keys[slot] = child->keys[0];
+        if (*result == LINE_ADDED) node->lines++;
+        if (sibling) insert_slot(node, slot + 1, sibling->keys[0], sibling);
+    }
+
+    return node->count > NODE_KEYS ? split_node(node) : 0;
+}
+
+// Returns LINE_ADDED, LINE_REPLACED or 0 when out of memory or full
+int program_set_line(int number, const char* text) {
+    if (program_line_count() >= MAX_PROGRAM_LINES && program_find_line(number) < 0) return 0;
+
+    if (!reserve_nodes()) return 0;
+    char* copy = (char*)kmalloc(string_length(text) + 1);
+    if (!copy) return 0;
+    copy_string(copy, text);
+
+    if (!root) root = new_node(1);
+
+    int result = 0;
+    ProgramNode* sibling = insert_line(root, number, copy, &result);
+    if (sibling) {
+        ProgramNode* top = new_node(0);
+        insert_slot(top, 0, root->keys[0], root);
+        insert_slot(top, 1, sibling->keys[0], sibling);
+        count_lines(top);
+        root = top;
+    }
+    return result;
+}
+
+// Index of the line with this number, or -1
+int program_find_line(int number) {
+    ProgramNode* node = root;
+    int index = 0;
+    if (!node) return -1;
+
+    while (!node->leaf) {
+        int slot = node_slot(node, number);
+        if (slot < 0) return -1;
+        for (int i = 0; i < slot; i++) index += node->child[i]->lines;
+        node = node->child[slot];
+    }
+
+    int slot = node_slot(node, number);
+    if (slot < 0 || node->keys[slot] != number) return -1;
+    return index + slot;
+}
+
+static ProgramNode* leaf_at(int index, int* slot) {
+    ProgramNode* node = root;
+    while (!node->leaf) {
+        int i = 0;
+        while (index >= (int)node->child[i]->lines) {
+            index -= node->child[i]->lines;
+            i++;
+        }
+        node = node->child[i];
+    }
+    *slot = index;
+    return node;
+}
+
+int program_line_number(int index) {
+    int slot;
+    ProgramNode* leaf = leaf_at(index, &slot);
+    return leaf->keys[slot];
+}
+
+const char* program_line_text(int index) {
+    int slot;
+    ProgramNode* leaf = leaf_at(index, &slot);
+    return leaf->text[slot];
+}
+
+ProgramCursor program_begin() {
+    ProgramCursor cursor;
+    ProgramNode* node = root;
+    while (node && !node->leaf) node = node->child[0];
+    cursor.leaf = node;
+    cursor.slot = 0;
+    return cursor;
+}
+
+// Step through the lines in order; returns 0 after the last one
+int program_next(ProgramCursor* cursor, int* number, const char** text) {
+    ProgramNode* leaf = (ProgramNode*)cursor->leaf;
+    while (leaf && cursor->slot >= leaf->count) {
+        leaf = leaf->next;
+        cursor->slot = 0;
+    }
+    cursor->leaf = leaf;
+    if (!leaf) return 0;
+
+    *number = leaf->keys[cursor->slot];
+    *text = leaf->text[cursor->slot];
+    cursor->slot++;
+    return 1;
+}
@@ -0,0 +1,26 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+// EG-Basic program text, kept sorted by line number
+
+#define MAX_PROGRAM_LINES 65535     // instructions record their line in 16 bits
+
+#define LINE_ADDED    1
+#define LINE_REPLACED 2
+
+typedef struct {
+    void* leaf;
+    int slot;
+} ProgramCursor;
+
+void program_clear();
+int program_set_line(int number, const char* text);
+int program_find_line(int number);
+int program_line_count();
+int program_line_number(int index);
+const char* program_line_text(int index);
+
+ProgramCursor program_begin();
+int program_next(ProgramCursor* cursor, int* number, const char** text);
+
+#endif
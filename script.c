@@ -0,0 +1,170 @@
+#include "script.h"
+#include "heap.h"
+#include "util.h"
+
+// Scripts are split into command/argument pairs and resolved against the
+// command table once. Later runs reuse that list until the file changes.
+
+#define SCRIPT_CACHE_SIZE 8
+#define SCRIPT_TOKEN_MAX 63   // same limits as command_buffer/argument_buffer
+#define SCRIPT_LINE_MAX 127   // and input_buffer
+
+static CompiledScript cache[SCRIPT_CACHE_SIZE];
+static unsigned int cache_clock = 0;
+
+static void free_script(CompiledScript* script) {
+    for (int i = 0; i < script->count; i++) kfree(script->commands[i].pipeline);
+    kfree(script->commands);
+    kfree(script->strings);
+    script->commands = 0;
+    script->strings = 0;
+    script->count = 0;
+    script->file = 0;
+}
+
+static int is_blank_line(const char* text, unsigned int length) {
+    for (unsigned int i = 0; i < length; i++) {
+        if (text[i] != ' ' && text[i] != '\t' && text[i] != '\r') return 0;
+    }
+    return 1;
+}
+
+static int is_pipeline_text(const char* text, unsigned int length) {
+    for (unsigned int i = 0; i < length; i++) {
+        if (text[i] == '|' || text[i] == '>') return 1;
+    }
+    return 0;
+}
+
+// Append at most SCRIPT_TOKEN_MAX characters plus a NUL to the string pool
+static const char* add_token(char** pool, const char* text, unsigned int length) {
+    const char* token = *pool;
+    if (length > SCRIPT_TOKEN_MAX) length = SCRIPT_TOKEN_MAX;
+    memcpy(*pool, text, length);
+    (*pool)[length] = 0;
+    *pool += length + 1;
+    return token;
+}
+
+static int compile_script(CompiledScript* script, TextFile* file) {
+    const char* text = file->data;
+    unsigned int size = text ? file->size : 0;
+
+    int lines = 0;
+    for (unsigned int i = 0; i < size; i++) {
+        if (text[i] == '\n') lines++;
+    }
+    lines++;
+
+    script->commands = (ScriptCommand*)kmalloc(lines * sizeof(ScriptCommand));
+    script->strings = (char*)kmalloc(size + 2 * lines);
+    if (!script->commands || !script->strings) {
+        free_script(script);
+        return 0;
+    }
+
+    char* pool = script->strings;
+    int count = 0;
+    unsigned int pos = 0;
+    while (pos < size) {
+        unsigned int start = pos;
+        while (pos < size && text[pos] != '\n') pos++;
+        unsigned int length = pos - start;
+        pos++;
+        if (is_blank_line(text + start, length)) continue;
+
+        ScriptCommand* command = &script->commands[count++];
+        command->pipeline = 0;
+
+        if (is_pipeline_text(text + start, length)) {
+            // Keep the whole line; a failed parse is reported again at run time
+            if (length > SCRIPT_LINE_MAX) length = SCRIPT_LINE_MAX;
+            command->name = pool;
+            memcpy(pool, text + start, length);
+            pool[length] = 0;
+            pool += length + 1;
+            command->args = command->name;
+            command->command = 0;
+
+            command->pipeline = (Pipeline*)kmalloc(sizeof(Pipeline));
+            if (command->pipeline && !parse_pipeline(command->name, command->pipeline, 1)) {
+                kfree(command->pipeline);
+                command->pipeline = 0;
+            }
+            continue;
+        }
+
+        // Split at the first space, exactly like split_command_line()
+        unsigned int split = 0;
+        while (split < length && text[start + split] != ' ') split++;
+
+        command->name = add_token(&pool, text + start, split);
+        if (split < length) {
+            command->args = add_token(&pool, text + start + split + 1, length - split - 1);
+        } else {
+            command->args = add_token(&pool, "", 0);
+        }
+        command->command = find_command(command->name);
+    }
+
+    script->file = file;
+    script->version = file->version;
+    script->count = count;
+    return 1;
+}
+
+CompiledScript* get_compiled_script(TextFile* file, int* cache_hit) {
+    CompiledScript* slot = 0;
+    *cache_hit = 0;
+
+    for (int i = 0; i < SCRIPT_CACHE_SIZE; i++) {
+        if (cache[i].file == file) {
+            slot = &cache[i];
+            break;
+        }
+    }
+
+    if (slot && slot->version == file->version) {
+        *cache_hit = 1;
+    } else {
+        if (slot && slot->running) return slot;   // stale, but still executing below us
+
+        if (!slot) {
+            // Reuse an empty entry or evict the least recently used idle one
+            for (int i = 0; i < SCRIPT_CACHE_SIZE; i++) {
+                if (cache[i].running) continue;
+                if (!cache[i].file) {
+                    slot = &cache[i];
+                    break;
+                }
+                if (!slot || cache[i].last_used < slot->last_used) slot = &cache[i];
+            }
+            if (!slot) return 0;
+        }
+
+        free_script(slot);
+        if (!compile_script(slot, file)) return 0;
+    }
+
+    slot->last_used = ++cache_clock;
+    return slot;
+}
+
+void run_compiled_script(CompiledScript* script) {
+    script->running++;
+    for (int i = 0; i < script->count; i++) {
+        const ScriptCommand* command = &script->commands[i];
+        if (command->pipeline) {
+            run_pipeline(command->pipeline);
+        } else if (command->command) {
+            dispatch_command(command->command, command->args);
+        } else if (is_pipeline(command->name)) {
+            Pipeline pipeline;
+            parse_pipeline(command->name, &pipeline, 0);   // prints the error
+        } else if (command->name[0]) {
+            command_error("\nUnknown command: ");
+            print_string(command->name);
+        }
+    }
+    script->running--;
+}
@@ -0,0 +1,29 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include "command.h"
+#include "fs.h"
+#include "pipe.h"
+
+// One pre-tokenised script line
+typedef struct {
+    const Command* command;   // 0 when the name did not resolve
+    const char* name;
+    const char* args;
+    Pipeline* pipeline;       // set for lines using | or >
+} ScriptCommand;
+
+typedef struct {
+    TextFile* file;           // cache key
+    unsigned int version;     // file version the commands were built from
+    unsigned int last_used;
+    int running;
+    int count;
+    ScriptCommand* commands;
+    char* strings;            // names and arguments, NUL separated
+} CompiledScript;
+
+CompiledScript* get_compiled_script(TextFile* file, int* cache_hit);
+void run_compiled_script(CompiledScript* script);
+
+#endif
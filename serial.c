@@ -0,0 +1,98 @@
+#include "serial.h"
+#include "spinlock.h"
+#include "util.h"
+#include "workqueue.h"
+
+// COM1, 115200 8N1. With serial_mirror set, everything print_string() puts
+// on the screen is copied here as well (e.g. for -serial stdio in QEMU).
+// Writers only fill a ring buffer; the work queue moves it to the UART,
+// one 16 byte FIFO load per lock hold (about 1.4 ms of line time), with
+// interrupts back on while the UART drains.
+
+#define SERIAL_BUFFER 4096      // power of two
+#define UART_FIFO     16
+
+int serial_mirror = 0;
+static int serial_present = 0;
+
+static char tx_buffer[SERIAL_BUFFER];
+static unsigned int tx_head = 0;        // next write
+static unsigned int tx_tail = 0;        // next byte to send
+static Spinlock tx_lock;
+
+static int send_fifo_load();
+
+// Re-posts itself until the ring is empty, so other work runs in between
+static void serial_flush_work(WorkItem* work) {
+    if (send_fifo_load()) work_post(work);
+}
+
+static WorkItem flush_work = WORK_ITEM(serial_flush_work);
+
+void serial_init() {
+    outb(COM1_PORT + 1, 0x00);    // No interrupts
+    outb(COM1_PORT + 3, 0x80);    // DLAB on
+    outb(COM1_PORT + 0, 0x01);    // Divisor 1 = 115200 baud
+    outb(COM1_PORT + 1, 0x00);
+    outb(COM1_PORT + 3, 0x03);    // 8 bits, no parity, one stop bit
+    outb(COM1_PORT + 2, 0xC7);    // FIFO on, cleared, 14 byte threshold
+    outb(COM1_PORT + 4, 0x0B);    // DTR, RTS, OUT2
+
+    // Floating bus reads 0xFF when there is no UART
+    serial_present = inb(COM1_PORT + 5) != 0xFF;
+}
+
+void serial_putc(char c) {
+    if (!serial_present) return;
+    while (!(inb(COM1_PORT + 5) & 0x20));  // wait for empty transmit register
+    outb(COM1_PORT, c);
+}
+
+// Wait for the FIFO to empty without the lock, then refill it under the
+// lock (another CPU may have got there first). Returns 1 while bytes remain.
+static int send_fifo_load() {
+    while (!(inb(COM1_PORT + 5) & 0x20)) __asm__ __volatile__ ("pause");
+
+    unsigned int flags = spin_lock_irqsave(&tx_lock);
+    if (inb(COM1_PORT + 5) & 0x20) {
+        for (int i = 0; i < UART_FIFO && tx_tail != tx_head; i++) {
+            outb(COM1_PORT, tx_buffer[tx_tail % SERIAL_BUFFER]);
+            tx_tail++;
+        }
+    }
+    int remaining = tx_tail != tx_head;
+    spin_unlock_irqrestore(&tx_lock, flags);
+    return remaining;
+}
+
+// Called with tx_lock held and room in the ring
+static void buffer_char(char c) {
+    tx_buffer[tx_head % SERIAL_BUFFER] = c;
+    tx_head++;
+}
+
+void serial_write(const char* str) {
+    if (!serial_present) return;
+
+    unsigned int flags = spin_lock_irqsave(&tx_lock);
+    for (; *str; str++) {
+        // Full (room for "\r\n" needed): drain one FIFO load at a time,
+        // dropping the lock in between. The caller may be print_string,
+        // which keeps interrupts off under its own lock either way.
+        while (SERIAL_BUFFER - (tx_head - tx_tail) < 2) {
+            spin_unlock_irqrestore(&tx_lock, flags);
+            send_fifo_load();
+            flags = spin_lock_irqsave(&tx_lock);
+        }
+        if (*str == '\n') buffer_char('\r');
+        buffer_char(*str);
+    }
+    spin_unlock_irqrestore(&tx_lock, flags);
+    work_post(&flush_work);
+}
+
+// Send everything buffered so far and wait for it
+void serial_flush() {
+    if (!serial_present) return;
+    while (send_fifo_load());
+}
@@ -0,0 +1,13 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#define COM1_PORT 0x3F8
+
+extern int serial_mirror;
+
+void serial_init();
+void serial_putc(char c);
+void serial_write(const char* str);
+void serial_flush();
+
+#endif
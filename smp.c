@@ -0,0 +1,230 @@
+#include "smp.h"
+#include "acpi.h"
+#include "fpu.h"
+#include "heap.h"
+#include "interrupts.h"
+#include "paging.h"
+#include "profile.h"
+#include "syscall.h"
+#include "thread.h"
+#include "timer.h"
+#include "util.h"
+
+// Application processor start-up (INIT-SIPI-SIPI to every CPU in the
+// MADT) and the local APIC timer that drives their schedulers. The boot
+// CPU keeps the PIT for timekeeping and the legacy IRQs.
+
+#define LAPIC_ID          0x020
+#define LAPIC_EOI         0x0B0
+#define LAPIC_SPURIOUS    0x0F0
+#define LAPIC_ICR_LOW     0x300
+#define LAPIC_ICR_HIGH    0x310
+#define LAPIC_LVT_TIMER   0x320
+#define LAPIC_TIMER_INIT  0x380
+#define LAPIC_TIMER_COUNT 0x390
+#define LAPIC_TIMER_DIV   0x3E0
+
+#define ICR_INIT          0x00004500     // INIT, level assert
+#define ICR_STARTUP       0x00004600     // start-up IPI, vector = page number
+#define ICR_PENDING       0x00001000
+#define LVT_MASKED        0x00010000
+#define LVT_PERIODIC      0x00020000
+
+#define TRAMPOLINE_BASE   0x7000         // must match trampoline.asm
+
+extern char trampoline_start[];
+extern char trampoline_end[];
+extern char trampoline_stack[];
+extern char trampoline_entry[];
+
+Cpu cpus[MAX_CPUS];
+int cpu_count = 1;
+
+static volatile unsigned int* lapic = 0;
+static unsigned int lapic_timer_period = 0;     // APIC timer counts per tick
+static volatile int starting_cpu = 0;
+static unsigned char* starting_stack = 0;
+
+static unsigned int lapic_read(unsigned int reg) {
+    return lapic[reg / 4];
+}
+
+static void lapic_write(unsigned int reg, unsigned int value) {
+    lapic[reg / 4] = value;
+    lapic_read(LAPIC_ID);                       // wait for the write to land
+}
+
+static void lapic_enable() {
+    lapic_write(LAPIC_SPURIOUS, 0x100 | LAPIC_SPURIOUS_VECTOR);
+}
+
+static void lapic_timer_interrupt(InterruptFrame* frame) {
+    lapic_write(LAPIC_EOI, 0);
+    profile_sample(frame);
+    scheduler_tick();
+}
+
+static void lapic_timer_start() {
+    lapic_write(LAPIC_TIMER_DIV, 0x3);          // divide by 16
+    lapic_write(LAPIC_LVT_TIMER, LVT_PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, lapic_timer_period);
+}
+
+// Count APIC timer ticks over 10 PIT ticks
+static void lapic_timer_calibrate() {
+    lapic_write(LAPIC_TIMER_DIV, 0x3);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    unsigned int start = timer_ticks;
+    while (timer_ticks == start) __asm__ __volatile__ ("hlt");
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    start = timer_ticks;
+    while (timer_ticks - start < 10) __asm__ __volatile__ ("hlt");
+    unsigned int counted = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_COUNT);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    lapic_timer_period = counted / 10;
+}
+
+static void delay_us(unsigned int us) {
+    unsigned long long end = read_tsc() + u64_div((unsigned long long)us * (tsc_khz ? tsc_khz : 1000000), 1000);
+    while (read_tsc() < end) __asm__ __volatile__ ("pause");
+}
+
+static void send_ipi(unsigned char apic_id, unsigned int command) {
+    lapic_write(LAPIC_ICR_HIGH, (unsigned int)apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING) __asm__ __volatile__ ("pause");
+}
+
+// First C code on an application processor, on the stack smp_init gave it
+static void ap_main() {
+    Cpu* cpu = &cpus[starting_cpu];
+    interrupts_init_ap();
+    cpu_segment_init(cpu->index, cpu);
+    fpu_init();
+    syscall_init_cpu();
+    paging_enable();
+    lapic_enable();
+    scheduler_init_ap(starting_stack);
+    lapic_timer_start();
+    cpu->online = 1;
+    irq_enable();
+    scheduler_idle();
+}
+
+void smp_init_boot_cpu() {
+    cpus[0].self = &cpus[0];
+    cpus[0].index = 0;
+    cpus[0].online = 1;
+    cpu_segment_init(0, &cpus[0]);
+}
+
+static int start_cpu(Cpu* cpu) {
+    unsigned char* stack = (unsigned char*)kmalloc(THREAD_STACK_SIZE);
+    if (!stack) return 0;
+
+    unsigned char* base = (unsigned char*)TRAMPOLINE_BASE;
+    memcpy(base, trampoline_start, trampoline_end - trampoline_start);
+    *(unsigned int*)(base + (trampoline_stack - trampoline_start)) = (unsigned int)(stack + THREAD_STACK_SIZE);
+    *(unsigned int*)(base + (trampoline_entry - trampoline_start)) = (unsigned int)ap_main;
+    starting_cpu = cpu->index;
+    starting_stack = stack;
+
+    send_ipi(cpu->apic_id, ICR_INIT);
+    thread_sleep(10);
+    for (int i = 0; i < 2; i++) {
+        send_ipi(cpu->apic_id, ICR_STARTUP | (TRAMPOLINE_BASE >> 12));
+        delay_us(200);
+    }
+
+    for (int waited = 0; !cpu->online && waited < 100; waited++) thread_sleep(1);
+    if (cpu->online) return 1;
+
+    // Leave the stack: a CPU that starts late would still run on it
+    return 0;
+}
+
+void smp_init() {
+    unsigned char apic_ids[MAX_CPUS];
+    unsigned int lapic_address = 0;
+    int found = acpi_find_cpus(apic_ids, MAX_CPUS, &lapic_address);
+    if (found < 2) return;
+
+    lapic = (volatile unsigned int*)lapic_address;
+    unsigned char boot_id = lapic_read(LAPIC_ID) >> 24;
+    cpus[0].apic_id = boot_id;
+    lapic_enable();
+    lapic_timer_calibrate();
+    interrupt_install(LAPIC_TIMER_VECTOR, lapic_timer_interrupt);
+
+    for (int i = 0; i < found; i++) {
+        if (apic_ids[i] == boot_id) continue;
+        Cpu* cpu = &cpus[cpu_count];
+        cpu->self = cpu;
+        cpu->index = cpu_count;
+        cpu->apic_id = apic_ids[i];
+        if (!start_cpu(cpu)) {
+            print_string("[smp] CPU did not start\n");
+            break;
+        }
+        cpu_count++;
+    }
+}
+
+// benchmark smp: the same CPU-bound job on 1..N threads at once. With
+// perfect scaling the wall time stays flat, so the speed-up is
+// n * time(1) / time(n).
+
+#define BENCH_ITERATIONS 50000000
+
+static volatile int bench_done = 0;
+static volatile unsigned int bench_sink = 0;
+
+static void bench_worker(void* arg) {
+    unsigned int x = (unsigned int)arg + 1;
+    for (int i = 0; i < BENCH_ITERATIONS; i++) x = x * 1664525 + 1013904223;
+    bench_sink = x;
+    __asm__ __volatile__ ("lock incl %0" : "+m"(bench_done) :: "memory");
+}
+
+void smp_benchmark() {
+    char buffer[24];
+    print_string("\nCPUs  time(ms)  speed-up");
+
+    unsigned int first = 0;
+    for (int n = 1; n <= cpu_count; n++) {
+        bench_done = 0;
+        unsigned long long start = read_tsc();
+        for (int i = 0; i < n; i++) {
+            if (!thread_create("bench", PRIORITY_NORMAL, bench_worker, (void*)i)) {
+                print_string("\nOut of threads.");
+                while (bench_done < i) thread_sleep(1);
+                return;
+            }
+        }
+        while (bench_done < n) thread_sleep(1);
+        unsigned long long cycles = read_tsc() - start;
+
+        // Kilocycles keep the ratio in 32 bits
+        unsigned int elapsed = (unsigned int)(cycles >> 10);
+        if (!elapsed) elapsed = 1;
+        if (n == 1) first = elapsed;
+        unsigned int speedup = (unsigned int)u64_div((unsigned long long)first * n * 100, elapsed);
+
+        print_string("\n");
+        int_to_string(n, buffer);
+        print_string(buffer);
+        print_string(n < 10 ? "     " : "    ");
+        if (tsc_khz) u64_to_string(u64_div(cycles, tsc_khz), buffer);
+        else copy_string(buffer, "?");
+        print_string(buffer);
+        for (int pad = string_length(buffer); pad < 10; pad++) print_string(" ");
+        int_to_string(speedup / 100, buffer);
+        print_string(buffer);
+        print_string(".");
+        int_to_string(speedup % 100 / 10, buffer);
+        print_string(buffer);
+        int_to_string(speedup % 10, buffer);
+        print_string(buffer);
+        print_string("x");
+    }
+}
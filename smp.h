@@ -0,0 +1,60 @@
+#ifndef SMP_H
+#define SMP_H
+
+#define MAX_CPUS 8
+
+struct Thread;
+struct OutputSink;
+
+// Per-CPU data. Every CPU's GS segment starts at its own entry, so
+// this_cpu() is a single load.
+typedef struct Cpu {
+    struct Cpu* self;                   // must stay first, read through %gs:0
+    int index;
+    unsigned char apic_id;
+    volatile int online;
+    struct Thread* current;
+    struct OutputSink* sink;            // print_string target of the current thread
+    unsigned int ticks;                 // scheduler ticks seen by this CPU
+    struct Thread* fpu_owner;           // whose FPU registers are loaded
+    int fpu_trap;                       // CR0.TS set: the next FPU use traps
+} Cpu;
+
+extern Cpu cpus[MAX_CPUS];
+extern int cpu_count;
+
+static inline Cpu* this_cpu() {
+#ifdef HOSTED
+    return &cpus[0];                    // one CPU, no GS setup
+#else
+    Cpu* cpu;
+    __asm__ __volatile__ ("movl %%gs:0, %0" : "=r"(cpu));   // threads can migrate
+    return cpu;
+#endif
+}
+
+// A field of this CPU's entry in a single instruction. Going through
+// this_cpu() takes two loads, and a thread preempted and moved to another
+// CPU between them would use the old CPU's field.
+#ifdef HOSTED
+#define this_cpu_read(field) (cpus[0].field)
+#define this_cpu_write(field, value) (cpus[0].field = (value))
+#else
+#define this_cpu_read(field) ({                                             \
+        __typeof__(((Cpu*)0)->field) value_;                                \
+        __asm__ __volatile__ ("movl %%gs:%c1, %0"                           \
+            : "=r"(value_) : "i"(__builtin_offsetof(Cpu, field)));          \
+        value_;                                                             \
+    })
+#define this_cpu_write(field, value) do {                                   \
+        __typeof__(((Cpu*)0)->field) value_ = (value);                      \
+        __asm__ __volatile__ ("movl %0, %%gs:%c1"                           \
+            :: "r"(value_), "i"(__builtin_offsetof(Cpu, field)) : "memory"); \
+    } while (0)
+#endif
+
+void smp_init_boot_cpu();
+void smp_init();
+void smp_benchmark();
+
+#endif
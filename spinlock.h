@@ -0,0 +1,70 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "interrupts.h"
+
+// Test-and-test-and-set lock: spins on a plain read so waiting CPUs don't
+// keep stealing the cache line from the owner
+typedef struct {
+    volatile unsigned int locked;
+} Spinlock;
+
+// FIFO lock for busy shared resources (heap, console): CPUs get in in the
+// order they arrived, so none of them starves
+typedef struct {
+    volatile unsigned int next;
+    volatile unsigned int serving;
+} TicketLock;
+
+static inline int spin_trylock(Spinlock* lock) {
+    unsigned int old = 1;
+    __asm__ __volatile__ ("xchgl %0, %1" : "+r"(old), "+m"(lock->locked) :: "memory");
+    return old == 0;
+}
+
+static inline void spin_lock(Spinlock* lock) {
+    while (!spin_trylock(lock)) {
+        while (lock->locked) __asm__ __volatile__ ("pause" ::: "memory");
+    }
+}
+
+static inline void spin_unlock(Spinlock* lock) {
+    __asm__ __volatile__ ("" ::: "memory");
+    lock->locked = 0;
+}
+
+static inline void ticket_lock(TicketLock* lock) {
+    unsigned int ticket = 1;
+    __asm__ __volatile__ ("lock xaddl %0, %1" : "+r"(ticket), "+m"(lock->next) :: "memory");
+    while (lock->serving != ticket) __asm__ __volatile__ ("pause" ::: "memory");
+}
+
+static inline void ticket_unlock(TicketLock* lock) {
+    __asm__ __volatile__ ("" ::: "memory");
+    lock->serving = lock->serving + 1;     // only the owner writes it
+}
+
+// Locks also taken by interrupt handlers must be held with interrupts off
+static inline unsigned int spin_lock_irqsave(Spinlock* lock) {
+    unsigned int flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(Spinlock* lock, unsigned int flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+static inline unsigned int ticket_lock_irqsave(TicketLock* lock) {
+    unsigned int flags = irq_save();
+    ticket_lock(lock);
+    return flags;
+}
+
+static inline void ticket_unlock_irqrestore(TicketLock* lock, unsigned int flags) {
+    ticket_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif
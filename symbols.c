@@ -0,0 +1,100 @@
+#include "symbols.h"
+#include "elf.h"
+
+// GRUB passes the kernel's section headers (multiboot flag 0x20) and loads
+// the sections that aren't part of the image, .symtab and .strtab
+// included. The function symbols are moved to the front of .symtab in
+// place and sorted by address, so lookups are a binary search and nothing
+// is allocated: this runs before the heap exists, and the heap starts past
+// these sections (symbols_end).
+
+#define MULTIBOOT_ELF_SECTIONS 0x20
+
+static ElfSymbol* symbols = 0;
+static int function_count = 0;
+static const char* names = 0;
+
+static const ElfSectionHeader* section_headers(multiboot_info_t* mbi, unsigned int* count) {
+    if (!(mbi->flags & MULTIBOOT_ELF_SECTIONS) || mbi->syms[1] != sizeof(ElfSectionHeader)) return 0;
+    *count = mbi->syms[0];
+    return (const ElfSectionHeader*)mbi->syms[2];
+}
+
+void symbols_init(multiboot_info_t* mbi) {
+    unsigned int count;
+    const ElfSectionHeader* sections = section_headers(mbi, &count);
+    if (!sections) return;
+
+    const ElfSectionHeader* symtab = 0;
+    for (unsigned int i = 0; i < count && !symtab; i++) {
+        if (sections[i].type == SHT_SYMTAB) symtab = &sections[i];
+    }
+    if (!symtab || !symtab->addr || symtab->link >= count || !sections[symtab->link].addr) return;
+
+    ElfSymbol* table = (ElfSymbol*)symtab->addr;
+    int total = symtab->size / sizeof(ElfSymbol);
+    int kept = 0;
+    for (int i = 0; i < total; i++) {
+        if ((table[i].info & 0xF) == STT_FUNC && table[i].value) table[kept++] = table[i];
+    }
+
+    // Shell sort: a few thousand entries at most, once at boot
+    for (int gap = kept / 2; gap > 0; gap /= 2) {
+        for (int i = gap; i < kept; i++) {
+            ElfSymbol symbol = table[i];
+            int j = i;
+            while (j >= gap && table[j - gap].value > symbol.value) {
+                table[j] = table[j - gap];
+                j -= gap;
+            }
+            table[j] = symbol;
+        }
+    }
+
+    symbols = table;
+    function_count = kept;
+    names = (const char*)sections[symtab->link].addr;
+}
+
+// First byte after the section headers and the sections GRUB loaded
+// outside the kernel image
+unsigned int symbols_end(multiboot_info_t* mbi) {
+    unsigned int count;
+    const ElfSectionHeader* sections = section_headers(mbi, &count);
+    if (!sections) return 0;
+
+    unsigned int end = (unsigned int)(sections + count);
+    for (unsigned int i = 0; i < count; i++) {
+        if (sections[i].addr && sections[i].addr + sections[i].size > end) end = sections[i].addr + sections[i].size;
+    }
+    return end;
+}
+
+int symbol_count() {
+    return function_count;
+}
+
+// Index of the function containing 'address', or -1
+int symbol_find(unsigned int address) {
+    int low = 0;
+    int high = function_count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (symbols[mid].value <= address) low = mid + 1;
+        else high = mid - 1;
+    }
+    if (high < 0) return -1;
+
+    // Assembly labels have no size: they run up to the next function
+    const ElfSymbol* symbol = &symbols[high];
+    if (symbol->size && address >= symbol->value + symbol->size) return -1;
+    return high;
+}
+
+const char* symbol_name(int index) {
+    return names + symbols[index].name;
+}
+
+unsigned int symbol_address(int index) {
+    return symbols[index].value;
+}
@@ -0,0 +1,15 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include "multiboot.h"
+
+// Kernel function names from the ELF symbol table GRUB loads with the image
+
+void symbols_init(multiboot_info_t* mbi);
+unsigned int symbols_end(multiboot_info_t* mbi);
+int symbol_count();
+int symbol_find(unsigned int address);
+const char* symbol_name(int index);
+unsigned int symbol_address(int index);
+
+#endif
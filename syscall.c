@@ -0,0 +1,275 @@
+#include "syscall.h"
+#include "basic.h"
+#include "fs.h"
+#include "heap.h"
+#include "paging.h"
+#include "thread.h"
+#include "timer.h"
+#include "util.h"
+
+// The system call table and the ring 3 entry/exit around it. A program
+// runs synchronously inside the thread that started it (run_user), on the
+// thread's kernel stack for everything it traps into; the thread keeps the
+// program's open files.
+
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+#define CPUID_SEP    (1 << 11)
+#define KERNEL_CODE  0x08
+
+#define MAX_OPEN_FILES 8
+#define FIRST_FILE_FD  2            // 0 and 1 are the keyboard and the console
+#define CONSOLE_CHUNK  64
+
+typedef struct {
+    TextFile* file;
+    unsigned int offset;
+    int mode;
+} OpenFile;
+
+typedef int (*SyscallHandler)(unsigned int a, unsigned int b, unsigned int c);
+
+int sysenter_supported = 0;
+
+static OpenFile open_files[MAX_THREADS][MAX_OPEN_FILES];
+
+void sysenter_entry();
+int user_enter(unsigned int entry, unsigned int user_esp, unsigned int* kernel_esp, unsigned int* tss_esp0);
+void user_return(unsigned int kernel_esp, int status);
+
+static void write_msr(unsigned int msr, unsigned int value) {
+    __asm__ __volatile__ ("wrmsr" :: "c"(msr), "a"(value), "d"(0));
+}
+
+// Called on every CPU: the SYSENTER MSRs are per CPU
+void syscall_init_cpu() {
+    unsigned int regs[4];
+    cpuid(1, regs);
+
+    // The Pentium Pro reports SEP without implementing it
+    int family = (regs[0] >> 8) & 0xF;
+    int model = (regs[0] >> 4) & 0xF;
+    int stepping = regs[0] & 0xF;
+    sysenter_supported = (regs[3] & CPUID_SEP) && !(family == 6 && model < 3 && stepping < 3);
+    if (!sysenter_supported) return;
+
+    write_msr(MSR_SYSENTER_CS, KERNEL_CODE);    // SS is the next entry, kernel data
+    write_msr(MSR_SYSENTER_ESP, (unsigned int)cpu_tss(this_cpu()->index));
+    write_msr(MSR_SYSENTER_EIP, (unsigned int)sysenter_entry);
+}
+
+// Pointers from a program must stay inside the user window; pages there
+// that aren't mapped yet fault in as the kernel copies
+static int user_range(unsigned int address, unsigned int length) {
+    if (address + length < address) return 0;
+    if (paging_enabled) return address >= USER_BASE && address + length <= USER_TOP;
+    return address >= 0x1000;
+}
+
+// A name near the top of the window must end before it, not just start there
+static int user_string(unsigned int address) {
+    const char* text = (const char*)address;
+    for (int i = 0; i < MAX_FILENAME; i++) {
+        if (!user_range(address, i + 1)) return 0;
+        if (!text[i]) return i > 0;
+    }
+    return 0;
+}
+
+static OpenFile* file_slots() {
+    return open_files[current_thread - threads];
+}
+
+static OpenFile* lookup_fd(unsigned int fd) {
+    if (fd < FIRST_FILE_FD || fd >= FIRST_FILE_FD + MAX_OPEN_FILES) return 0;
+    OpenFile* file = &file_slots()[fd - FIRST_FILE_FD];
+    return file->file ? file : 0;
+}
+
+static void close_all() {
+    OpenFile* slots = file_slots();
+    for (int i = 0; i < MAX_OPEN_FILES; i++) slots[i].file = 0;
+}
+
+static int sys_exit(unsigned int status, unsigned int unused1, unsigned int unused2) {
+    close_all();
+    user_return(current_thread->kernel_esp, (int)status);
+    return 0;
+}
+
+static int sys_write(unsigned int fd, unsigned int buffer, unsigned int length) {
+    if (!user_range(buffer, length)) return -1;
+    const char* data = (const char*)buffer;
+
+    if (fd == FD_CONSOLE) {
+        char chunk[CONSOLE_CHUNK + 1];
+        for (unsigned int done = 0; done < length; done += CONSOLE_CHUNK) {
+            unsigned int count = length - done < CONSOLE_CHUNK ? length - done : CONSOLE_CHUNK;
+            memcpy(chunk, data + done, count);
+            chunk[count] = 0;
+            print_string(chunk);
+        }
+        return length;
+    }
+
+    OpenFile* file = lookup_fd(fd);
+    if (!file || file->mode == OPEN_READ) return -1;
+    if (!file_append(file->file, data, length)) return -1;
+    return length;
+}
+
+static int sys_open(unsigned int name, unsigned int mode, unsigned int unused) {
+    if (!user_string(name) || mode > OPEN_APPEND) return -1;
+
+    OpenFile* slots = file_slots();
+    int slot = 0;
+    while (slot < MAX_OPEN_FILES && slots[slot].file) slot++;
+    if (slot == MAX_OPEN_FILES) return -1;
+
+    TextFile* file = mode == OPEN_READ ? find_file((const char*)name) : create_file((const char*)name);
+    if (!file) return -1;
+    if (mode == OPEN_WRITE && !file_write(file, "", 0)) return -1;
+
+    slots[slot].file = file;
+    slots[slot].offset = 0;
+    slots[slot].mode = mode;
+    return FIRST_FILE_FD + slot;
+}
+
+static int sys_read(unsigned int fd, unsigned int buffer, unsigned int length) {
+    if (!user_range(buffer, length)) return -1;
+    OpenFile* file = lookup_fd(fd);
+    if (!file || file->mode != OPEN_READ) return -1;
+
+    unsigned int size = file->file->size;
+    unsigned int count = file->offset < size ? size - file->offset : 0;
+    if (count > length) count = length;
+    memcpy((void*)buffer, file->file->data + file->offset, count);
+    file->offset += count;
+    return count;
+}
+
+static int sys_close(unsigned int fd, unsigned int unused1, unsigned int unused2) {
+    OpenFile* file = lookup_fd(fd);
+    if (!file) return -1;
+    file->file = 0;
+    return 0;
+}
+
+static int sys_time(unsigned int unused1, unsigned int unused2, unsigned int unused3) {
+    return timer_ticks * (1000 / TIMER_HZ);
+}
+
+static const SyscallHandler syscall_table[SYSCALL_COUNT] = {
+    [SYS_EXIT]  = sys_exit,
+    [SYS_WRITE] = sys_write,
+    [SYS_OPEN]  = sys_open,
+    [SYS_READ]  = sys_read,
+    [SYS_CLOSE] = sys_close,
+    [SYS_TIME]  = sys_time,
+};
+
+// Both entry paths end up here, with interrupts enabled
+void syscall_dispatch(InterruptFrame* frame) {
+    unsigned int number = frame->eax;
+    if (number >= SYSCALL_COUNT) {
+        frame->eax = -1;
+        return;
+    }
+    frame->eax = syscall_table[number](frame->ebx, frame->esi, frame->edi);
+}
+
+// A CPU exception in ring 3 ends the program instead of the kernel
+void user_fault(InterruptFrame* frame, const char* name) {
+    Thread* thread = current_thread;
+    if (!thread->kernel_esp) return;
+
+    char buffer[16];
+    print_string("\n[user] ");
+    print_string(name ? name : "exception");
+    print_string(" at eip 0x");
+    itoa(frame->eip, buffer, 16);
+    print_string(buffer);
+    print_string("\n");
+
+    close_all();
+    user_return(thread->kernel_esp, -1);
+}
+
+// Run 'entry' in ring 3 on the given stack and address space (0 without
+// paging) until it exits; returns its status
+int run_user(AddressSpace* space, unsigned int entry, unsigned int stack_top) {
+    Thread* thread = current_thread;
+    unsigned int flags = irq_save();
+    thread->address_space = space;
+    paging_switch(space);
+    int status = user_enter(entry, stack_top, &thread->kernel_esp, tss_kernel_stack(this_cpu()->index));
+    thread->kernel_esp = 0;
+    thread->address_space = 0;
+    paging_switch(0);
+    irq_restore(flags);
+    return status;
+}
+
+// Syscall latency: a ring 3 loop of time() calls through each entry path,
+// timed with the TSC from user mode
+#define BENCH_CALLS 10000
+
+static unsigned long long bench_cycles[2];
+
+static inline unsigned long long user_tsc() {
+    unsigned long long value;
+    __asm__ __volatile__ ("rdtsc" : "=A"(value));
+    return value;
+}
+
+static void bench_user() {
+    unsigned long long start = user_tsc();
+    for (int i = 0; i < BENCH_CALLS; i++) syscall_int(SYS_TIME, 0, 0, 0);
+    unsigned long long middle = user_tsc();
+    if (sysenter_supported) {
+        for (int i = 0; i < BENCH_CALLS; i++) syscall_fast(SYS_TIME, 0, 0, 0);
+    }
+    unsigned long long end = user_tsc();
+
+    bench_cycles[0] = middle - start;
+    bench_cycles[1] = end - middle;
+    syscall_int(SYS_EXIT, 0, 0, 0);
+}
+
+static void print_latency(const char* label, unsigned long long cycles) {
+    char buffer[24];
+    print_string(label);
+    u64_to_string(u64_div(cycles, BENCH_CALLS), buffer);
+    print_string(buffer);
+    print_string(" cycles/call");
+}
+
+void syscall_benchmark() {
+    unsigned char* stack = (unsigned char*)kmalloc(THREAD_STACK_SIZE);
+    if (!stack) {
+        print_string("\nOut of memory.");
+        return;
+    }
+    // The test loop is kernel code, so ring 3 needs to see the kernel
+    AddressSpace* space = address_space_create(0, 1);
+    if (paging_enabled && !space) {
+        kfree(stack);
+        print_string("\nOut of memory.");
+        return;
+    }
+    run_user(space, (unsigned int)bench_user, (unsigned int)(stack + THREAD_STACK_SIZE));
+    address_space_destroy(space);
+    kfree(stack);
+
+    print_string("\nSyscall latency (time(), ");
+    char buffer[16];
+    int_to_string(BENCH_CALLS, buffer);
+    print_string(buffer);
+    print_string(" calls)");
+    print_latency("\nint 0x80:  ", bench_cycles[0]);
+    if (sysenter_supported) print_latency("\nsysenter:  ", bench_cycles[1]);
+    else print_string("\nsysenter:  not supported by this CPU");
+}
@@ -0,0 +1,53 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include "interrupts.h"
+
+struct AddressSpace;
+
+// System calls for ring 3 code: the number in EAX, up to three arguments
+// in EBX, ESI and EDI, the result back in EAX (-1 on error). They come in
+// through SYSENTER when the CPU has it, or int 0x80.
+
+#define SYS_EXIT    0   // (status)
+#define SYS_WRITE   1   // (fd, buffer, length)
+#define SYS_OPEN    2   // (name, mode) -> fd
+#define SYS_READ    3   // (fd, buffer, length) -> bytes read, 0 at the end
+#define SYS_CLOSE   4   // (fd)
+#define SYS_TIME    5   // () -> milliseconds since boot
+#define SYSCALL_COUNT 6
+
+#define FD_CONSOLE  1
+
+#define OPEN_READ   0
+#define OPEN_WRITE  1   // truncates
+#define OPEN_APPEND 2
+
+extern int sysenter_supported;
+
+void syscall_init_cpu();
+void syscall_dispatch(InterruptFrame* frame);
+void user_fault(InterruptFrame* frame, const char* name);
+int run_user(struct AddressSpace* space, unsigned int entry, unsigned int stack_top);
+void syscall_benchmark();
+
+// Call stubs for code running in ring 3
+static inline int syscall_int(int number, int a, int b, int c) {
+    int result;
+    __asm__ __volatile__ ("int $0x80"
+        : "=a"(result) : "a"(number), "b"(a), "S"(b), "D"(c) : "memory");
+    return result;
+}
+
+// SYSEXIT returns to EDX with the stack in ECX
+static inline int syscall_fast(int number, int a, int b, int c) {
+    int result;
+    __asm__ __volatile__ ("movl %%esp, %%ecx\n\t"
+                          "movl $1f, %%edx\n\t"
+                          "sysenter\n"
+                          "1:"
+        : "=a"(result) : "a"(number), "b"(a), "S"(b), "D"(c) : "ecx", "edx", "memory");
+    return result;
+}
+
+#endif
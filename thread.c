@@ -0,0 +1,393 @@
+#include "thread.h"
+#include "fpu.h"
+#include "heap.h"
+#include "interrupts.h"
+#include "paging.h"
+#include "timer.h"
+
+// Kernel threads with a preemptive, priority round-robin scheduler.
+//
+// Every CPU has its own run queues, one FIFO per priority level; the
+// highest non-empty level runs, and threads of one level take turns every
+// TIME_SLICE_MS. New and woken threads go to the queue of their CPU, and
+// a CPU with nothing to do steals a waiting thread from a busy one. Each
+// CPU has an idle thread of its own that is never queued.
+//
+// Threads leave the run queues to sleep (a list ordered by wake-up tick)
+// or to block on a WaitQueue. A switch saves the callee-saved registers on
+// the old stack (context_switch in interrupts.asm); when an interrupt
+// preempts a thread, the interrupt frame below that holds the rest.
+//
+// Lock order: wait queue or sleep list lock, then a run queue lock. The
+// run queue lock is held across context_switch and released by the thread
+// that runs next (finish_switch).
+
+void context_switch(unsigned int* save_esp, unsigned int next_esp);
+
+typedef struct {
+    Spinlock lock;
+    WaitQueue levels[PRIORITY_LEVELS];
+    volatile int queued;
+    Thread* idle;
+    Thread* prev;                   // switched away from, see finish_switch
+    unsigned int slice_end;
+    volatile int need_resched;
+    unsigned int steals;
+} RunQueue;
+
+Thread threads[MAX_THREADS];
+
+static RunQueue run_queues[MAX_CPUS];
+static Spinlock threads_lock;       // slot allocation and reaping
+static Spinlock sleep_lock;
+static Thread* sleepers = 0;
+static int next_id = 0;
+
+static void enqueue(WaitQueue* queue, Thread* thread) {
+    thread->next = 0;
+    if (queue->tail) queue->tail->next = thread;
+    else queue->head = thread;
+    queue->tail = thread;
+}
+
+static Thread* dequeue(WaitQueue* queue) {
+    Thread* thread = queue->head;
+    if (thread) {
+        queue->head = thread->next;
+        if (!queue->head) queue->tail = 0;
+        thread->next = 0;
+    }
+    return thread;
+}
+
+// Called with the run queue locked
+static void rq_add(RunQueue* rq, Thread* thread) {
+    thread->state = THREAD_READY;
+    enqueue(&rq->levels[thread->priority], thread);
+    rq->queued++;
+}
+
+static Thread* rq_take(RunQueue* rq) {
+    for (int level = 0; level < PRIORITY_LEVELS; level++) {
+        Thread* thread = dequeue(&rq->levels[level]);
+        if (thread) {
+            rq->queued--;
+            return thread;
+        }
+    }
+    return 0;
+}
+
+// Put a thread back on its CPU's queue and ask that CPU to reschedule if
+// the thread is more important than what it runs now
+static void make_ready(Thread* thread) {
+    RunQueue* rq = &run_queues[thread->cpu];
+    spin_lock(&rq->lock);
+    rq_add(rq, thread);
+    Thread* running = cpus[thread->cpu].current;
+    if (running && thread->priority < running->priority) rq->need_resched = 1;
+    spin_unlock(&rq->lock);
+}
+
+static void finish_switch() {
+    RunQueue* rq = &run_queues[this_cpu()->index];
+    Thread* prev = rq->prev;
+    rq->prev = 0;
+    spin_unlock(&rq->lock);
+    if (prev) prev->on_cpu = 0;
+}
+
+// Switch to the best ready thread; the caller has set the state of the
+// current one. Interrupts must be disabled and no run queue lock held.
+static void schedule() {
+    Cpu* cpu = this_cpu();
+    RunQueue* rq = &run_queues[cpu->index];
+    Thread* old = cpu->current;
+
+    spin_lock(&rq->lock);
+    rq->need_resched = 0;
+    if (old->state == THREAD_RUNNING && old != rq->idle) rq_add(rq, old);
+
+    Thread* next = rq_take(rq);
+    if (!next) next = rq->idle;
+    next->state = THREAD_RUNNING;
+    next->on_cpu = 1;
+    rq->slice_end = timer_ticks + ms_to_ticks(TIME_SLICE_MS);
+    if (next == old) {
+        spin_unlock(&rq->lock);
+        return;
+    }
+
+    unsigned long long now = read_tsc();
+    old->cpu_cycles += now - old->switched_in;
+    next->switched_in = now;
+
+    // Each thread keeps its own print_string target (pipes, files)
+    old->sink = output_sink;
+    set_output_sink(next->sink);
+
+    fpu_switch(old, next);
+    if (next->kernel_esp) tss_set_kernel_stack(next->kernel_esp);
+    paging_switch(next->address_space);
+    cpu->current = next;
+    rq->prev = old;
+    context_switch(&old->esp, next->esp);
+    finish_switch();
+}
+
+// New threads start here, "returning" from their first context_switch
+static void thread_start() {
+    finish_switch();
+    irq_enable();
+    current_thread->entry(current_thread->arg);
+    thread_exit();
+}
+
+// Take a waiting thread from the busiest other CPU. Threads that are still
+// switching out (on_cpu) stay where they are.
+static int steal_work(Cpu* cpu) {
+    RunQueue* own = &run_queues[cpu->index];
+    int busiest = -1;
+    for (int i = 0; i < cpu_count; i++) {
+        if (i == cpu->index || !cpus[i].online) continue;
+        if (run_queues[i].queued > 0 && (busiest < 0 || run_queues[i].queued > run_queues[busiest].queued)) busiest = i;
+    }
+    if (busiest < 0) return 0;
+
+    RunQueue* victim = &run_queues[busiest];
+    if (!spin_trylock(&victim->lock)) return 0;
+
+    Thread* stolen = 0;
+    for (int level = 0; level < PRIORITY_IDLE && !stolen; level++) {
+        Thread** link = &victim->levels[level].head;
+        Thread* prev = 0;
+        for (Thread* thread = *link; thread; prev = thread, thread = thread->next) {
+            if (thread->on_cpu) continue;
+            if (prev) prev->next = thread->next;
+            else victim->levels[level].head = thread->next;
+            if (victim->levels[level].tail == thread) victim->levels[level].tail = prev;
+            victim->queued--;
+            stolen = thread;
+            break;
+        }
+    }
+    spin_unlock(&victim->lock);
+    if (!stolen) return 0;
+
+    stolen->cpu = cpu->index;
+    spin_lock(&own->lock);
+    rq_add(own, stolen);
+    own->steals++;
+    spin_unlock(&own->lock);
+    return 1;
+}
+
+// Free the stacks of finished threads; they can't do it themselves
+static void reap_threads() {
+    spin_lock(&threads_lock);
+    for (int i = 0; i < MAX_THREADS; i++) {
+        Thread* thread = &threads[i];
+        if (thread->state == THREAD_DEAD && !thread->on_cpu) {
+            kfree(thread->stack);
+            thread->stack = 0;
+            fpu_release(thread);
+            thread->state = THREAD_UNUSED;
+        }
+    }
+    spin_unlock(&threads_lock);
+}
+
+// Idle threads: run whatever shows up, steal work or sleep until the next
+// interrupt. Never returns.
+void scheduler_idle() {
+    while (1) {
+        irq_save();
+        Cpu* cpu = this_cpu();
+        reap_threads();
+        if (run_queues[cpu->index].queued || steal_work(cpu)) {
+            schedule();
+            irq_enable();
+        } else {
+            __asm__ __volatile__ ("sti; hlt");      // sleeps until the next interrupt
+        }
+    }
+}
+
+static void idle_main(void* arg) {
+    scheduler_idle();
+}
+
+static Thread* allocate_thread(const char* name, int priority) {
+    spin_lock(&threads_lock);
+    Thread* thread = 0;
+    for (int i = 0; i < MAX_THREADS && !thread; i++) {
+        if (threads[i].state == THREAD_UNUSED) thread = &threads[i];
+    }
+    if (thread) {
+        int i = 0;
+        for (; name[i] && i < THREAD_NAME - 1; i++) thread->name[i] = name[i];
+        thread->name[i] = 0;
+        thread->id = next_id++;
+        thread->priority = priority;
+        thread->cpu = this_cpu()->index;
+        thread->cpu_cycles = 0;
+        thread->sink = output_sink;
+        thread->fpu_state = 0;
+        thread->fpu_cpu = -1;
+        thread->kernel_esp = 0;
+        thread->address_space = 0;
+        thread->state = THREAD_BLOCKED;     // not runnable yet
+    }
+    spin_unlock(&threads_lock);
+    return thread;
+}
+
+// The code that is already running on this CPU becomes a thread
+static Thread* adopt_context(const char* name, int priority, unsigned char* stack) {
+    Thread* thread = allocate_thread(name, priority);
+    thread->stack = stack;
+    thread->state = THREAD_RUNNING;
+    thread->on_cpu = 1;
+    thread->switched_in = read_tsc();
+    this_cpu_write(current, thread);
+    run_queues[this_cpu()->index].slice_end = timer_ticks + ms_to_ticks(TIME_SLICE_MS);
+    return thread;
+}
+
+// Stack and initial frame for context_switch: four registers, then
+// thread_start
+static int prepare_stack(Thread* thread) {
+    unsigned char* stack = (unsigned char*)kmalloc(THREAD_STACK_SIZE);
+    if (!stack) return 0;
+
+    unsigned int* sp = (unsigned int*)(stack + THREAD_STACK_SIZE);
+    *--sp = 0;                              // thread_start never returns
+    *--sp = (unsigned int)thread_start;
+    *--sp = 0;                              // ebp
+    *--sp = 0;                              // ebx
+    *--sp = 0;                              // esi
+    *--sp = 0;                              // edi
+    thread->stack = stack;
+    thread->esp = (unsigned int)sp;
+    return 1;
+}
+
+// Boot CPU: the kernel_main code becomes the "shell" thread
+void scheduler_init() {
+    adopt_context("shell", PRIORITY_NORMAL, 0);
+
+    Thread* idle = allocate_thread("idle0", PRIORITY_IDLE);
+    idle->entry = idle_main;
+    prepare_stack(idle);
+    run_queues[0].idle = idle;
+}
+
+// Application processors: the start-up context becomes the idle thread
+void scheduler_init_ap(unsigned char* stack) {
+    char name[THREAD_NAME] = "idle";
+    int_to_string(this_cpu()->index, name + 4);
+    run_queues[this_cpu()->index].idle = adopt_context(name, PRIORITY_IDLE, stack);
+}
+
+Thread* thread_create(const char* name, int priority, void (*entry)(void* arg), void* arg) {
+    Thread* thread = allocate_thread(name, priority);
+    if (!thread) return 0;
+    if (!prepare_stack(thread)) {
+        thread->state = THREAD_UNUSED;
+        return 0;
+    }
+    thread->entry = entry;
+    thread->arg = arg;
+
+    unsigned int flags = irq_save();
+    make_ready(thread);
+    irq_restore(flags);
+    return thread;
+}
+
+void thread_yield() {
+    unsigned int flags = irq_save();
+    schedule();
+    irq_restore(flags);
+}
+
+void thread_exit() {
+    irq_save();
+    current_thread->state = THREAD_DEAD;
+    schedule();
+    while (1);      // not reached
+}
+
+void thread_sleep(unsigned int ms) {
+    unsigned int flags = irq_save();
+    Thread* thread = current_thread;
+
+    spin_lock(&sleep_lock);
+    thread->wake_tick = timer_ticks + ms_to_ticks(ms);
+    thread->state = THREAD_SLEEPING;
+    Thread** link = &sleepers;
+    while (*link && (int)((*link)->wake_tick - thread->wake_tick) <= 0) link = &(*link)->next;
+    thread->next = *link;
+    *link = thread;
+    spin_unlock(&sleep_lock);
+
+    // A wake-up that comes in before the switch simply makes us ready again
+    schedule();
+    irq_restore(flags);
+}
+
+void wait_queue_sleep(WaitQueue* queue, Spinlock* lock) {
+    current_thread->state = THREAD_BLOCKED;
+    enqueue(queue, current_thread);
+    spin_unlock(lock);
+    schedule();
+    spin_lock(lock);
+}
+
+void wait_queue_wake_all(WaitQueue* queue) {
+    Thread* thread;
+    while ((thread = dequeue(queue))) make_ready(thread);
+}
+
+// Timer interrupt on any CPU; the boot CPU also wakes the sleepers
+void scheduler_tick() {
+    Cpu* cpu = this_cpu();
+    if (!cpu->current) return;
+    cpu->ticks++;
+
+    if (cpu->index == 0) {
+        spin_lock(&sleep_lock);
+        while (sleepers && (int)(timer_ticks - sleepers->wake_tick) >= 0) {
+            Thread* thread = sleepers;
+            sleepers = thread->next;
+            make_ready(thread);
+        }
+        spin_unlock(&sleep_lock);
+    }
+
+    RunQueue* rq = &run_queues[cpu->index];
+    if ((int)(timer_ticks - rq->slice_end) >= 0 && rq->queued) rq->need_resched = 1;
+}
+
+// End of every interrupt: switch if the time slice ran out or a more
+// important thread became ready
+void scheduler_preempt() {
+    Cpu* cpu = this_cpu();
+    if (cpu->current && run_queues[cpu->index].need_resched) schedule();
+}
+
+// Threads this CPU took from others
+unsigned int scheduler_steals(int cpu) {
+    return run_queues[cpu].steals;
+}
+
+const char* thread_state_name(ThreadState state) {
+    switch (state) {
+        case THREAD_READY: return "ready";
+        case THREAD_RUNNING: return "running";
+        case THREAD_SLEEPING: return "sleeping";
+        case THREAD_BLOCKED: return "blocked";
+        case THREAD_DEAD: return "dead";
+        default: return "unused";
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include "smp.h"
+#include "spinlock.h"
+#include "util.h"
+
+#define MAX_THREADS       32
+#define THREAD_STACK_SIZE 16384
+#define THREAD_NAME       16
+#define TIME_SLICE_MS     10
+
+#define PRIORITY_HIGH     0
+#define PRIORITY_NORMAL   1
+#define PRIORITY_LOW      2
+#define PRIORITY_IDLE     3
+#define PRIORITY_LEVELS   4
+
+struct AddressSpace;
+
+typedef enum {
+    THREAD_UNUSED,
+    THREAD_READY,
+    THREAD_RUNNING,
+    THREAD_SLEEPING,
+    THREAD_BLOCKED,
+    THREAD_DEAD
+} ThreadState;
+
+typedef struct Thread {
+    unsigned int esp;               // saved stack pointer while switched out
+    int id;
+    char name[THREAD_NAME];
+    int priority;
+    ThreadState state;
+    int cpu;                        // run queue the thread belongs to
+    volatile int on_cpu;            // its registers are live or being saved
+    unsigned char* stack;           // 0 for the boot thread
+    unsigned long long cpu_cycles;  // TSC cycles spent running
+    unsigned long long switched_in;
+    unsigned int wake_tick;
+    OutputSink* sink;               // print_string target while switched out
+    unsigned char* fpu_state;       // FXSAVE area, allocated on first FPU use
+    int fpu_cpu;                    // CPU that last loaded fpu_state, -1 if none
+    unsigned int kernel_esp;        // kernel stack while in ring 3, 0 otherwise
+    struct AddressSpace* address_space; // program running in ring 3, if any
+    void (*entry)(void* arg);
+    void* arg;
+    struct Thread* next;            // run queue, wait queue or sleep list
+} Thread;
+
+typedef struct {
+    Thread* head;
+    Thread* tail;
+} WaitQueue;
+
+extern Thread threads[MAX_THREADS];
+
+#define current_thread this_cpu_read(current)
+
+void scheduler_init();
+void scheduler_init_ap(unsigned char* stack);
+void scheduler_tick();
+void scheduler_preempt();
+void scheduler_idle();
+unsigned int scheduler_steals(int cpu);
+Thread* thread_create(const char* name, int priority, void (*entry)(void* arg), void* arg);
+void thread_yield();
+void thread_exit();
+void thread_sleep(unsigned int ms);
+
+// The caller holds 'lock' (with interrupts disabled), which protects both
+// the queue and the condition it waits for; it is held again on return
+void wait_queue_sleep(WaitQueue* queue, Spinlock* lock);
+void wait_queue_wake_all(WaitQueue* queue);
+
+const char* thread_state_name(ThreadState state);
+
+#endif
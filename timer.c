@@ -0,0 +1,30 @@
+#include "timer.h"
+#include "interrupts.h"
+#include "profile.h"
+#include "thread.h"
+#include "util.h"
+
+#define PIT_FREQUENCY 1193182
+#define PIT_CHANNEL0  0x40
+#define PIT_COMMAND   0x43
+
+volatile unsigned int timer_ticks = 0;
+
+static void timer_interrupt(InterruptFrame* frame) {
+    timer_ticks++;
+    profile_sample(frame);
+    scheduler_tick();
+}
+
+// PIT channel 0 drives the scheduler at TIMER_HZ
+void timer_init() {
+    unsigned int divisor = PIT_FREQUENCY / TIMER_HZ;
+    outb(PIT_COMMAND, 0x36);        // channel 0, lobyte/hibyte, square wave
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, divisor >> 8);
+    irq_install(IRQ_TIMER, timer_interrupt);
+}
+
+unsigned int ms_to_ticks(unsigned int ms) {
+    return (ms * TIMER_HZ + 999) / 1000;
+}
@@ -0,0 +1,11 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#define TIMER_HZ 1000
+
+extern volatile unsigned int timer_ticks;
+
+void timer_init();
+unsigned int ms_to_ticks(unsigned int ms);
+
+#endif
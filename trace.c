@@ -0,0 +1,69 @@
+#include "trace.h"
+#include "serial.h"
+#include "util.h"
+
+volatile int trace_enabled = 0;
+TraceEntry trace_buffer[TRACE_ENTRIES];
+volatile unsigned int trace_head = 0;
+
+static const char* const event_names[TRACE_EVENT_COUNT] = {
+    [TRACE_KEY_IRQ]       = "key_irq",
+    [TRACE_KEYPRESS]      = "keypress",
+    [TRACE_COMMAND_BEGIN] = "command_begin",
+    [TRACE_COMMAND_END]   = "command_end",
+    [TRACE_PRINT]         = "print",
+    [TRACE_SCROLL_BEGIN]  = "scroll_begin",
+    [TRACE_SCROLL_END]    = "scroll_end",
+};
+
+void trace_clear() {
+    trace_head = 0;
+}
+
+static void serial_number(unsigned long long value) {
+    char buffer[24];
+    u64_to_string(value, buffer);
+    serial_write(buffer);
+}
+
+// Tracing is paused while the buffer goes out; writers that were already
+// inside trace_record may still land in the oldest slots
+void trace_dump() {
+    int was_enabled = trace_enabled;
+    trace_enabled = 0;
+
+    unsigned int head = trace_head;
+    unsigned int count = head < TRACE_ENTRIES ? head : TRACE_ENTRIES;
+
+    serial_write("\nTRACE-BEGIN tsc_khz=");
+    serial_number(tsc_khz);
+    serial_write(" events=");
+    serial_number(count);
+    serial_write(" lost=");
+    serial_number(head - count);
+    serial_write("\n");
+
+    for (unsigned int i = head - count; i != head; i++) {
+        const TraceEntry* entry = &trace_buffer[i & (TRACE_ENTRIES - 1)];
+        serial_number(entry->tsc);
+        serial_write(" ");
+        serial_number(entry->cpu);
+        serial_write(" ");
+        serial_write(entry->event < TRACE_EVENT_COUNT && event_names[entry->event] ? event_names[entry->event] : "unknown");
+        serial_write(" ");
+        serial_number(entry->a);
+        serial_write(" ");
+        serial_number(entry->b);
+        serial_write("\n");
+    }
+    serial_write("TRACE-END\n");
+    serial_flush();
+
+    trace_enabled = was_enabled;
+
+    char buffer[16];
+    print_string("\n");
+    int_to_string(count, buffer);
+    print_string(buffer);
+    print_string(" events sent to serial");
+}
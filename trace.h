@@ -0,0 +1,64 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "smp.h"
+
+// Static tracepoints: TRACE(event, a, b) stores a TSC timestamp, the CPU,
+// the event ID and two 32-bit arguments in a ring buffer. Built without
+// CONFIG_TRACE the macro is empty; built with it, a tracepoint costs one
+// test while tracing is off and an RDTSC plus a few stores while it is on.
+//
+// "trace dump" sends the buffer over serial, oldest event first:
+//   TRACE-BEGIN tsc_khz=<n> events=<n> lost=<n>
+//   <tsc> <cpu> <event name> <a> <b>
+//   TRACE-END
+
+#define TRACE_ENTRIES 4096      // power of two
+
+typedef enum {
+    TRACE_KEY_IRQ = 1,          // a: scancode
+    TRACE_KEYPRESS,             // a: character, b: scancode (get_keypress returns)
+    TRACE_COMMAND_BEGIN,        // a: first four bytes of the command name
+    TRACE_COMMAND_END,          // a: errors while it ran
+    TRACE_PRINT,                // a: characters, b: cursor position
+    TRACE_SCROLL_BEGIN,
+    TRACE_SCROLL_END,
+    TRACE_EVENT_COUNT
+} TraceEvent;
+
+typedef struct {
+    unsigned long long tsc;
+    unsigned short event;
+    unsigned short cpu;
+    unsigned int a, b;
+} TraceEntry;
+
+extern volatile int trace_enabled;
+extern TraceEntry trace_buffer[TRACE_ENTRIES];
+extern volatile unsigned int trace_head;
+
+static inline void trace_record(unsigned int event, unsigned int a, unsigned int b) {
+    unsigned int slot = 1;
+    __asm__ __volatile__ ("lock xaddl %0, %1" : "+r"(slot), "+m"(trace_head) :: "memory");
+    TraceEntry* entry = &trace_buffer[slot & (TRACE_ENTRIES - 1)];
+    unsigned int low, high;
+    __asm__ __volatile__ ("rdtsc" : "=a"(low), "=d"(high));
+    entry->tsc = ((unsigned long long)high << 32) | low;
+    entry->event = event;
+    entry->cpu = this_cpu()->index;
+    entry->a = a;
+    entry->b = b;
+}
+
+#ifdef CONFIG_TRACE
+#define TRACE(event, a, b) do {                                 \
+        if (trace_enabled) trace_record((event), (a), (b));    \
+    } while (0)
+#else
+#define TRACE(event, a, b) do { } while (0)
+#endif
+
+void trace_clear();
+void trace_dump();
+
+#endif
@@ -0,0 +1,57 @@
+; Application processor start-up code. smp.c copies it to TRAMPOLINE_BASE
+; (below 1 MB, page aligned) and points the CPUs there with a SIPI; they
+; start in real mode, so every address is relative to that copy.
+
+TRAMPOLINE_BASE equ 0x7000
+
+%define REL(label) (TRAMPOLINE_BASE + (label - trampoline_start))
+
+section .text
+
+global trampoline_start
+global trampoline_end
+global trampoline_stack
+global trampoline_entry
+
+bits 16
+trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    lgdt [REL(trampoline_gdtr)]
+    mov eax, cr0
+    or eax, 1               ; protected mode
+    mov cr0, eax
+    jmp dword 0x08:REL(trampoline_32)
+
+bits 32
+trampoline_32:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    mov esp, [REL(trampoline_stack)]
+    call [REL(trampoline_entry)]
+.halt:
+    cli
+    hlt
+    jmp .halt
+
+align 8
+trampoline_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF   ; flat code
+    dq 0x00CF92000000FFFF   ; flat data
+trampoline_gdtr:
+    dw 23
+    dd REL(trampoline_gdt)
+
+; Filled in by smp.c for each CPU it starts
+trampoline_stack:
+    dd 0
+trampoline_entry:
+    dd 0
+trampoline_end:
@@ -1,4 +1,9 @@
 #include "util.h"
+#include "spinlock.h"
+#include "metrics.h"
+#include "serial.h"
+#include "trace.h"
+#include "workqueue.h"
 
 char* video_memory = VIDEO_MEMORY;
 unsigned short cursor_pos = 0;
@@ -12,14 +17,19 @@ unsigned char color = 0x0F;
 
 char cpu_brand[49] = "Unknown";
 
+// regs receives EAX, EBX, ECX, EDX in that order
+void cpuid(unsigned int leaf, unsigned int* regs) {
+    __asm__ volatile (
+        "cpuid"
+        : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
+        : "a"(leaf), "c"(0)
+    );
+}
+
 void get_cpu_brand() {
     unsigned int regs[4];
     for (int i = 0; i < 3; i++) {
-        __asm__ volatile (
-            "cpuid"
-            : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
-            : "a"(0x80000002 + i)
-        );
+        cpuid(0x80000002 + i, regs);
 
         int offset = i * 16;
         *((unsigned int*)(cpu_brand + offset))     = regs[0];
@@ -31,23 +41,29 @@ void get_cpu_brand() {
     cpu_brand[48] = '\0'; // Ensure null-termination
 }
 
-void scroll_if_needed() {
-    if (cursor_pos >= WIDTH * HEIGHT) {
-        for (int row = 1; row < HEIGHT; row++) {
-            for (int col = 0; col < WIDTH; col++) {
-                int from = (row * WIDTH + col) * 2;
-                int to = ((row - 1) * WIDTH + col) * 2;
-                video_memory[to] = video_memory[from];
-                video_memory[to + 1] = video_memory[from + 1];
-            }
-        }
-
+static void scroll_screen() {
+    TRACE(TRACE_SCROLL_BEGIN, 0, 0);
+    metric_inc(METRIC_SCROLLS);
+    for (int row = 1; row < HEIGHT; row++) {
         for (int col = 0; col < WIDTH; col++) {
-            int idx = ((HEIGHT - 1) * WIDTH + col) * 2;
-            video_memory[idx] = ' ';
-            video_memory[idx + 1] = color;
+            int from = (row * WIDTH + col) * 2;
+            int to = ((row - 1) * WIDTH + col) * 2;
+            video_memory[to] = video_memory[from];
+            video_memory[to + 1] = video_memory[from + 1];
         }
+    }
+
+    for (int col = 0; col < WIDTH; col++) {
+        int idx = ((HEIGHT - 1) * WIDTH + col) * 2;
+        video_memory[idx] = ' ';
+        video_memory[idx + 1] = color;
+    }
+    TRACE(TRACE_SCROLL_END, 0, 0);
+}
 
+void scroll_if_needed() {
+    if (cursor_pos >= WIDTH * HEIGHT) {
+        scroll_screen();
         cursor_pos -= WIDTH; // Only move up one line, keep column
     }
 }
@@ -63,8 +79,25 @@ void change_color(const char* str) {
 
 }
 
+static TicketLock console_lock;
+
+static void cursor_work_function(WorkItem* work) {
+    update_cursor();
+}
+
+// Four port writes per move add up; one deferred update covers a burst
+static WorkItem cursor_work = WORK_ITEM(cursor_work_function);
+
 void print_string(const char* str) {
-    for (int i = 0; str[i]; i++) {
+    if (output_sink) {
+        output_sink->write(output_sink, str);
+        return;
+    }
+
+    // Threads on every CPU print; keep the cursor and the scroll consistent
+    unsigned int flags = ticket_lock_irqsave(&console_lock);
+    int i = 0;
+    for (; str[i]; i++) {
         if (str[i] == '\n') {
             newline();
         } else if (str[i] == '\r') {
@@ -78,9 +111,26 @@ void print_string(const char* str) {
             scroll_if_needed();
         }
     }
-    update_cursor();
+    work_post(&cursor_work);
+    TRACE(TRACE_PRINT, i, cursor_pos);
+    metric_add(METRIC_CHARS_PRINTED, i);
+
+    if (serial_mirror) serial_write(str);
+    ticket_unlock_irqrestore(&console_lock, flags);
 }
 
+// Print text left-aligned in a column of the given width
+void print_padded(const char* text, int width) {
+    print_string(text);
+    for (int i = string_length(text); i < width; i++) print_string(" ");
+}
+
+// Scroll the screen up one line, leaving the cursor where it is
+void console_scroll() {
+    unsigned int flags = ticket_lock_irqsave(&console_lock);
+    scroll_screen();
+    ticket_unlock_irqrestore(&console_lock, flags);
+}
 
 int compare_strings(const char* a, const char* b) {
     while (*a && *b) {
@@ -98,16 +148,18 @@ unsigned int hex_to_uint(const char* str) {
     }
     while (*str) {
         char c = *str++;
-        result <<= 4;
-        if (c >= '0' && c <= '9') result |= c - '0';
-        else if (c >= 'A' && c <= 'F') result |= c - 'A' + 10;
-        else if (c >= 'a' && c <= 'f') result |= c - 'a' + 10;
-        else break;
+        unsigned int digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else break;  // stop at the first non-hex character, e.g. an argument separator
+        result = (result << 4) | digit;
     }
     return result;
 }
 
-// Optional: port I/O, if not moved to separate file
+// Port I/O; the hosted build has stand-ins that only record the writes
+#ifndef HOSTED
 void outb(unsigned short port, unsigned char val) {
     __asm__ __volatile__ ("outb %0, %1" : : "a"(val), "Nd"(port));
 }
@@ -121,8 +173,38 @@ unsigned char inb(unsigned short port) {
     __asm__ __volatile__ ("inb %1, %0" : "=a"(ret) : "Nd"(port));
     return ret;
 }
+#endif
+
+unsigned long long read_tsc() {
+    unsigned int low, high;
+    __asm__ __volatile__ ("rdtsc" : "=a"(low), "=d"(high));
+    return ((unsigned long long)high << 32) | low;
+}
+
+unsigned int tsc_khz = 0;
+
+// Count TSC ticks across 10 ms of PIT channel 2 (the speaker channel, so the
+// system timer is left alone). The gate bit in port 0x61 starts the count.
+void calibrate_tsc() {
+    unsigned char gate = inb(0x61);
+    outb(0x61, gate & ~0x03);               // gate off, speaker off
+    outb(0x43, 0xB0);                       // channel 2, lobyte/hibyte, mode 0
+    outb(0x42, 11932 & 0xFF);               // 1193182 Hz / 100
+    outb(0x42, 11932 >> 8);
+
+    outb(0x61, (gate & ~0x02) | 0x01);      // gate on: counting starts
+    unsigned long long start = read_tsc();
+    unsigned int spins = 0;
+    while (!(inb(0x61) & 0x20) && ++spins < 10000000);
+    unsigned long long elapsed = read_tsc() - start;
+    outb(0x61, gate);
+
+    // 10 ms fits in 32 bits for any clock below 400 GHz
+    tsc_khz = spins < 10000000 ? (unsigned int)elapsed / 10 : 0;
+}
 
 void update_cursor() {
+    metric_add(METRIC_CURSOR_WRITES, 4);
     outb(0x3D4, 0x0F);
     outb(0x3D5, (unsigned char)(cursor_pos & 0xFF));
     outb(0x3D4, 0x0E);
@@ -146,6 +228,58 @@ void copy_string(char* dest, const char* src) {
     *dest = 0;
 }
 
+int string_length(const char* str) {
+    int len = 0;
+    while (str[len]) len++;
+    return len;
+}
+
+int contains_string(const char* str, const char* needle) {
+    if (!*needle) return 1;
+    for (; *str; str++) {
+        if (*str == *needle && starts_with(str, needle)) return 1;
+    }
+    return 0;
+}
+
+// GCC may emit calls to these for struct copies, so they keep their libc names
+#ifndef HOSTED
+void* memset(void* dest, int value, unsigned int count) {
+    unsigned char* d = (unsigned char*)dest;
+    while (count--) *d++ = (unsigned char)value;
+    return dest;
+}
+
+void* memcpy(void* dest, const void* src, unsigned int count) {
+    unsigned char* d = (unsigned char*)dest;
+    const unsigned char* s = (const unsigned char*)src;
+    while (count--) *d++ = *s++;
+    return dest;
+}
+
+void* memmove(void* dest, const void* src, unsigned int count) {
+    unsigned char* d = (unsigned char*)dest;
+    const unsigned char* s = (const unsigned char*)src;
+    if (d < s) {
+        while (count--) *d++ = *s++;
+    } else if (d > s) {
+        d += count;
+        s += count;
+        while (count--) *--d = *--s;
+    }
+    return dest;
+}
+
+int memcmp(const void* a, const void* b, unsigned int count) {
+    const unsigned char* x = (const unsigned char*)a;
+    const unsigned char* y = (const unsigned char*)b;
+    for (unsigned int i = 0; i < count; i++) {
+        if (x[i] != y[i]) return x[i] - y[i];
+    }
+    return 0;
+}
+#endif
+
 int string_to_int(const char* str) {
     int result = 0;
     while (*str >= '0' && *str <= '9') {
@@ -186,3 +320,43 @@ void int_to_string(int value, char* buffer) {
     }
     buffer[j] = 0;
 }
+
+// 64-by-32 bit division in two divl steps (there is no libgcc for __udivdi3)
+unsigned long long u64_div(unsigned long long value, unsigned int divisor) {
+    unsigned int high = (unsigned int)(value >> 32);
+    unsigned int low = (unsigned int)value;
+    unsigned int q_high = high / divisor;
+    unsigned int rem = high % divisor;
+    unsigned int q_low;
+    __asm__ ("divl %2" : "=a"(q_low), "+d"(rem) : "rm"(divisor), "a"(low));
+    return ((unsigned long long)q_high << 32) | q_low;
+}
+
+// 64-bit to decimal using only 32-bit divisions (no libgcc helpers needed)
+void u64_to_string(unsigned long long value, char* buffer) {
+    char temp[21];
+    int i = 0;
+
+    do {
+        unsigned int high = (unsigned int)(value >> 32);
+        unsigned int low = (unsigned int)value;
+
+        unsigned int q_high = high / 10;
+        unsigned int rem = high % 10;
+        unsigned int mid = (rem << 16) | (low >> 16);
+        unsigned int q_mid = mid / 10;
+        rem = mid % 10;
+        unsigned int bottom = (rem << 16) | (low & 0xFFFF);
+        unsigned int q_low = bottom / 10;
+        rem = bottom % 10;
+
+        value = ((unsigned long long)q_high << 32) | (q_mid << 16) | q_low;
+        temp[i++] = '0' + rem;
+    } while (value);
+
+    int j = 0;
+    while (i > 0) {
+        buffer[j++] = temp[--i];
+    }
+    buffer[j] = 0;
+}
@@ -1,6 +1,8 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include "smp.h"
+
 #define VIDEO_MEMORY (char*)0xB8000
 #define WIDTH 80
 #define HEIGHT 25
@@ -17,20 +19,47 @@ extern unsigned short cursor_pos;
 extern char cpu_brand[49];
 extern unsigned char color;
 
+// Where print_string() output goes instead of the screen (pipes, files)
+typedef struct OutputSink {
+    void (*write)(struct OutputSink* sink, const char* str);
+} OutputSink;
+
+// Per CPU: it belongs to the thread running there (see thread.c)
+#define output_sink this_cpu_read(sink)
+#define set_output_sink(target) this_cpu_write(sink, (target))
+
+void cpuid(unsigned int leaf, unsigned int* regs);
 void get_cpu_brand();
 void scroll_if_needed();
+void console_scroll();
 void newline();
 void change_color(const char* str);
 void print_string(const char* str);
+void print_padded(const char* text, int width);
 int compare_strings(const char* a, const char* b);
 unsigned int hex_to_uint(const char* str);
 void outb(unsigned short port, unsigned char val);
 void outw(unsigned short port, unsigned short val);
 unsigned char inb(unsigned short port);
+unsigned long long read_tsc();
+extern unsigned int tsc_khz;    // TSC ticks per millisecond, 0 if unknown
+void calibrate_tsc();
 void update_cursor();
 int starts_with(const char* str, const char* prefix);
 void copy_string(char* dest, const char* src);
+int string_length(const char* str);
+int contains_string(const char* str, const char* needle);
+#ifdef HOSTED
+#include <string.h>     // the C library's, so sanitizers can see them
+#else
+void* memset(void* dest, int value, unsigned int count);
+void* memcpy(void* dest, const void* src, unsigned int count);
+void* memmove(void* dest, const void* src, unsigned int count);
+int memcmp(const void* a, const void* b, unsigned int count);
+#endif
 int string_to_int(const char* str);
 void int_to_string(int value, char* buffer);
+unsigned long long u64_div(unsigned long long value, unsigned int divisor);
+void u64_to_string(unsigned long long value, char* buffer);
 
 #endif
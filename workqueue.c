@@ -0,0 +1,114 @@
+#include "workqueue.h"
+#include "spinlock.h"
+#include "thread.h"
+#include "util.h"
+
+// Producers push onto a lock-free stack (compare-and-swap on the head);
+// the consumer takes the whole stack with one exchange and reverses it,
+// so items still run in the order they were posted. Only the push that
+// makes the queue non-empty takes the lock to wake the worker.
+
+WorkStats work_stats;
+
+static WorkItem* volatile queue_head = 0;   // newest first
+static Spinlock worker_lock;                // worker_waiters
+static WaitQueue worker_waiters;
+static Spinlock consumer_lock;              // one consumer at a time
+
+static unsigned int atomic_xchg(volatile unsigned int* target, unsigned int value) {
+    __asm__ __volatile__ ("xchgl %0, %1" : "+r"(value), "+m"(*target) :: "memory");
+    return value;
+}
+
+static int atomic_cmpxchg(volatile unsigned int* target, unsigned int expected, unsigned int value) {
+    unsigned int previous;
+    __asm__ __volatile__ ("lock cmpxchgl %2, %1"
+                          : "=a"(previous), "+m"(*target)
+                          : "r"(value), "0"(expected)
+                          : "memory");
+    return previous == expected;
+}
+
+static void atomic_add(volatile unsigned int* target, int value) {
+    __asm__ __volatile__ ("lock addl %1, %0" : "+m"(*target) : "ir"(value) : "memory");
+}
+
+// Returns 0 if the item was already waiting
+int work_post(WorkItem* work) {
+    if (atomic_xchg(&work->pending, 1)) {
+        atomic_add(&work_stats.coalesced, 1);
+        return 0;
+    }
+    work->posted = read_tsc();
+    atomic_add(&work_stats.posted, 1);
+    atomic_add((volatile unsigned int*)&work_stats.depth, 1);
+    if (work_stats.depth > work_stats.max_depth) work_stats.max_depth = work_stats.depth;
+
+    WorkItem* head;
+    do {
+        head = queue_head;
+        work->next = head;
+    } while (!atomic_cmpxchg((volatile unsigned int*)&queue_head, (unsigned int)head, (unsigned int)work));
+
+    if (!head) {
+        unsigned int flags = spin_lock_irqsave(&worker_lock);
+        wait_queue_wake_all(&worker_waiters);
+        spin_unlock_irqrestore(&worker_lock, flags);
+    }
+    return 1;
+}
+
+// Run everything posted so far; returns how many items ran
+static int run_pending() {
+    WorkItem* batch = (WorkItem*)atomic_xchg((volatile unsigned int*)&queue_head, 0);
+
+    WorkItem* ordered = 0;
+    while (batch) {
+        WorkItem* next = batch->next;
+        batch->next = ordered;
+        ordered = batch;
+        batch = next;
+    }
+
+    int count = 0;
+    while (ordered) {
+        WorkItem* work = ordered;
+        ordered = work->next;
+
+        unsigned long long latency = read_tsc() - work->posted;
+        work_stats.latency_total += latency;
+        if (latency > work_stats.latency_max) work_stats.latency_max = latency;
+        atomic_add((volatile unsigned int*)&work_stats.depth, -1);
+
+        // Clear first: a post while the item runs queues it again
+        atomic_xchg(&work->pending, 0);
+        work->function(work);
+        work_stats.executed++;
+        count++;
+    }
+    return count;
+}
+
+static void worker_main(void* arg) {
+    while (1) {
+        unsigned int flags = spin_lock_irqsave(&worker_lock);
+        while (!queue_head) wait_queue_sleep(&worker_waiters, &worker_lock);
+        spin_unlock_irqrestore(&worker_lock, flags);
+
+        spin_lock(&consumer_lock);
+        run_pending();
+        spin_unlock(&consumer_lock);
+    }
+}
+
+// Items posted before this run as soon as the worker starts
+void workqueue_init() {
+    thread_create("worker", PRIORITY_HIGH, worker_main, 0);
+}
+
+// Run whatever is waiting in the caller (e.g. before powering off)
+void work_flush() {
+    while (!spin_trylock(&consumer_lock)) thread_yield();
+    while (run_pending());
+    spin_unlock(&consumer_lock);
+}
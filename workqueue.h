@@ -0,0 +1,34 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+// Deferred work ("bottom halves"). Interrupt handlers and other code that
+// must not wait post a WorkItem; a worker thread runs it soon after.
+// Posting an item that is still waiting is a no-op, so bursts of the same
+// request (cursor moves, console flushes) coalesce into one run.
+
+typedef struct WorkItem {
+    struct WorkItem* next;
+    void (*function)(struct WorkItem* work);
+    volatile unsigned int pending;      // posted and not started yet
+    unsigned long long posted;          // TSC of the first post, for latency
+} WorkItem;
+
+#define WORK_ITEM(function) { 0, function, 0, 0 }
+
+typedef struct {
+    volatile unsigned int posted;
+    volatile unsigned int coalesced;    // posts that found the item pending
+    volatile unsigned int executed;
+    volatile int depth;                 // items waiting right now
+    int max_depth;
+    unsigned long long latency_total;   // TSC cycles from post to start
+    unsigned long long latency_max;
+} WorkStats;
+
+extern WorkStats work_stats;
+
+void workqueue_init();
+int work_post(WorkItem* work);
+void work_flush();
+
+#endif